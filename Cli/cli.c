@@ -34,7 +34,7 @@ static void runFile(const char *path)
     
     VM *vm = newVM();
     const char *sourceCode = readFile(path);
-    executeModule(vm, OBJ_TO_VALUE(newObjString(vm, path, strlen(path))), sourceCode);
+    executeModule(vm, OBJ_TO_VALUE(newObjString(vm, path, strlen(path))), sourceCode, path);
 }
 
 //运行命令行
@@ -59,7 +59,7 @@ static void runCli(void)
             exit(0);
         }
         
-        executeModule(vm, OBJ_TO_VALUE(newObjString(vm, "cli", 3)), line);
+        executeModule(vm, OBJ_TO_VALUE(newObjString(vm, "cli", 3)), line, NULL);
         // 添加命令至历史列表
         linenoiseHistoryAdd(line);
         // 保存命令至历史文件
@@ -3,8 +3,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include "common.h"
 
-#define VERSION "0.1.1"
 #define MAX_LINE_LEN 1024
 
 void LOGO()
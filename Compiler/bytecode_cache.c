@@ -0,0 +1,1047 @@
+#include "bytecode_cache.h"
+#include <string.h>
+#include "compiler.h"
+#include "core.h"
+#include "class.h"
+#include "obj_string.h"
+#include "gc.h"
+
+//字节码缓存:把模块编译生成的函数树写入源码文件旁的缓存文件,
+//下次载入同一份源码时直接读入,省去词法分析和编译.构建时预编译的核心模块映像也是这种格式.
+//文件格式(整数按本机字节序存储,缓存只在本机使用):
+//  文件头: 魔数"VTC\0" | 格式版本 | vm版本 | 操作码数 | 源码长度 | 源码哈希 | 其后内容的哈希
+//  模块变量名表 | 方法名表 | 模块函数
+//  名表: 名字个数 | 各名字的长度及内容
+//  函数: 参数个数 | upvalue数 | 指令流 | 常量表,常量表中的函数嵌套存储.所需栈空间载入时推算,不存储
+//指令流中的方法索引存为文件内方法名表的索引,载入时按名字映射回vm->allMethodNames中的索引,
+//模块变量索引同理.内联缓存索引一律存为0,载入时重新分配.
+//载入时校验内容哈希,检查各操作数在常量表、指令流和upvalue的范围内,
+//并沿控制流推算栈深度:各路径汇合处深度须一致,不能弹出栈帧之外的slot,
+//局部变量须在当前栈深度之内.函数所需的栈空间以推算结果为准,不用文件中记录的值.
+//缓存与源码一样是受信任的输入,以下几项要到运行时才能对照,只检查不超过编译器的上限:
+//字段索引与实例的类、接收者的类型、方法的参数个数与调用点.
+//内容哈希只用来发现损坏的文件,防不了有意的篡改
+
+static const char cacheMagic[4] = { 'V', 'T', 'C', '\0' };
+
+//操作码的个数,指令集变化时旧缓存随之失效
+#define OPCODE_SLOTS(opcode, effect) + 1
+static const uint32_t opcodeNum = 0
+#include "opcode.inc"
+;
+#undef OPCODE_SLOTS
+
+//各操作码对栈深度的影响,用于载入时推算函数所需的栈空间
+#define OPCODE_SLOTS(opcode, effect) effect,
+static const int opcodeSlotsUsed[] = {
+#include "opcode.inc"
+};
+#undef OPCODE_SLOTS
+
+typedef enum
+{
+    CONST_NULL,
+    CONST_NUM,
+    CONST_STRING,
+    CONST_FN
+} ConstantTag;   //缓存中常量的类型
+
+typedef struct
+{
+    VM *vm;
+    ByteBuffer fnBytes;  //序列化后的模块函数
+    int *methodMap;      //vm中的方法索引到文件内方法名表索引的映射,未用到的为-1
+    uint32_t *methods;   //文件内的方法名表,存储的是vm中的方法索引
+    uint32_t methodNum;
+} CacheWriter;
+
+typedef struct
+{
+    VM *vm;
+    ObjModule *module;
+    const Byte *cur;
+    const Byte *end;
+    bool isValid;          //读取越界或内容非法时置为false
+    uint32_t *methodMap;   //文件内方法名表索引到vm中方法索引的映射
+    uint32_t methodNum;
+    uint32_t *varMap;      //文件内模块变量名表索引到模块中变量索引的映射
+    uint32_t varNum;
+} CacheReader;
+
+//FNV-1a哈希,用于判断缓存是否过期或已损坏
+static uint64_t hashBytes(const void *data, uint32_t length)
+{
+    const Byte *bytes = (const Byte *)data;
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t idx = 0;
+    while (idx < length)
+    {
+        hash ^= bytes[idx++];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//缓存文件的路径,由主调函数free
+static char *getCachePath(const char *sourcePath)
+{
+    uint32_t length = strlen(sourcePath);
+    char *cachePath = (char *)malloc(length + strlen(BYTECODE_CACHE_SUFFIX) + 1);
+    if (cachePath == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache path failed!");
+    }
+    memcpy(cachePath, sourcePath, length);
+    strcpy(cachePath + length, BYTECODE_CACHE_SUFFIX);
+    return cachePath;
+}
+
+//指令是否带有方法索引,方法索引是紧跟操作码的2字节操作数
+static bool hasMethodOperand(OpCode opCode)
+{
+    return (opCode >= OPCODE_CALL0 && opCode <= OPCODE_SUPER16) ||
+        (opCode >= OPCODE_ADD && opCode <= OPCODE_NEQ) ||
+        opCode == OPCODE_INSTANCE_METHOD || opCode == OPCODE_STATIC_METHOD;
+}
+
+#ifdef INLINE_CACHE
+//方法调用指令中内联缓存索引相对于操作码的偏移,不是方法调用指令时返回0
+static uint32_t inlineCacheOperandOffset(OpCode opCode)
+{
+    if ((opCode >= OPCODE_CALL0 && opCode <= OPCODE_CALL16) ||
+        (opCode >= OPCODE_ADD && opCode <= OPCODE_NEQ))
+    {
+        return 3;   //1字节的操作码和2字节的方法索引之后
+    }
+    if (opCode >= OPCODE_SUPER0 && opCode <= OPCODE_SUPER16)
+    {
+        return 5;   //还有2字节的基类常量索引
+    }
+    return 0;
+}
+#endif
+
+//读取指令流中的2字节操作数,与READ_SHORT一样是大端序
+static uint32_t getShortOperand(const Byte *operand)
+{
+    return (operand[0] << 8) | operand[1];
+}
+
+//改写指令流中的2字节操作数
+static void setShortOperand(Byte *operand, uint32_t value)
+{
+    operand[0] = (value >> 8) & 0xff;
+    operand[1] = value & 0xff;
+}
+
+//向buffer中追加length字节
+static void bufferWrite(VM *vm, ByteBuffer *buffer, const void *data, uint32_t length)
+{
+    const Byte *bytes = (const Byte *)data;
+    uint32_t idx = 0;
+    while (idx < length)
+    {
+        ByteBufferAdd(vm, buffer, bytes[idx++]);
+    }
+}
+
+static void writeBytes(CacheWriter *writer, const void *data, uint32_t length)
+{
+    bufferWrite(writer->vm, &writer->fnBytes, data, length);
+}
+
+static void writeU32(CacheWriter *writer, uint32_t value)
+{
+    writeBytes(writer, &value, sizeof(value));
+}
+
+//返回vm中第index个方法在文件内方法名表中的索引,首次用到时加入方法名表
+static uint32_t mapMethodIndex(CacheWriter *writer, uint32_t index)
+{
+    if (writer->methodMap[index] == -1)
+    {
+        writer->methodMap[index] = writer->methodNum;
+        writer->methods[writer->methodNum++] = index;
+    }
+    return writer->methodMap[index];
+}
+
+//序列化函数fn及其常量表中的函数,遇到无法缓存的常量时返回false
+static bool writeFn(CacheWriter *writer, ObjFn *fn)
+{
+    writeBytes(writer, &fn->argNum, sizeof(fn->argNum));
+    writeU32(writer, fn->upvalueNum);
+    writeU32(writer, fn->instrStream.count);
+
+    //先原样写入指令流,再改写其中的方法索引和内联缓存索引
+    uint32_t start = writer->fnBytes.count;
+    writeBytes(writer, fn->instrStream.datas, fn->instrStream.count);
+    uint32_t ip = 0;
+    while (ip < fn->instrStream.count)
+    {
+        OpCode opCode = (OpCode)fn->instrStream.datas[ip];
+        Byte *instr = writer->fnBytes.datas + start + ip;
+        if (hasMethodOperand(opCode))
+        {
+            setShortOperand(instr + 1, mapMethodIndex(writer, getShortOperand(instr + 1)));
+        }
+#ifdef INLINE_CACHE
+        uint32_t cacheOffset = inlineCacheOperandOffset(opCode);
+        if (cacheOffset != 0)
+        {
+            setShortOperand(instr + cacheOffset, 0);
+        }
+#endif
+        ip += 1 + getBytesOfOperands(fn->instrStream.datas, fn->constants.datas, ip);
+    }
+
+    writeU32(writer, fn->constants.count);
+    uint32_t idx = 0;
+    while (idx < fn->constants.count)
+    {
+        Value constant = fn->constants.datas[idx++];
+        Byte tag;
+        if (VALUE_IS_NULL(constant))
+        {
+            tag = CONST_NULL;
+            writeBytes(writer, &tag, sizeof(tag));
+        }
+        else if (VALUE_IS_NUM(constant))
+        {
+            tag = CONST_NUM;
+            double num = VALUE_TO_NUM(constant);
+            writeBytes(writer, &tag, sizeof(tag));
+            writeBytes(writer, &num, sizeof(num));
+        }
+        else if (VALUE_IS_OBJSTR(constant))
+        {
+            tag = CONST_STRING;
+            ObjString *objString = VALUE_TO_OBJSTR(constant);
+            writeBytes(writer, &tag, sizeof(tag));
+            writeU32(writer, objString->value.length);
+            writeBytes(writer, objString->value.start, objString->value.length);
+        }
+        else if (VALUE_IS_CERTAIN_OBJ(constant, OT_FUNCTION))
+        {
+            tag = CONST_FN;
+            writeBytes(writer, &tag, sizeof(tag));
+            if (!writeFn(writer, VALUE_TO_OBJFN(constant)))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//向映像中写入名字
+static void writeName(VM *vm, ByteBuffer *image, String *name)
+{
+    bufferWrite(vm, image, &name->length, sizeof(name->length));
+    bufferWrite(vm, image, name->str, name->length);
+}
+
+//把模块编译生成的函数fn连同文件头和名表序列化为字节码映像,追加到image.
+//fn中有无法序列化的常量时返回false
+bool dumpBytecode(VM *vm, ObjFn *fn, const char *sourceCode, ByteBuffer *image)
+{
+#ifdef DEBUG
+    //调试版本的函数带有调试信息,不序列化
+    return false;
+#endif
+    CacheWriter writer;
+    writer.vm = vm;
+    ByteBufferInit(&writer.fnBytes);
+    writer.methodNum = 0;
+    writer.methodMap = (int *)malloc(sizeof(int) * (vm->allMethodNames.count + 1));
+    writer.methods = (uint32_t *)malloc(sizeof(uint32_t) * (vm->allMethodNames.count + 1));
+    if (writer.methodMap == NULL || writer.methods == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache method map failed!");
+    }
+    memset(writer.methodMap, -1, sizeof(int) * vm->allMethodNames.count);
+
+    //序列化过程中会分配内存,可能触发gc
+    pushTmpRoot(vm, (ObjHeader *)fn);
+    bool isDumped = writeFn(&writer, fn);
+    if (isDumped)
+    {
+        uint32_t versionLength = strlen(VERSION);
+        uint32_t sourceLength = strlen(sourceCode);
+        uint64_t sourceHash = hashBytes(sourceCode, sourceLength);
+        uint32_t cacheVersion = BYTECODE_CACHE_VERSION;
+        bufferWrite(vm, image, cacheMagic, sizeof(cacheMagic));
+        bufferWrite(vm, image, &cacheVersion, sizeof(cacheVersion));
+        bufferWrite(vm, image, &versionLength, sizeof(versionLength));
+        bufferWrite(vm, image, VERSION, versionLength);
+        bufferWrite(vm, image, &opcodeNum, sizeof(opcodeNum));
+        bufferWrite(vm, image, &sourceLength, sizeof(sourceLength));
+        bufferWrite(vm, image, &sourceHash, sizeof(sourceHash));
+
+        //内容哈希先占位,写完其后的内容再回填
+        uint64_t payloadHash = 0;
+        uint32_t hashOffset = image->count;
+        bufferWrite(vm, image, &payloadHash, sizeof(payloadHash));
+        uint32_t payloadStart = image->count;
+
+        ObjModule *objModule = fn->module;
+        bufferWrite(vm, image, &objModule->moduleVarName.count, sizeof(uint32_t));
+        uint32_t idx = 0;
+        while (idx < objModule->moduleVarName.count)
+        {
+            writeName(vm, image, &objModule->moduleVarName.datas[idx++]);
+        }
+
+        bufferWrite(vm, image, &writer.methodNum, sizeof(writer.methodNum));
+        idx = 0;
+        while (idx < writer.methodNum)
+        {
+            writeName(vm, image, &vm->allMethodNames.datas[writer.methods[idx++]]);
+        }
+
+        bufferWrite(vm, image, writer.fnBytes.datas, writer.fnBytes.count);
+        payloadHash = hashBytes(image->datas + payloadStart, image->count - payloadStart);
+        memcpy(image->datas + hashOffset, &payloadHash, sizeof(payloadHash));
+    }
+    popTmpRoot(vm);
+
+    ByteBufferClear(vm, &writer.fnBytes);
+    free(writer.methodMap);
+    free(writer.methods);
+    return isDumped;
+}
+
+//把image写入缓存文件cachePath
+static void writeCacheFile(ByteBuffer *image, const char *cachePath)
+{
+    //先写到临时文件再改名,避免其它进程读到写了一半的缓存
+    char *tmpPath = (char *)malloc(strlen(cachePath) + strlen(".tmp") + 1);
+    if (tmpPath == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache path failed!");
+    }
+    strcpy(tmpPath, cachePath);
+    strcat(tmpPath, ".tmp");
+
+    //目录不可写时不缓存,不影响运行
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        free(tmpPath);
+        return;
+    }
+
+    bool isWritten = fwrite(image->datas, 1, image->count, file) == image->count;
+    if (fclose(file) != 0)
+    {
+        isWritten = false;
+    }
+    if (!isWritten || rename(tmpPath, cachePath) != 0)
+    {
+        remove(tmpPath);
+    }
+    free(tmpPath);
+}
+
+//把模块编译生成的函数fn写入源码文件sourcePath对应的缓存文件
+void saveBytecodeCache(VM *vm, ObjFn *fn, const char *sourcePath, const char *sourceCode)
+{
+    ByteBuffer image;
+    ByteBufferInit(&image);
+    if (dumpBytecode(vm, fn, sourceCode, &image))
+    {
+        char *cachePath = getCachePath(sourcePath);
+        writeCacheFile(&image, cachePath);
+        free(cachePath);
+    }
+    ByteBufferClear(vm, &image);
+}
+
+//从缓存中读取length字节,越界时返回NULL
+static const Byte *readBytes(CacheReader *reader, uint32_t length)
+{
+    if (!reader->isValid || (uint64_t)(reader->end - reader->cur) < length)
+    {
+        reader->isValid = false;
+        return NULL;
+    }
+    const Byte *bytes = reader->cur;
+    reader->cur += length;
+    return bytes;
+}
+
+static Byte readU8(CacheReader *reader)
+{
+    const Byte *bytes = readBytes(reader, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint32_t readU32(CacheReader *reader)
+{
+    uint32_t value = 0;
+    const Byte *bytes = readBytes(reader, sizeof(value));
+    if (bytes != NULL)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+//检查文件头,缓存与源码sourceCode及当前vm都匹配时返回true
+static bool checkHeader(CacheReader *reader, const char *sourceCode)
+{
+    const Byte *magic = readBytes(reader, sizeof(cacheMagic));
+    if (magic == NULL || memcmp(magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        readU32(reader) != BYTECODE_CACHE_VERSION)
+    {
+        return false;
+    }
+
+    uint32_t versionLength = readU32(reader);
+    const Byte *version = readBytes(reader, versionLength);
+    if (version == NULL || versionLength != strlen(VERSION) ||
+        memcmp(version, VERSION, versionLength) != 0 ||
+        readU32(reader) != opcodeNum)
+    {
+        return false;
+    }
+
+    uint32_t sourceLength = strlen(sourceCode);
+    uint64_t sourceHash = 0;
+    if (readU32(reader) != sourceLength)
+    {
+        return false;
+    }
+    const Byte *hash = readBytes(reader, sizeof(sourceHash));
+    if (hash == NULL)
+    {
+        return false;
+    }
+    memcpy(&sourceHash, hash, sizeof(sourceHash));
+    if (sourceHash != hashBytes(sourceCode, sourceLength))
+    {
+        return false;
+    }
+
+    uint64_t payloadHash = 0;
+    hash = readBytes(reader, sizeof(payloadHash));
+    if (hash == NULL)
+    {
+        return false;
+    }
+    memcpy(&payloadHash, hash, sizeof(payloadHash));
+    return payloadHash == hashBytes(reader->cur, reader->end - reader->cur);
+}
+
+//读入名表,返回文件内索引到vm中索引的映射,由主调函数free.
+//isMethod为真时是方法名表,名字不存在就加入vm->allMethodNames,
+//否则是模块变量名表,变量不存在就在模块中定义
+static uint32_t *readNameTable(CacheReader *reader, uint32_t *nameNum, bool isMethod)
+{
+    *nameNum = readU32(reader);
+
+    //每个名字至少占4字节的长度,据此排除损坏的名字个数
+    if (!reader->isValid || *nameNum > (uint32_t)(reader->end - reader->cur) / sizeof(uint32_t))
+    {
+        reader->isValid = false;
+        return NULL;
+    }
+
+    uint32_t *map = (uint32_t *)malloc(sizeof(uint32_t) * (*nameNum + 1));
+    if (map == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache name map failed!");
+    }
+    uint32_t idx = 0;
+    while (idx < *nameNum)
+    {
+        uint32_t length = readU32(reader);
+        const char *name = (const char *)readBytes(reader, length);
+        if (name == NULL || length == 0 || length > MAX_ID_LEN)
+        {
+            reader->isValid = false;
+            break;
+        }
+
+        if (isMethod)
+        {
+            map[idx] = ensureSymbolExist(reader->vm, &reader->vm->allMethodNames, name, length);
+        }
+        else
+        {
+            int index = getIndexFromSymbolTable(&reader->module->moduleVarName, name, length);
+            if (index == -1)
+            {
+                index = defineModuleVar(reader->vm, reader->module,
+                    name, length, VT_TO_VALUE(VT_NULL));
+            }
+            map[idx] = index;
+        }
+        idx++;
+    }
+    return map;
+}
+
+#ifdef INLINE_CACHE
+//为方法调用点分配内联缓存,返回缓存索引
+static uint32_t newInlineCache(CacheReader *reader, ObjFn *fn)
+{
+    //调用点过多时交给编译器报错
+    if (fn->inlineCaches.count > UINT16_MAX)
+    {
+        reader->isValid = false;
+        return 0;
+    }
+    InlineCache emptyCache = { .entryNum = 0 };
+    InlineCacheBufferAdd(reader->vm, &fn->inlineCaches, emptyCache);
+    return fn->inlineCaches.count - 1;
+}
+#endif
+
+//跳转指令的目标地址,偏移量不合法时返回指令流的长度.
+//JUMP一类向前跳,LOOP向后跳,偏移量都相对于操作数之后的地址,且为正数
+static uint32_t jumpTarget(ObjFn *fn, uint32_t ip)
+{
+    OpCode opCode = (OpCode)fn->instrStream.datas[ip];
+    int16_t offset = (int16_t)getShortOperand(fn->instrStream.datas + ip + 1);
+    uint32_t next = ip + 3;
+    if (offset <= 0)
+    {
+        return fn->instrStream.count;
+    }
+    if (opCode == OPCODE_LOOP)
+    {
+        return (uint32_t)offset > next ? fn->instrStream.count : next - offset;
+    }
+    return next + offset < fn->instrStream.count ? next + offset : fn->instrStream.count;
+}
+
+//是否为带2字节跳转偏移量的指令
+static bool isJump(OpCode opCode)
+{
+    return opCode == OPCODE_JUMP || opCode == OPCODE_LOOP || opCode == OPCODE_JUMP_IF_FALSE ||
+        opCode == OPCODE_AND || opCode == OPCODE_OR;
+}
+
+//检查ip处指令的常量、局部变量、upvalue和字段操作数是否越界
+static bool checkOperands(ObjFn *fn, uint32_t ip)
+{
+    const Byte *instr = fn->instrStream.datas + ip;
+    switch ((OpCode)instr[0])
+    {
+    case OPCODE_LOAD_CONSTANT:
+        return getShortOperand(instr + 1) < fn->constants.count;
+
+    case OPCODE_LOAD_UPVALUE:
+    case OPCODE_STORE_UPVALUE:
+        return instr[1] < fn->upvalueNum;
+
+    case OPCODE_LOAD_THIS_FIELD:
+    case OPCODE_STORE_THIS_FIELD:
+    case OPCODE_LOAD_FIELD:
+    case OPCODE_STORE_FIELD:
+        return instr[1] < MAX_FIELD_NUM;
+
+    case OPCODE_CREATE_CLASS:
+        return instr[1] <= MAX_FIELD_NUM;
+
+    case OPCODE_CREATE_CLOSURE:
+    {
+        //每个upvalue一对儿操作数:是否为直接外层的局部变量,及其在外层中的索引.
+        //局部变量由checkStackDepth检查
+        ObjFn *closureFn = VALUE_TO_OBJFN(fn->constants.datas[getShortOperand(instr + 1)]);
+        uint32_t idx = 0;
+        while (idx < closureFn->upvalueNum)
+        {
+            const Byte *pair = instr + 3 + idx * 2;
+            if (!pair[0] && pair[1] >= fn->upvalueNum)
+            {
+                return false;
+            }
+            idx++;
+        }
+        return true;
+    }
+
+    default:
+        if (instr[0] >= OPCODE_SUPER0 && instr[0] <= OPCODE_SUPER16)
+        {   //基类常量由bindMethodAndPatch回填,缓存中是占位的null
+            uint32_t superIdx = getShortOperand(instr + 3);
+            return superIdx < fn->constants.count && VALUE_IS_NULL(fn->constants.datas[superIdx]);
+        }
+        if (isJump((OpCode)instr[0]))
+        {
+            return jumpTarget(fn, ip) < fn->instrStream.count;
+        }
+        return true;
+    }
+}
+
+//指令要从栈顶读取的slot数
+static uint32_t slotsRead(OpCode opCode)
+{
+    if (opCode >= OPCODE_CALL0 && opCode <= OPCODE_CALL16)
+    {
+        return opCode - OPCODE_CALL0 + 1;
+    }
+    if (opCode >= OPCODE_SUPER0 && opCode <= OPCODE_SUPER16)
+    {
+        return opCode - OPCODE_SUPER0 + 1;
+    }
+    switch (opCode)
+    {
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_DIV:
+    case OPCODE_LT:
+    case OPCODE_LE:
+    case OPCODE_GT:
+    case OPCODE_GE:
+    case OPCODE_EQ:
+    case OPCODE_NEQ:
+    case OPCODE_STORE_FIELD:
+    case OPCODE_CREATE_CLASS:
+    case OPCODE_INSTANCE_METHOD:
+    case OPCODE_STATIC_METHOD:
+        return 2;
+
+    case OPCODE_STORE_LOCAL_VAR:
+    case OPCODE_STORE_UPVALUE:
+    case OPCODE_STORE_MODULE_VAR:
+    case OPCODE_STORE_THIS_FIELD:
+    case OPCODE_LOAD_FIELD:
+    case OPCODE_POP:
+    case OPCODE_JUMP_IF_FALSE:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_CLOSE_UPVALUE:
+    case OPCODE_RETURN:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+//ip处的指令在栈深度为depth时所用的局部变量都在栈中
+static bool checkLocals(ObjFn *fn, uint32_t ip, uint32_t depth)
+{
+    const Byte *instr = fn->instrStream.datas + ip;
+    switch ((OpCode)instr[0])
+    {
+    case OPCODE_LOAD_LOCAL_VAR:
+    case OPCODE_STORE_LOCAL_VAR:
+        return instr[1] < depth;
+
+    case OPCODE_CREATE_CLOSURE:
+    {
+        ObjFn *closureFn = VALUE_TO_OBJFN(fn->constants.datas[getShortOperand(instr + 1)]);
+        uint32_t idx = 0;
+        while (idx < closureFn->upvalueNum)
+        {
+            const Byte *pair = instr + 3 + idx * 2;
+            if (pair[0] && pair[1] >= depth)
+            {
+                return false;
+            }
+            idx++;
+        }
+        return true;
+    }
+
+    default:
+        return true;
+    }
+}
+
+//把深度为depth的栈状态传到指令target处,与已经到达target的深度不一致时返回false
+static bool reachInstr(int *depths, uint32_t *pending, uint32_t *pendingNum,
+    uint32_t target, int depth)
+{
+    if (depths[target] == -1)
+    {
+        depths[target] = depth;
+        pending[(*pendingNum)++] = target;
+        return true;
+    }
+    return depths[target] == depth;
+}
+
+//沿控制流推算fn的栈深度,即栈帧中已用的slot数.
+//函数和方法开始时栈帧中有接收者和argNum个参数,模块函数的栈帧开始时为空.
+//返回最大深度,指令流对栈的使用不合法时返回-1
+static int checkStackDepth(ObjFn *fn, bool isModuleFn)
+{
+    uint32_t count = fn->instrStream.count;
+    const Byte *instrs = fn->instrStream.datas;
+    int *depths = (int *)malloc(sizeof(int) * count);
+    uint32_t *pending = (uint32_t *)malloc(sizeof(uint32_t) * count);
+    if (depths == NULL || pending == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache stack map failed!");
+    }
+    memset(depths, -1, sizeof(int) * count);
+
+    uint32_t pendingNum = 0;
+    int maxDepth = isModuleFn ? 0 : 1 + fn->argNum;
+    bool isValid = reachInstr(depths, pending, &pendingNum, 0, maxDepth);
+    while (pendingNum > 0 && isValid)
+    {
+        uint32_t ip = pending[--pendingNum];
+        OpCode opCode = (OpCode)instrs[ip];
+        int depth = depths[ip];
+        int next = depth + opcodeSlotsUsed[opCode];
+        if (depth < (int)slotsRead(opCode) || next < 0 || !checkLocals(fn, ip, depth))
+        {
+            isValid = false;
+            break;
+        }
+        if (next > maxDepth)
+        {
+            maxDepth = next;
+        }
+
+        uint32_t fallThrough = ip + 1 + getBytesOfOperands(fn->instrStream.datas, fn->constants.datas, ip);
+        switch (opCode)
+        {
+        case OPCODE_RETURN:
+        case OPCODE_END:
+            break;
+
+        case OPCODE_JUMP:
+        case OPCODE_LOOP:
+            isValid = reachInstr(depths, pending, &pendingNum, jumpTarget(fn, ip), next);
+            break;
+
+        case OPCODE_AND:
+        case OPCODE_OR:
+            //跳转时条件留在栈顶,不跳转时才弹出
+            isValid = reachInstr(depths, pending, &pendingNum, jumpTarget(fn, ip), depth) &&
+                reachInstr(depths, pending, &pendingNum, fallThrough, next);
+            break;
+
+        case OPCODE_JUMP_IF_FALSE:
+            isValid = reachInstr(depths, pending, &pendingNum, jumpTarget(fn, ip), next) &&
+                reachInstr(depths, pending, &pendingNum, fallThrough, next);
+            break;
+
+        default:
+            //指令流以OPCODE_END结尾,不会越过末尾
+            isValid = reachInstr(depths, pending, &pendingNum, fallThrough, next);
+            break;
+        }
+    }
+
+    free(depths);
+    free(pending);
+    return isValid ? maxDepth : -1;
+}
+
+//把fn指令流中文件内的方法索引和模块变量索引映射为vm中的索引,并为调用点分配内联缓存.
+//同时检查各操作数,跳转目标须是某条指令的起始处,指令流须以OPCODE_END结尾
+static void relocateInstrStream(CacheReader *reader, ObjFn *fn, bool isModuleFn)
+{
+    Byte *instrs = fn->instrStream.datas;
+    uint32_t count = fn->instrStream.count;
+    if (count == 0 || instrs[count - 1] != OPCODE_END)
+    {
+        reader->isValid = false;
+        return;
+    }
+
+    //标记各指令的起始处,供最后检查跳转目标
+    bool *isInstrStart = (bool *)calloc(count, sizeof(bool));
+    if (isInstrStart == NULL)
+    {
+        MEM_ERROR("allocate bytecode cache instruction map failed!");
+    }
+    uint32_t ip = 0;
+    while (ip < count && reader->isValid)
+    {
+        OpCode opCode = (OpCode)instrs[ip];
+        if (opCode >= opcodeNum)
+        {
+            reader->isValid = false;
+            break;
+        }
+
+        //getBytesOfOperands要从常量表中读取闭包函数的upvalue数,先确认常量是函数
+        if (opCode == OPCODE_CREATE_CLOSURE)
+        {
+            uint32_t fnIdx = ip + 2 < count ? getShortOperand(instrs + ip + 1) : fn->constants.count;
+            if (fnIdx >= fn->constants.count ||
+                !VALUE_IS_CERTAIN_OBJ(fn->constants.datas[fnIdx], OT_FUNCTION))
+            {
+                reader->isValid = false;
+                break;
+            }
+        }
+        uint32_t length = 1 + getBytesOfOperands(instrs, fn->constants.datas, ip);
+        if (ip + length > count || !checkOperands(fn, ip))
+        {
+            reader->isValid = false;
+            break;
+        }
+        isInstrStart[ip] = true;
+
+        if (hasMethodOperand(opCode))
+        {
+            uint32_t local = getShortOperand(instrs + ip + 1);
+            if (local >= reader->methodNum)
+            {
+                reader->isValid = false;
+                break;
+            }
+            setShortOperand(instrs + ip + 1, reader->methodMap[local]);
+        }
+        else if (opCode == OPCODE_LOAD_MODULE_VAR || opCode == OPCODE_STORE_MODULE_VAR)
+        {
+            uint32_t local = getShortOperand(instrs + ip + 1);
+            if (local >= reader->varNum)
+            {
+                reader->isValid = false;
+                break;
+            }
+            setShortOperand(instrs + ip + 1, reader->varMap[local]);
+        }
+
+#ifdef INLINE_CACHE
+        uint32_t cacheOffset = inlineCacheOperandOffset(opCode);
+        if (cacheOffset != 0)
+        {
+            setShortOperand(instrs + ip + cacheOffset, newInlineCache(reader, fn));
+        }
+#endif
+        ip += length;
+    }
+
+    ip = 0;
+    while (ip < count && reader->isValid)
+    {
+        if (isJump((OpCode)instrs[ip]) && !isInstrStart[jumpTarget(fn, ip)])
+        {
+            reader->isValid = false;
+        }
+        ip += 1 + getBytesOfOperands(instrs, fn->constants.datas, ip);
+    }
+    free(isInstrStart);
+    if (!reader->isValid)
+    {
+        return;
+    }
+
+    //调用时在接收者和参数之上再分配maxStackSlotUsedNum个slot,
+    //取整个栈帧的最大深度就足够了,即便文件中记录的参数个数与调用时不符
+    int maxDepth = checkStackDepth(fn, isModuleFn);
+    if (maxDepth < 0)
+    {
+        reader->isValid = false;
+        return;
+    }
+    fn->maxStackSlotUsedNum = maxDepth;
+}
+
+//向fn的常量表中添加常量
+static void addConstant(CacheReader *reader, ObjFn *fn, Value constant)
+{
+    //常量可能是刚创建的对象,在加入常量表之前避免被gc回收
+    if (VALUE_IS_OBJ(constant))
+    {
+        pushTmpRoot(reader->vm, VALUE_TO_OBJ(constant));
+    }
+    ValueBufferAdd(reader->vm, &fn->constants, constant);
+    WRITE_BARRIER_VALUE(reader->vm, fn, constant);
+    if (VALUE_IS_OBJ(constant))
+    {
+        popTmpRoot(reader->vm);
+    }
+}
+
+//读入一个函数,parent不为NULL时读入的函数是parent的常量
+static ObjFn *readFn(CacheReader *reader, ObjFn *parent)
+{
+    Byte argNum = readU8(reader);
+    uint32_t upvalueNum = readU32(reader);
+    uint32_t instrNum = readU32(reader);
+    const Byte *instrs = readBytes(reader, instrNum);
+    //模块函数没有upvalue
+    if (upvalueNum > MAX_UPVALUE_NUM || argNum > MAX_ARG_NUM || (parent == NULL && upvalueNum != 0))
+    {
+        reader->isValid = false;
+    }
+    if (instrs == NULL || !reader->isValid)
+    {
+        return NULL;
+    }
+
+    //所需栈空间在relocateInstrStream中推算
+    ObjFn *fn = newObjFn(reader->vm, reader->module, 0);
+
+    //内层函数先挂到外层函数的常量表上,顶层函数在读入期间放在临时根中
+    if (parent != NULL)
+    {
+        addConstant(reader, parent, OBJ_TO_VALUE(fn));
+    }
+    else
+    {
+        pushTmpRoot(reader->vm, (ObjHeader *)fn);
+    }
+    fn->argNum = argNum;
+    fn->upvalueNum = upvalueNum;
+    if (instrNum > 0)
+    {
+        ByteBufferFillWrite(reader->vm, &fn->instrStream, 0, instrNum);
+        memcpy(fn->instrStream.datas, instrs, instrNum);
+    }
+
+    uint32_t constantNum = readU32(reader);
+    uint32_t idx = 0;
+    while (idx < constantNum && reader->isValid)
+    {
+        switch (readU8(reader))
+        {
+        case CONST_NULL:
+            addConstant(reader, fn, VT_TO_VALUE(VT_NULL));
+            break;
+
+        case CONST_NUM:
+        {
+            double num;
+            const Byte *bytes = readBytes(reader, sizeof(num));
+            if (bytes != NULL)
+            {
+                memcpy(&num, bytes, sizeof(num));
+                addConstant(reader, fn, NUM_TO_VALUE(num));
+            }
+            break;
+        }
+
+        case CONST_STRING:
+        {
+            uint32_t length = readU32(reader);
+            const char *str = (const char *)readBytes(reader, length);
+            if (str != NULL)
+            {
+                addConstant(reader, fn, OBJ_TO_VALUE(newInternedString(reader->vm, str, length)));
+            }
+            break;
+        }
+
+        case CONST_FN:
+            readFn(reader, fn);
+            break;
+
+        default:
+            reader->isValid = false;
+            break;
+        }
+        idx++;
+    }
+
+    if (reader->isValid)
+    {
+        relocateInstrStream(reader, fn, parent == NULL);
+    }
+    if (parent == NULL)
+    {
+        popTmpRoot(reader->vm);
+    }
+    return reader->isValid ? fn : NULL;
+}
+
+//读入整个缓存文件,文件不存在时返回NULL,由主调函数free
+static Byte *readCacheFile(const char *cachePath, uint32_t *fileSize)
+{
+    FILE *file = fopen(cachePath, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    Byte *content = NULL;
+    long size;
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 &&
+        fseek(file, 0, SEEK_SET) == 0)
+    {
+        content = (Byte *)malloc(size);
+        if (content != NULL && fread(content, 1, size, file) != (size_t)size)
+        {
+            free(content);
+            content = NULL;
+        }
+        *fileSize = (uint32_t)size;
+    }
+    fclose(file);
+    return content;
+}
+
+//撤销载入过程中新定义的模块变量,使模块恢复原状以便重新编译
+static void undefineModuleVars(VM *vm, ObjModule *objModule, uint32_t varNum)
+{
+    truncateSymbolTable(vm, &objModule->moduleVarName, varNum);
+    objModule->moduleVarValue.count = varNum;
+}
+
+//从字节码映像image中载入模块objModule的函数,
+//映像与源码sourceCode或当前vm不符、或已损坏时返回NULL
+ObjFn *undumpBytecode(VM *vm, ObjModule *objModule,
+    const Byte *image, uint32_t size, const char *sourceCode)
+{
+#ifdef DEBUG
+    //调试版本的函数带有调试信息,不从映像载入
+    return NULL;
+#endif
+    CacheReader reader;
+    reader.vm = vm;
+    reader.module = objModule;
+    reader.cur = image;
+    reader.end = image + size;
+    reader.isValid = image != NULL;
+    reader.methodMap = reader.varMap = NULL;
+    reader.methodNum = reader.varNum = 0;
+
+    ObjFn *fn = NULL;
+    if (checkHeader(&reader, sourceCode))
+    {
+        uint32_t varNumBefore = objModule->moduleVarName.count;
+        reader.varMap = readNameTable(&reader, &reader.varNum, false);
+        reader.methodMap = readNameTable(&reader, &reader.methodNum, true);
+        if (reader.isValid)
+        {
+            fn = readFn(&reader, NULL);
+        }
+        if (fn == NULL || reader.cur != reader.end)
+        {
+            fn = NULL;
+            undefineModuleVars(vm, objModule, varNumBefore);
+        }
+    }
+
+    free(reader.varMap);
+    free(reader.methodMap);
+    return fn;
+}
+
+//从源码文件sourcePath对应的缓存文件中载入模块objModule的函数,
+//缓存不存在、已过期或已损坏时返回NULL
+ObjFn *loadBytecodeCache(VM *vm, ObjModule *objModule,
+    const char *sourcePath, const char *sourceCode)
+{
+    char *cachePath = getCachePath(sourcePath);
+    uint32_t fileSize = 0;
+    Byte *content = readCacheFile(cachePath, &fileSize);
+    free(cachePath);
+    if (content == NULL)
+    {
+        return NULL;
+    }
+
+    ObjFn *fn = undumpBytecode(vm, objModule, content, fileSize, sourceCode);
+    free(content);
+    return fn;
+}
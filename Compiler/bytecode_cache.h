@@ -0,0 +1,27 @@
+#ifndef _COMPILER_BYTECODE_CACHE_H
+#define _COMPILER_BYTECODE_CACHE_H
+
+#include "obj_fn.h"
+
+//字节码缓存文件的格式版本,文件格式或指令编码变化时加1.
+//定义了INLINE_CACHE时方法调用指令多2字节的缓存索引,用最高位区分,两种缓存文件不能混用
+#ifdef INLINE_CACHE
+#define BYTECODE_CACHE_VERSION (3 | 0x80000000u)
+#else
+#define BYTECODE_CACHE_VERSION 3
+#endif
+
+//字节码缓存文件的扩展名,缓存文件就是源码文件的路径后加'c',如foo.vt的缓存是foo.vtc
+#define BYTECODE_CACHE_SUFFIX "c"
+
+bool dumpBytecode(VM *vm, ObjFn *fn, const char *sourceCode, ByteBuffer *image);
+
+ObjFn *undumpBytecode(VM *vm, ObjModule *objModule,
+    const Byte *image, uint32_t size, const char *sourceCode);
+
+ObjFn *loadBytecodeCache(VM *vm, ObjModule *objModule,
+    const char *sourcePath, const char *sourceCode);
+
+void saveBytecodeCache(VM *vm, ObjFn *fn, const char *sourcePath, const char *sourceCode);
+
+#endif
@@ -1,6 +1,7 @@
 #include "compiler.h"
 #include "parser.h"
 #include "core.h"
+#include "gc.h"
 #include <string.h>
 
 #if DEBUG
@@ -130,6 +131,7 @@ static void initCompileUnit(Parser *parser, CompileUnit *cu,
     parser->curCompileUnit = cu;
     cu->curParser = parser;
     cu->enclosingUnit = enclosingUnit;
+    cu->fn = NULL;   //在newObjFn中可能触发gc,此前fn须有合法值
     cu->curLoop = NULL;
     cu->enclosingClassBK = NULL;
     
@@ -226,6 +228,21 @@ static void writeOpCodeShortOperand(CompileUnit *cu, OpCode opCode, int operand)
     writeShortOperand(cu, operand);
 }
 
+//为方法调用指令分配一个内联缓存,写入2字节的缓存索引.
+//未定义INLINE_CACHE时不分配缓存也不写入索引
+static void writeInlineCache(CompileUnit *cu UNUSED)
+{
+#ifdef INLINE_CACHE
+    if (cu->fn->inlineCaches.count > UINT16_MAX)
+    {
+        COMPILE_ERROR(cu->curParser, "the function has too many call sites!");
+    }
+    InlineCache emptyCache = { .entryNum = 0 };
+    InlineCacheBufferAdd(cu->curParser->vm, &cu->fn->inlineCaches, emptyCache);
+    writeShortOperand(cu, cu->fn->inlineCaches.count - 1);
+#endif
+}
+
 //在模块objModule中定义名为name,值为value的模块变量
 int defineModuleVar(VM *vm, ObjModule *objModule,
     const char *name, uint32_t length, Value value)
@@ -253,16 +270,29 @@ int defineModuleVar(VM *vm, ObjModule *objModule,
     int symbolIndex = getIndexFromSymbolTable(&objModule->moduleVarName, name, length);
     if (symbolIndex == -1)
     {
+        //value可能是尚未挂到其它可达对象上的新对象,添加过程中避免被gc回收
+        if (VALUE_IS_OBJ(value))
+        {
+            pushTmpRoot(vm, VALUE_TO_OBJ(value));
+        }
+        
         //添加变量名
         symbolIndex = addSymbol(vm, &objModule->moduleVarName, name, length);
         //添加变量值
         ValueBufferAdd(vm, &objModule->moduleVarValue, value);
+        WRITE_BARRIER_VALUE(vm, objModule, value);
+        
+        if (VALUE_IS_OBJ(value))
+        {
+            popTmpRoot(vm);
+        }
         
     }
     else if (VALUE_IS_NUM(objModule->moduleVarValue.datas[symbolIndex]))
     {
         //若遇到之前预先声明的模块变量的定义,在此为其赋予正确的值
         objModule->moduleVarValue.datas[symbolIndex] = value;
+        WRITE_BARRIER_VALUE(vm, objModule, value);
         
     }
     else
@@ -461,6 +491,7 @@ static void emitCallBySignature(CompileUnit *cu, Signature *sign, OpCode opcode)
     {
         writeShortOperand(cu, addConstant(cu, VT_TO_VALUE(VT_NULL)));
     }
+    writeInlineCache(cu);
 }
 
 //声明模块变量,与defineModuleVar的区别是不做重定义检查,默认为声明
@@ -1184,7 +1215,17 @@ static void super(CompileUnit *cu, bool canAssign)
 //添加常量并返回其索引
 static uint32_t addConstant(CompileUnit *cu, Value constant)
 {
+    //常量可能是刚创建的字符串,在加入常量表之前避免被gc回收
+    if (VALUE_IS_OBJ(constant))
+    {
+        pushTmpRoot(cu->curParser->vm, VALUE_TO_OBJ(constant));
+    }
     ValueBufferAdd(cu->curParser->vm, &cu->fn->constants, constant);
+    WRITE_BARRIER_VALUE(cu->curParser->vm, cu->fn, constant);
+    if (VALUE_IS_OBJ(constant))
+    {
+        popTmpRoot(cu->curParser->vm);
+    }
     return cu->fn->constants.count - 1;
 }
 
@@ -1220,6 +1261,7 @@ static void emitCall(CompileUnit *cu, int numArgs, const char *name, int length)
     int symbolIndex = ensureSymbolExist(cu->curParser->vm,
         &cu->curParser->vm->allMethodNames, name, length);
     writeOpCodeShortOperand(cu, OPCODE_CALL0 + numArgs, symbolIndex);
+    writeInlineCache(cu);
 }
 
 //生成加载类的指令
@@ -1696,7 +1738,8 @@ static void expression(CompileUnit *cu, BindPower rbp)
 //中缀运算符.led方法
 static void infixOperator(CompileUnit *cu, bool canAssign UNUSED)
 {
-    SymbolBindRule *rule = &Rules[cu->curParser->preToken.type];
+    TokenType operatorType = cu->curParser->preToken.type;
+    SymbolBindRule *rule = &Rules[operatorType];
     
     //中缀运算符对左右操作数的绑定权值一样
     BindPower rbp = rule->lbp;
@@ -1704,7 +1747,53 @@ static void infixOperator(CompileUnit *cu, bool canAssign UNUSED)
     
     //生成1个参数的签名
     Signature sign = { SIGN_METHOD, rule->id, strlen(rule->id), 1 };
-    emitCallBySignature(cu, &sign, OPCODE_CALL0);
+    
+    //算术和比较运算有专门的指令,两个操作数都是数字时直接计算,
+    //否则和OPCODE_CALL1一样调用方法,因此操作数也与之相同
+    OpCode opCode;
+    switch (operatorType)
+    {
+    case TOKEN_ADD:
+        opCode = OPCODE_ADD;
+        break;
+    case TOKEN_SUB:
+        opCode = OPCODE_SUB;
+        break;
+    case TOKEN_MUL:
+        opCode = OPCODE_MUL;
+        break;
+    case TOKEN_DIV:
+        opCode = OPCODE_DIV;
+        break;
+    case TOKEN_LESS:
+        opCode = OPCODE_LT;
+        break;
+    case TOKEN_LESS_EQUAL:
+        opCode = OPCODE_LE;
+        break;
+    case TOKEN_GREATE:
+        opCode = OPCODE_GT;
+        break;
+    case TOKEN_GREATE_EQUAL:
+        opCode = OPCODE_GE;
+        break;
+    case TOKEN_EQUAL:
+        opCode = OPCODE_EQ;
+        break;
+    case TOKEN_NOT_EQUAL:
+        opCode = OPCODE_NEQ;
+        break;
+    default:
+        emitCallBySignature(cu, &sign, OPCODE_CALL0);
+        return;
+    }
+    
+    char signBuffer[MAX_SIGN_LEN];
+    uint32_t length = sign2String(&sign, signBuffer);
+    int symbolIndex = ensureSymbolExist(cu->curParser->vm,
+        &cu->curParser->vm->allMethodNames, signBuffer, length);
+    writeOpCodeShortOperand(cu, opCode, symbolIndex);
+    writeInlineCache(cu);
 }
 
 //前缀运算符.nud方法, 如'-','!'等
@@ -1957,6 +2046,19 @@ uint32_t getBytesOfOperands(Byte *instrStream,
     case OPCODE_CALL14:
     case OPCODE_CALL15:
     case OPCODE_CALL16:
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_DIV:
+    case OPCODE_LT:
+    case OPCODE_LE:
+    case OPCODE_GT:
+    case OPCODE_GE:
+    case OPCODE_EQ:
+    case OPCODE_NEQ:
+        //OPCODE_CALLx和算术比较指令的操作数是2字节的方法索引和内联缓存索引
+        return 2 + INLINE_CACHE_OPERAND_BYTES;
+    
     case OPCODE_LOAD_CONSTANT:
     case OPCODE_LOAD_MODULE_VAR:
     case OPCODE_STORE_MODULE_VAR:
@@ -1986,9 +2088,10 @@ uint32_t getBytesOfOperands(Byte *instrStream,
     case OPCODE_SUPER14:
     case OPCODE_SUPER15:
     case OPCODE_SUPER16:
-        //OPCODE_SUPERx的操作数是分别由writeOpCodeShortOperand
-        //和writeShortOperand写入的,共1个操作码和4个字节的操作数
-        return 4;
+        //OPCODE_SUPERx的操作数是分别由writeOpCodeShortOperand,
+        //writeShortOperand和writeInlineCache写入的,共1个操作码和4个字节的操作数,
+        //还有内联缓存索引
+        return 4 + INLINE_CACHE_OPERAND_BYTES;
     
     case OPCODE_CREATE_CLOSURE:
     {
@@ -2300,6 +2403,7 @@ static void emitCreateInstance(CompileUnit *cu,
 {
     CompileUnit methodCU;
     initCompileUnit(cu->curParser, &methodCU, cu, true);
+    methodCU.fn->argNum = sign->argNum;
 
 //1 生成OPCODE_CONSTRUCT指令,该指令生成新实例存储到stack[0].
     writeOpCode(&methodCU, OPCODE_CONSTRUCT);
@@ -2307,6 +2411,7 @@ static void emitCreateInstance(CompileUnit *cu,
 //2 生成OPCODE_CALLx指令,该指令调用新实例的构造函数.
     writeOpCodeShortOperand(&methodCU,
         (OpCode)(OPCODE_CALL0 + sign->argNum), constructorIndex);
+    writeInlineCache(&methodCU);
 
 //生成return指令,将栈顶中的实例返回
     writeOpCode(&methodCU, OPCODE_RETURN);
@@ -2347,6 +2452,7 @@ static void compileMethod(CompileUnit *cu, Variable classVar, bool isStatic)
     
     //构造签名
     methodSign(&methodCU, &sign);
+    methodCU.fn->argNum = sign.argNum;
     consumeCurToken(cu->curParser, TOKEN_LEFT_BRACE,
         "expect '{' at the beginning of method body.");
     
@@ -2434,7 +2540,7 @@ static void compileClassDefinition(CompileUnit *cu)
         cu->curParser->preToken.start, cu->curParser->preToken.length);
     
     //生成类名,用于创建类
-    ObjString *className = newObjString(cu->curParser->vm,
+    ObjString *className = newInternedString(cu->curParser->vm,
         cu->curParser->preToken.start, cu->curParser->preToken.length);
     
     //生成加载类名的指令
@@ -2462,7 +2568,7 @@ static void compileClassDefinition(CompileUnit *cu)
     ClassBookKeep classBK;
     classBK.name = className;
     classBK.inStatic = false;   //默认为false
-    StringBufferInit(&classBK.fields);
+    symbolTableInit(&classBK.fields);
     IntBufferInit(&classBK.instantMethods);
     IntBufferInit(&classBK.staticMethods);
     
@@ -2603,7 +2709,7 @@ static void compileImport(CompileUnit *cu)
     }
     
     //把模块名转为字符串,存储为常量
-    ObjString *moduleName = newObjString(cu->curParser->vm,
+    ObjString *moduleName = newInternedString(cu->curParser->vm,
         moduleNameToken.start, moduleNameToken.length);
     uint32_t constModIdx = addConstant(cu, OBJ_TO_VALUE(moduleName));
     
@@ -2635,7 +2741,7 @@ static void compileImport(CompileUnit *cu)
             cu->curParser->preToken.start, cu->curParser->preToken.length);
         
         //把模块变量转为字符串,存储为常量
-        ObjString *constVarName = newObjString(cu->curParser->vm,
+        ObjString *constVarName = newInternedString(cu->curParser->vm,
             cu->curParser->preToken.start, cu->curParser->preToken.length);
         uint32_t constVarIdx = addConstant(cu, OBJ_TO_VALUE(constVarName));
         
@@ -2733,12 +2839,33 @@ ObjFn *compileModule(VM *vm, ObjModule *objModule, const char *moduleCode)
         idx++;
     }
     
-    //模块编译完成,当前编译单元置空
-    vm->curParser->curCompileUnit = NULL;
-    vm->curParser = vm->curParser->parent;
+    //结束模块编译单元,endCompileUnit会将当前编译单元置空.
+    //须在恢复父parser之前调用,使写入指令时moduleCU.fn仍能被gc标记
 #if DEBUG
-    return endCompileUnit(&moduleCU, "(script)", 8);
+    ObjFn *fn = endCompileUnit(&moduleCU, "(script)", 8);
 #else
-    return endCompileUnit(&moduleCU);
+    ObjFn *fn = endCompileUnit(&moduleCU);
 #endif
+    vm->curParser = vm->curParser->parent;
+    return fn;
+}
+
+//标灰编译单元,编译期间触发gc时正在编译的函数及token中的常量不能被回收
+void grayCompileUnit(VM *vm, Parser *parser)
+{
+    //模块编译可能是嵌套的,故沿parent链标灰所有parser
+    while (parser != NULL)
+    {
+        grayValue(vm, parser->curToken.value);
+        grayValue(vm, parser->preToken.value);
+        grayObject(vm, (ObjHeader *)parser->curModule);
+        
+        CompileUnit *cu = parser->curCompileUnit;
+        while (cu != NULL)
+        {
+            grayObject(vm, (ObjHeader *)cu->fn);
+            cu = cu->enclosingUnit;
+        }
+        parser = parser->parent;
+    }
 }
@@ -82,4 +82,6 @@ ObjFn *compileModule(VM *vm, ObjModule *objModule, const char *moduleCode);
 
 uint32_t getBytesOfOperands(Byte *instrStream, Value *constants, int ip);
 
+void grayCompileUnit(VM *vm, Parser *parser);
+
 #endif
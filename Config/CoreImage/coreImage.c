@@ -0,0 +1,58 @@
+//核心模块映像生成器:构建时预编译核心脚本,
+//把字节码映像输出为C数组,由core.c以core.image.inc的形式链接进Tiderip,
+//这样newVM()时不必再编译core.script.inc和exten.script.inc
+#include <stdio.h>
+#include "utils.h"
+#include "vm.h"
+#include "bytecode_cache.h"
+
+static FILE *imageFile = NULL;
+
+//buildCore每编译一段核心脚本就调用一次,把它的映像输出为名为imageName的字节数组
+void emitCoreImage(VM *vm, const char *imageName, ObjFn *fn, const char *sourceCode)
+{
+    ByteBuffer image;
+    ByteBufferInit(&image);
+
+    //无法生成映像时输出一个非法映像,Tiderip载入失败后会退回到编译源码
+    if (!dumpBytecode(vm, fn, sourceCode, &image))
+    {
+        ByteBufferAdd(vm, &image, 0);
+    }
+
+    fprintf(imageFile, "static const Byte %s[] = {", imageName);
+    uint32_t idx = 0;
+    while (idx < image.count)
+    {
+        fprintf(imageFile, "%s0x%02x,", idx % 16 == 0 ? "\n    " : " ", image.datas[idx]);
+        idx++;
+    }
+    fprintf(imageFile, "\n};\n\n");
+
+    ByteBufferClear(vm, &image);
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: coreImageBuilder <core.image.inc>\n");
+        return 1;
+    }
+
+    imageFile = fopen(argv[1], "w");
+    if (imageFile == NULL)
+    {
+        IO_ERROR("Could`t open file \"%s\".\n", argv[1]);
+    }
+    fprintf(imageFile, "//由coreImageBuilder生成,请勿手动修改\n\n");
+
+    //newVM()中的buildCore编译核心脚本时会调用emitCoreImage
+    newVM();
+
+    if (fclose(imageFile) != 0)
+    {
+        IO_ERROR("Could`t write file \"%s\".\n", argv[1]);
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include "core.List.h"
 #include "class.h"
 #include "core.h"
+#include "obj_string_builder.h"
 
 //objList.new():创建1个新的liist
 static bool primListNew(VM *vm, Value *args UNUSED)
@@ -57,7 +58,7 @@ static bool primListSubscript(VM *vm, Value *args)
 }
 
 //objList[_]=(_):只支持数字做为subscript
-static bool primListSubscriptSetter(VM *vm UNUSED, Value *args)
+static bool primListSubscriptSetter(VM *vm, Value *args)
 {
     //获取对象
     ObjList *objList = VALUE_TO_OBJLIST(args[0]);
@@ -71,6 +72,7 @@ static bool primListSubscriptSetter(VM *vm UNUSED, Value *args)
     
     //直接赋值
     objList->elements.datas[index] = args[2];
+    LIST_WRITE_BARRIER(vm, objList, index, index + 1, args[2]);
     
     RET_VALUE(args[2]); //把参数2做为返回值
 }
@@ -80,6 +82,7 @@ static bool primListAdd(VM *vm, Value *args)
 {
     ObjList *objList = VALUE_TO_OBJLIST(args[0]);
     ValueBufferAdd(vm, &objList->elements, args[1]);
+    LIST_WRITE_BARRIER(vm, objList, objList->elements.count - 1, objList->elements.count, args[1]);
     RET_VALUE(args[1]); //把参数1做为返回值
 }
 
@@ -88,6 +91,7 @@ static bool primListAddCore(VM *vm, Value *args)
 {
     ObjList *objList = VALUE_TO_OBJLIST(args[0]);
     ValueBufferAdd(vm, &objList->elements, args[1]);
+    LIST_WRITE_BARRIER(vm, objList, objList->elements.count - 1, objList->elements.count, args[1]);
     RET_VALUE(args[0]); //返回列表自身
 }
 
@@ -180,6 +184,57 @@ static bool primListRemoveAt(VM *vm, Value *args)
     RET_VALUE(removeElement(vm, objList, index));
 }
 
+//objList.joinCore_(_):以args[1]为分隔符连接元素.
+//元素都是字符串或数字时直接写入缓冲区,数字不必先转成字符串;
+//有其它元素或分隔符不是字符串时返回null,由脚本按原来的方式处理
+static bool primListJoinCore(VM *vm, Value *args)
+{
+    if (!VALUE_IS_OBJSTR(args[1]))
+    {
+        RET_NULL;
+    }
+    
+    ObjList *objList = VALUE_TO_OBJLIST(args[0]);
+    uint32_t idx = 0;
+    while (idx < objList->elements.count)
+    {
+        Value element = objList->elements.datas[idx];
+        if (!VALUE_IS_OBJSTR(element) && !VALUE_IS_NUM(element))
+        {
+            RET_NULL;
+        }
+        idx++;
+    }
+    
+    ObjString *sep = VALUE_TO_OBJSTR(args[1]);
+    ObjStringBuilder *objBuilder = newObjStringBuilder(vm);
+    pushTmpRoot(vm, (ObjHeader *)objBuilder);  //追加时扩容可能触发gc
+    idx = 0;
+    while (idx < objList->elements.count)
+    {
+        if (idx > 0 && sep->value.length > 0)
+        {
+            copyStringChars(sep, reserveStringBuilder(vm, objBuilder, sep->value.length));
+        }
+        Value element = objList->elements.datas[idx];
+        if (VALUE_IS_NUM(element))
+        {
+            char buf[NUM_STRING_MAX_LENGTH];
+            uint32_t length = formatNum(VALUE_TO_NUM(element), buf);
+            appendStringBuilder(vm, objBuilder, buf, length);
+        }
+        else if (VALUE_TO_OBJSTR(element)->value.length > 0)
+        {
+            ObjString *objString = VALUE_TO_OBJSTR(element);
+            copyStringChars(objString, reserveStringBuilder(vm, objBuilder, objString->value.length));
+        }
+        idx++;
+    }
+    ObjString *result = stringBuilderToString(vm, objBuilder);
+    popTmpRoot(vm);
+    RET_OBJ(result);
+}
+
 void coreListBind(VM *vm, ObjModule *coreModule)
 {
     vm->listClass = VALUE_TO_CLASS(getCoreClassValue(coreModule, "List"));
@@ -191,6 +246,7 @@ void coreListBind(VM *vm, ObjModule *coreModule)
     PRIM_METHOD_BIND(vm->listClass, "clear()", primListClear);
     PRIM_METHOD_BIND(vm->listClass, "count", primListCount);
     PRIM_METHOD_BIND(vm->listClass, "insert(_,_)", primListInsert);
+    PRIM_METHOD_BIND(vm->listClass, "joinCore_(_)", primListJoinCore);
     PRIM_METHOD_BIND(vm->listClass, "iterate(_)", primListIterate);
     PRIM_METHOD_BIND(vm->listClass, "iteratorValue(_)", primListIteratorValue);
     PRIM_METHOD_BIND(vm->listClass, "removeAt(_)", primListRemoveAt);
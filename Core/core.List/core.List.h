@@ -12,4 +12,5 @@ extern Value getCoreClassValue(ObjModule *objModule, const char *name);
 extern uint32_t validateIndex(VM *vm, Value index, uint32_t length);
 extern bool validateInt(VM *vm, Value arg);
 extern uint32_t calculateRange(VM *vm, ObjRange *objRange, uint32_t *countPtr, int *directionPtr);
+extern uint32_t formatNum(double num, char *buf);
 void coreListBind(VM *vm, ObjModule *coreModule);
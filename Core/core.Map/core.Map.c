@@ -16,17 +16,27 @@ static bool primMapNew(VM *vm, Value *args UNUSED)
 //objMap[_]:返回map[key]对应的value
 static bool primMapSubscript(VM *vm, Value *args)
 {
+    //数组部分的整数key直接按下标取entry,不必校验和哈希
+    ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
+    uint32_t pos;
+    if (mapArrayPos(objMap, args[1], &pos))
+    {
+        uint32_t index = objMap->arrayIndex[pos];
+        if (index == 0)
+        {
+            RET_NULL;
+        }
+        RET_VALUE(objMap->entries[index - 1].value);
+    }
+    
     //校验key的合法性
     if (!validateKey(vm, args[1]))
     {
         return false;  //出错了,切换线程
     }
     
-    //获得map对象实例
-    ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
-    
     //从map中查找key(args[1])对应的value
-    Value value = mapGet(objMap, args[1]);
+    Value value = mapGet(vm, objMap, args[1]);
     
     //若没有相应的key则返回NULL
     if (VALUE_IS_UNDEFINED(value))
@@ -40,15 +50,22 @@ static bool primMapSubscript(VM *vm, Value *args)
 //objMap[_]=(_):map[key]=value
 static bool primMapSubscriptSetter(VM *vm, Value *args)
 {
+    //数组部分中已有的整数key直接更新value
+    ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
+    uint32_t pos;
+    if (mapArrayPos(objMap, args[1], &pos) && objMap->arrayIndex[pos] != 0)
+    {
+        objMap->entries[objMap->arrayIndex[pos] - 1].value = args[2];
+        WRITE_BARRIER_VALUE(vm, objMap, args[2]);
+        RET_VALUE(args[2]);
+    }
+    
     //校验key的合法性
     if (!validateKey(vm, args[1]))
     {
         return false;  //出错了,切换线程
     }
     
-    //获得map对象实例
-    ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
-    
     //在map中将key和value关联
     //即map[key]=value
     mapSet(vm, objMap, args[1], args[2]);
@@ -91,7 +108,7 @@ static bool primMapContainsKey(VM *vm, Value *args)
     }
     
     //直接去get该key,判断是否get成功
-    RET_BOOL(!VALUE_IS_UNDEFINED(mapGet(VALUE_TO_OBJMAP(args[0]), args[1])));
+    RET_BOOL(!VALUE_IS_UNDEFINED(mapGet(vm, VALUE_TO_OBJMAP(args[0]), args[1])));
 }
 
 //objMap.count:返回map中entry个数
@@ -145,7 +162,7 @@ static bool primMapIterate(VM *vm, Value *args)
         
         index = (uint32_t)VALUE_TO_NUM(args[1]);
         //迭代器不能越界
-        if (index >= objMap->capacity)
+        if (index >= objMap->entryCount)
         {
             RET_FALSE;
         }
@@ -154,10 +171,9 @@ static bool primMapIterate(VM *vm, Value *args)
     }
     
     //返回下一个正在使用(有效)的entry
-    while (index < objMap->capacity)
+    while (index < objMap->entryCount)
     {
-        //entries是个数组, 元素是哈希槽,
-        //哈希值散布在这些槽中并不连续,因此逐个判断槽位是否在用
+        //entries按插入顺序稠密存放,只需跳过已删除留下的空洞
         if (!VALUE_IS_UNDEFINED(objMap->entries[index].key))
         {
             RET_NUM(index);    //返回entry索引
@@ -174,7 +190,7 @@ static bool primMapKeyIteratorValue(VM *vm, Value *args)
 {
     ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
     
-    uint32_t index = validateIndex(vm, args[1], objMap->capacity);
+    uint32_t index = validateIndex(vm, args[1], objMap->entryCount);
     if (index == UINT32_MAX)
     {
         return false;
@@ -196,7 +212,7 @@ static bool primMapValueIteratorValue(VM *vm, Value *args)
 {
     ObjMap *objMap = VALUE_TO_OBJMAP(args[0]);
     
-    uint32_t index = validateIndex(vm, args[1], objMap->capacity);
+    uint32_t index = validateIndex(vm, args[1], objMap->entryCount);
     if (index == UINT32_MAX)
     {
         return false;
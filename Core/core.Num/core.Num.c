@@ -9,30 +9,51 @@
 #include "core.Num.h"
 #include "core.h"
 #include "obj_range.h"
+#include "obj_list.h"
+#include "atod.h"
 
-//将字符串转换为数字
-static bool primNumFromString(VM *vm, Value *args)
+//将字符串转换为数字,字符串不是合法的数字时返回null
+static Value stringToNum(VM *vm, ObjString *objString)
 {
-    if (!validateString(vm, args[1]))
+    flattenString(vm, objString);
+    
+    //空字符串返回null
+    if (objString->value.length == 0)
     {
-        return false;
+        return VT_TO_VALUE(VT_NULL);
     }
     
-    ObjString *objString = VALUE_TO_OBJSTR(args[1]);
-    
-    //空字符串返回RETURN_NULL
-    if (objString->value.length == 0)
+    //常见的十进制数字由parseDecimal直接转换,不必先以'\0'结尾
+    const char *cur = objString->value.start;
+    const char *end = cur + objString->value.length;
+    while (cur < end && isspace((unsigned char)*cur))
+    {
+        cur++;
+    }
+    double num;
+    uint32_t consumed = parseDecimal(cur, (uint32_t)(end - cur), &num);
+    if (consumed > 0)
     {
-        RET_NULL;
+        cur += consumed;
+        while (cur < end && isspace((unsigned char)*cur))
+        {
+            cur++;
+        }
+        if (cur == end)
+        {
+            return NUM_TO_VALUE(num);
+        }
     }
     
+    //其余的(十六进制,inf,nan,超出规格化数的范围等)仍交给strtod
+    terminateString(vm, objString);
     ASSERT(objString->value.start[objString->value.length] == '\0', "objString don`t teminate!");
     
     errno = 0;
     char *endPtr;
     
     //将字符串转换为double型, 它会自动跳过前面的空白
-    double num = strtod(objString->value.start, &endPtr);
+    num = strtod(objString->value.start, &endPtr);
     
     //以endPtr是否等于start+length来判断不能转换的字符之后是否全是空白
     while (*endPtr != '\0' && isspace((unsigned char)*endPtr))
@@ -48,11 +69,62 @@ static bool primNumFromString(VM *vm, Value *args)
     //如果字符串中不能转换的字符不全是空白,字符串非法,返回NULL
     if (endPtr < objString->value.start + objString->value.length)
     {
-        RET_NULL;
+        return VT_TO_VALUE(VT_NULL);
     }
     
     //至此,检查通过,返回正确结果
-    RET_NUM(num);
+    return NUM_TO_VALUE(num);
+}
+
+//Num.toNum(_):将字符串转换为数字
+static bool primNumFromString(VM *vm, Value *args)
+{
+    if (!validateString(vm, args[1]))
+    {
+        return false;
+    }
+    RET_VALUE(stringToNum(vm, VALUE_TO_OBJSTR(args[1])));
+}
+
+//Num.parseAll(_):把list args[1]中的字符串逐个转换为数字,返回新的list,
+//不合法的转换为null.省去了逐个调用toNum的方法分派
+static bool primNumParseAll(VM *vm, Value *args)
+{
+    if (!VALUE_IS_CERTAIN_OBJ(args[1], OT_LIST))
+    {
+        SET_ERROR_FALSE(vm, "argument must be list!");
+    }
+    
+    ObjList *source = VALUE_TO_OBJLIST(args[1]);
+    uint32_t idx = 0;
+    while (idx < source->elements.count)
+    {
+        if (!VALUE_IS_OBJSTR(source->elements.datas[idx]))
+        {
+            SET_ERROR_FALSE(vm, "element must be string!");
+        }
+        idx++;
+    }
+    
+    //展平rope和复制slice时可能触发gc,先填满null再保护起来
+    uint32_t count = source->elements.count;
+    ObjList *result = newObjList(vm, count);
+    idx = 0;
+    while (idx < count)
+    {
+        result->elements.datas[idx++] = VT_TO_VALUE(VT_NULL);
+    }
+    pushTmpRoot(vm, (ObjHeader *)result);
+    
+    //转换过程中不会执行脚本,source的元素个数不变
+    idx = 0;
+    while (idx < count)
+    {
+        result->elements.datas[idx] = stringToNum(vm, VALUE_TO_OBJSTR(source->elements.datas[idx]));
+        idx++;
+    }
+    popTmpRoot(vm);
+    RET_OBJ(result);
 }
 
 //返回圆周率
@@ -244,6 +316,7 @@ void coreNumBind(VM *vm, ObjModule *coreModule)
     vm->numClass = VALUE_TO_CLASS(getCoreClassValue(coreModule, "Num"));
     //类方法
     PRIM_METHOD_BIND(vm->numClass->objHeader.class, "toNum(_)", primNumFromString);
+    PRIM_METHOD_BIND(vm->numClass->objHeader.class, "parseAll(_)", primNumParseAll);
     PRIM_METHOD_BIND(vm->numClass->objHeader.class, "pi", primNumPi);
     //实例方法
     PRIM_METHOD_BIND(vm->numClass, "+(_)", primNumPlus);
@@ -7,6 +7,20 @@
 #include "core.h"
 #include "unicodeUtf8.h"
 
+//split、replace等的pattern须是非空字符串
+static bool validatePattern(VM *vm, Value arg)
+{
+    if (!validateString(vm, arg))
+    {
+        return false;
+    }
+    if (VALUE_TO_OBJSTR(arg)->value.length == 0)
+    {
+        SET_ERROR_FALSE(vm, "pattern can`t be empty!");
+    }
+    return true;
+}
+
 //objString.fromCodePoint(_):从码点建立字符串
 static bool primStringFromCodePoint(VM *vm, Value *args)
 {
@@ -41,20 +55,27 @@ static bool primStringPlus(VM *vm, Value *args)
     ObjString *left = VALUE_TO_OBJSTR(args[0]);
     ObjString *right = VALUE_TO_OBJSTR(args[1]);
     
-    uint32_t totalLength = strlen(left->value.start) + strlen(right->value.start);
-    //+1是为了结尾的'\0'
-    ObjString *result = ALLOCATE_EXTRA(vm, ObjString, totalLength + 1);
-    if (result == NULL)
+    if (right->value.length == 0)
+    {
+        RET_OBJ(left);
+    }
+    if (left->value.length == 0)
     {
-        MEM_ERROR("allocate memory failed in runtime!");
+        RET_OBJ(right);
     }
-    initObjHeader(vm, &result->objHeader, OT_STRING, vm->stringClass);
-    memcpy(result->value.start, left->value.start, strlen(left->value.start));
-    memcpy(result->value.start + strlen(left->value.start),
-        right->value.start, strlen(right->value.start));
-    result->value.start[totalLength] = '\0';
-    result->value.length = totalLength;
-    hashObjString(result);
+    
+    //结果较长时建rope,循环拼接时就不必每次都复制已有的字符
+    uint32_t totalLength = left->value.length + right->value.length;
+    if (totalLength >= ROPE_MIN_LENGTH)
+    {
+        RET_OBJ(newRope(vm, left, right));
+    }
+    
+    //rope至少有ROPE_MIN_LENGTH长,所以此时两部分都不是rope
+    ObjString *result = allocateObjString(vm, totalLength);
+    memcpy(result->value.start, left->value.start, left->value.length);
+    memcpy(result->value.start + left->value.length,
+        right->value.start, right->value.length);
     
     RET_OBJ(result);
 }
@@ -63,6 +84,7 @@ static bool primStringPlus(VM *vm, Value *args)
 static bool primStringSubscript(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
     //数字和objRange都可以做索引,分别判断
     //若索引是数字,就直接索引1个字符,这是最简单的subscript
     if (VALUE_IS_NUM(args[1]))
@@ -98,9 +120,10 @@ static bool primStringSubscript(VM *vm, Value *args)
 }
 
 //objString.byteAt_():返回指定索引的字节
-static bool primStringByteAt(VM *vm UNUSED, Value *args)
+static bool primStringByteAt(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
     uint32_t index = validateIndex(vm, args[1], objString->value.length);
     if (index == UINT32_MAX)
     {
@@ -117,9 +140,10 @@ static bool primStringByteCount(VM *vm UNUSED, Value *args)
 }
 
 //objString.codePointAt_(_):返回指定的CodePoint
-static bool primStringCodePointAt(VM *vm UNUSED, Value *args)
+static bool primStringCodePointAt(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
     uint32_t index = validateIndex(vm, args[1], objString->value.length);
     if (index == UINT32_MAX)
     {
@@ -139,6 +163,78 @@ static bool primStringCodePointAt(VM *vm UNUSED, Value *args)
         objString->value.length - index));
 }
 
+//objString.codePointCount_:返回字符串的码点数
+static bool primStringCodePointCount(VM *vm, Value *args)
+{
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
+    RET_NUM(stringCodePointCount(vm, objString));
+}
+
+//objString.codePointAtIndex_(_):按码点下标返回第args[1]个CodePoint
+static bool primStringCodePointAtIndex(VM *vm, Value *args)
+{
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
+    uint32_t index = validateIndex(vm, args[1], stringCodePointCount(vm, objString));
+    if (index == UINT32_MAX)
+    {
+        return false;
+    }
+    
+    uint32_t offset = stringCodePointOffset(vm, objString, index);
+    RET_NUM(decodeUtf8((uint8_t *)objString->value.start + offset,
+        objString->value.length - offset));
+}
+
+//objString.codePointList_:返回由全部码点组成的list
+static bool primStringCodePointList(VM *vm, Value *args)
+{
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
+    uint32_t count = stringCodePointCount(vm, objString);
+    if (count == 0)
+    {
+        RET_OBJ(newObjList(vm, 0));
+    }
+    
+    //先整体解码到临时缓冲区,再创建list,中间不会触发gc
+    int *codePoints = ALLOCATE_ARRAY(vm, int, count);
+    utf8ToCodePoints((const uint8_t *)objString->value.start, objString->value.length, codePoints);
+    ObjList *objList = newObjList(vm, count);
+    uint32_t idx = 0;
+    while (idx < count)
+    {
+        objList->elements.datas[idx] = NUM_TO_VALUE(codePoints[idx]);
+        idx++;
+    }
+    DEALLOCATE_ARRAY(vm, codePoints, count);
+    RET_OBJ(objList);
+}
+
+//objString.count_(_):返回字符串中不重叠的args[1]的个数
+static bool primStringCount(VM *vm, Value *args)
+{
+    if (!validatePattern(vm, args[1]))
+    {
+        return false;
+    }
+    
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
+    
+    uint32_t count = 0;
+    int index = findString(objString, pattern);
+    while (index != -1)
+    {
+        count++;
+        index = findStringFrom(objString, pattern, (uint32_t)index + pattern->value.length);
+    }
+    RET_NUM(count);
+}
+
 //objString.contains(_):判断字符串args[0]中是否包含子字符串args[1]
 static bool primStringContains(VM *vm UNUSED, Value *args)
 {
@@ -149,6 +245,8 @@ static bool primStringContains(VM *vm UNUSED, Value *args)
     
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
     ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
     RET_BOOL(findString(objString, pattern) != -1);
 }
 
@@ -162,6 +260,8 @@ static bool primStringEndsWith(VM *vm UNUSED, Value *args)
     
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
     ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
     
     //若pattern比源串还长,源串必然不包括pattern
     if (pattern->value.length > objString->value.length)
@@ -184,6 +284,8 @@ static bool primStringIndexOf(VM *vm UNUSED, Value *args)
     
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
     ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
     
     //若pattern比源串还长,源串必然不包括pattern
     if (pattern->value.length > objString->value.length)
@@ -196,9 +298,10 @@ static bool primStringIndexOf(VM *vm UNUSED, Value *args)
 }
 
 //objString.iterate(_):返回下一个utf8字符(不是字节)的迭代器
-static bool primStringIterate(VM *vm UNUSED, Value *args)
+static bool primStringIterate(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
     
     //如果是第一次迭代 迭代索引肯定为空
     if (VALUE_IS_NULL(args[1]))
@@ -223,6 +326,12 @@ static bool primStringIterate(VM *vm UNUSED, Value *args)
     }
     
     uint32_t index = (uint32_t)iter;
+    //已知全是ascii时每个字节就是一个字符
+    if (objString->utf8 == UTF8_ASCII)
+    {
+        if (index + 1 >= objString->value.length) RET_FALSE;
+        RET_NUM(index + 1);
+    }
     do
     {
         index++;
@@ -278,6 +387,7 @@ static bool primStringIterateByte(VM *vm UNUSED, Value *args)
 static bool primStringIteratorValue(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
     uint32_t index = validateIndex(vm, args[1], objString->value.length);
     if (index == UINT32_MAX)
     {
@@ -286,6 +396,112 @@ static bool primStringIteratorValue(VM *vm, Value *args)
     RET_VALUE(stringCodePointAt(vm, objString, index));
 }
 
+//objString.lastIndexOf(_):检索字符串args[0]中最后一个子串args[1]的起始下标,没有则返回-1
+static bool primStringLastIndexOf(VM *vm, Value *args)
+{
+    if (!validateString(vm, args[1]))
+    {
+        return false;
+    }
+    
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
+    RET_NUM(findLastString(objString, pattern));
+}
+
+//objString.replace(_,_):把字符串中所有的args[1]替换为args[2]
+static bool primStringReplace(VM *vm, Value *args)
+{
+    if (!validatePattern(vm, args[1]) || !validateString(vm, args[2]))
+    {
+        return false;
+    }
+    
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    ObjString *from = VALUE_TO_OBJSTR(args[1]);
+    ObjString *to = VALUE_TO_OBJSTR(args[2]);
+    flattenString(vm, objString);
+    flattenString(vm, from);
+    flattenString(vm, to);
+    
+    //先数出替换的次数,以便一次分配好结果
+    uint32_t count = 0;
+    int first = findString(objString, from);
+    int index = first;
+    while (index != -1)
+    {
+        count++;
+        index = findStringFrom(objString, from, (uint32_t)index + from->value.length);
+    }
+    if (count == 0)
+    {
+        RET_VALUE(args[0]);
+    }
+    
+    uint64_t totalLength = (uint64_t)objString->value.length +
+        (uint64_t)count * to->value.length - (uint64_t)count * from->value.length;
+    if (totalLength >= UINT32_MAX)
+    {
+        SET_ERROR_FALSE(vm, "result of replace is too long!");
+    }
+    
+    ObjString *result = allocateObjString(vm, (uint32_t)totalLength);
+    char *dest = result->value.start;
+    uint32_t start = 0;
+    index = first;
+    while (index != -1)
+    {
+        memcpy(dest, objString->value.start + start, index - start);
+        dest += index - start;
+        memcpy(dest, to->value.start, to->value.length);
+        dest += to->value.length;
+        start = (uint32_t)index + from->value.length;
+        index = findStringFrom(objString, from, start);
+    }
+    memcpy(dest, objString->value.start + start, objString->value.length - start);
+    RET_OBJ(result);
+}
+
+//objString.split(_):以args[1]为分隔符把字符串分成若干段,返回各段组成的list.
+//n个分隔符总是得到n+1段,分隔符在首尾或相邻时对应的段为空串,
+//因此空串得到只含一个空串的list,即[""],而不是空list.
+//较长的段是与原串共用字符的切片
+static bool primStringSplit(VM *vm, Value *args)
+{
+    if (!validatePattern(vm, args[1]))
+    {
+        return false;
+    }
+    
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    ObjString *separator = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, separator);
+    
+    ObjList *objList = newObjList(vm, 0);
+    pushTmpRoot(vm, (ObjHeader *)objList);  //创建字符串时可能触发gc
+    uint32_t start = 0;
+    int index = findString(objString, separator);
+    while (true)
+    {
+        uint32_t end = index == -1 ? objString->value.length : (uint32_t)index;
+        ObjString *piece = newStringSlice(vm, objString, start, end - start);
+        pushTmpRoot(vm, (ObjHeader *)piece);  //扩容list时可能触发gc
+        ValueBufferAdd(vm, &objList->elements, OBJ_TO_VALUE(piece));
+        popTmpRoot(vm);
+        if (index == -1)
+        {
+            break;
+        }
+        start = end + separator->value.length;
+        index = findStringFrom(objString, separator, start);
+    }
+    popTmpRoot(vm);
+    RET_OBJ(objList);
+}
+
 //objString.startsWith(_): 返回args[0]是否以args[1]为起始
 static bool primStringStartsWith(VM *vm UNUSED, Value *args)
 {
@@ -296,6 +512,8 @@ static bool primStringStartsWith(VM *vm UNUSED, Value *args)
     
     ObjString *objString = VALUE_TO_OBJSTR(args[0]);
     ObjString *pattern = VALUE_TO_OBJSTR(args[1]);
+    flattenString(vm, objString);
+    flattenString(vm, pattern);
     
     //若pattern比源串还长,源串必然不包括pattern,
     //因此不可能以pattern为起始
@@ -314,6 +532,42 @@ static bool primStringToString(VM *vm UNUSED, Value *args)
     RET_VALUE(args[0]);
 }
 
+//trim去掉的空白字符
+static inline bool isTrimSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+//objString.trim:返回去掉首尾空白字符后的字符串
+static bool primStringTrim(VM *vm, Value *args)
+{
+    ObjString *objString = VALUE_TO_OBJSTR(args[0]);
+    flattenString(vm, objString);
+    
+    const char *chars = objString->value.start;
+    uint32_t start = 0, end = objString->value.length;
+    while (start < end && isTrimSpace(chars[start]))
+    {
+        start++;
+    }
+    while (end > start && isTrimSpace(chars[end - 1]))
+    {
+        end--;
+    }
+    if (start == 0 && end == objString->value.length)
+    {
+        RET_VALUE(args[0]);
+    }
+    RET_OBJ(newStringSlice(vm, objString, start, end - start));
+}
+
+//objString.intern:返回内容相同的驻留字符串.
+//驻留字符串之间比较相等或作为map的key查找时只需比较地址
+static bool primStringIntern(VM *vm, Value *args)
+{
+    RET_OBJ(internString(vm, VALUE_TO_OBJSTR(args[0])));
+}
+
 void coreStringBind(VM *vm, ObjModule *coreModule)
 {
     vm->stringClass = VALUE_TO_CLASS(getCoreClassValue(coreModule, "String"));
@@ -323,13 +577,22 @@ void coreStringBind(VM *vm, ObjModule *coreModule)
     PRIM_METHOD_BIND(vm->stringClass, "byteAt_(_)", primStringByteAt);
     PRIM_METHOD_BIND(vm->stringClass, "byteCount_", primStringByteCount);
     PRIM_METHOD_BIND(vm->stringClass, "codePointAt_(_)", primStringCodePointAt);
+    PRIM_METHOD_BIND(vm->stringClass, "codePointCount_", primStringCodePointCount);
+    PRIM_METHOD_BIND(vm->stringClass, "codePointAtIndex_(_)", primStringCodePointAtIndex);
+    PRIM_METHOD_BIND(vm->stringClass, "codePointList_", primStringCodePointList);
+    PRIM_METHOD_BIND(vm->stringClass, "count_(_)", primStringCount);
     PRIM_METHOD_BIND(vm->stringClass, "contains(_)", primStringContains);
     PRIM_METHOD_BIND(vm->stringClass, "endsWith(_)", primStringEndsWith);
     PRIM_METHOD_BIND(vm->stringClass, "indexOf(_)", primStringIndexOf);
     PRIM_METHOD_BIND(vm->stringClass, "iterate(_)", primStringIterate);
     PRIM_METHOD_BIND(vm->stringClass, "iterateByte_(_)", primStringIterateByte);
     PRIM_METHOD_BIND(vm->stringClass, "iteratorValue(_)", primStringIteratorValue);
+    PRIM_METHOD_BIND(vm->stringClass, "lastIndexOf(_)", primStringLastIndexOf);
+    PRIM_METHOD_BIND(vm->stringClass, "replace(_,_)", primStringReplace);
+    PRIM_METHOD_BIND(vm->stringClass, "split(_)", primStringSplit);
     PRIM_METHOD_BIND(vm->stringClass, "startsWith(_)", primStringStartsWith);
     PRIM_METHOD_BIND(vm->stringClass, "toString", primStringToString);
+    PRIM_METHOD_BIND(vm->stringClass, "trim", primStringTrim);
+    PRIM_METHOD_BIND(vm->stringClass, "intern", primStringIntern);
     PRIM_METHOD_BIND(vm->stringClass, "count", primStringByteCount);
 }
\ No newline at end of file
@@ -16,5 +16,7 @@ extern bool validateString(VM *vm, Value arg);
 extern ObjString *newObjStringFromSub(VM *vm, ObjString *sourceStr, int startIndex, uint32_t count, int direction);
 extern Value makeStringFromCodePoint(VM *vm, int value);
 extern int findString(ObjString *haystack, ObjString *needle);
+extern int findStringFrom(ObjString *haystack, ObjString *needle, uint32_t from);
+extern int findLastString(ObjString *haystack, ObjString *needle);
 extern Value stringCodePointAt(VM *vm, ObjString *objString, uint32_t index);
 void coreStringBind(VM *vm, ObjModule *coreModule);
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "core.StringBuilder.h"
+#include "class.h"
+#include "core.h"
+
+//StringBuilder.new():创建空的StringBuilder
+static bool primStringBuilderNew(VM *vm, Value *args UNUSED)
+{
+    RET_OBJ(newObjStringBuilder(vm));
+}
+
+//objStringBuilder.appendString_(_):追加字符串args[1],args[1]是rope时不必展平
+static bool primStringBuilderAppendString(VM *vm, Value *args)
+{
+    if (!validateString(vm, args[1]))
+    {
+        return false;
+    }
+    
+    ObjStringBuilder *objBuilder = VALUE_TO_OBJSTRBUILDER(args[0]);
+    ObjString *objString = VALUE_TO_OBJSTR(args[1]);
+    if (objString->value.length > 0)
+    {
+        copyStringChars(objString, reserveStringBuilder(vm, objBuilder, objString->value.length));
+    }
+    RET_VALUE(args[0]);
+}
+
+//objStringBuilder.appendNum_(_):追加数字args[1],直接格式化到buffer中,不创建字符串
+static bool primStringBuilderAppendNum(VM *vm, Value *args)
+{
+    if (!validateNum(vm, args[1]))
+    {
+        return false;
+    }
+    
+    char buf[NUM_STRING_MAX_LENGTH];
+    uint32_t length = formatNum(VALUE_TO_NUM(args[1]), buf);
+    appendStringBuilder(vm, VALUE_TO_OBJSTRBUILDER(args[0]), buf, length);
+    RET_VALUE(args[0]);
+}
+
+//objStringBuilder.count:返回已追加的字节数
+static bool primStringBuilderCount(VM *vm UNUSED, Value *args)
+{
+    RET_NUM(VALUE_TO_OBJSTRBUILDER(args[0])->length);
+}
+
+//objStringBuilder.clear():清空内容
+static bool primStringBuilderClear(VM *vm UNUSED, Value *args)
+{
+    clearStringBuilder(VALUE_TO_OBJSTRBUILDER(args[0]));
+    RET_VALUE(args[0]);
+}
+
+//objStringBuilder.toString:以已追加的内容生成字符串
+static bool primStringBuilderToString(VM *vm, Value *args)
+{
+    RET_OBJ(stringBuilderToString(vm, VALUE_TO_OBJSTRBUILDER(args[0])));
+}
+
+void coreStringBuilderBind(VM *vm, ObjModule *coreModule)
+{
+    vm->stringBuilderClass = VALUE_TO_CLASS(getCoreClassValue(coreModule, "StringBuilder"));
+    PRIM_METHOD_BIND(vm->stringBuilderClass->objHeader.class, "new()", primStringBuilderNew);
+    PRIM_METHOD_BIND(vm->stringBuilderClass, "appendString_(_)", primStringBuilderAppendString);
+    PRIM_METHOD_BIND(vm->stringBuilderClass, "appendNum_(_)", primStringBuilderAppendNum);
+    PRIM_METHOD_BIND(vm->stringBuilderClass, "count", primStringBuilderCount);
+    PRIM_METHOD_BIND(vm->stringBuilderClass, "clear()", primStringBuilderClear);
+    PRIM_METHOD_BIND(vm->stringBuilderClass, "toString", primStringBuilderToString);
+}
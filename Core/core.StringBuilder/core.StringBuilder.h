@@ -0,0 +1,11 @@
+#pragma once
+
+#include "utils.h"
+#include "vm.h"
+#include "obj_string_builder.h"
+
+extern Value getCoreClassValue(ObjModule *objModule, const char *name);
+extern bool validateString(VM *vm, Value arg);
+extern bool validateNum(VM *vm, Value arg);
+extern uint32_t formatNum(double num, char *buf);
+void coreStringBuilderBind(VM *vm, ObjModule *coreModule);
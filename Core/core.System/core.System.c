@@ -4,12 +4,13 @@
 
 #include <time.h>
 #include "core.System.h"
+#include "gc.h"
 
 //输出字符串
-static void printString(const char *str)
+static void printString(const char *str, uint32_t length)
 {
     //输出到缓冲区后立即刷新
-    printf("%s", str);
+    printf("%.*s", (int)length, str);
     fflush(stdout);
 }
 
@@ -25,12 +26,13 @@ char *fgetsNoEndline(char *str, int n, FILE *stream)
     return ret;
 }
 
-//输入字符串
-static const char *inputString()
+//从标准输入读一行到str,读不到时为空串
+static const char *inputString(char *str, int n)
 {
-    //输出到缓冲区后立即刷新
-    char *str;
-    fgetsNoEndline(str, 1024, stdin);
+    if (fgetsNoEndline(str, n, stdin) == NULL)
+    {
+        str[0] = '\0';
+    }
     fflush(stdin);
     return (const char *)str;
 }
@@ -39,14 +41,17 @@ static const char *inputString()
 static Value importModule(VM *vm, Value moduleName)
 {
     //若已经导入则返回NULL_VAL
-    if (!VALUE_IS_UNDEFINED(mapGet(vm->allModules, moduleName)))
+    if (!VALUE_IS_UNDEFINED(mapGet(vm, vm->allModules, moduleName)))
     {
         return VT_TO_VALUE(VT_NULL);
     }
     ObjString *objString = VALUE_TO_OBJSTR(moduleName);
-    const char *sourceCode = readModule(objString->value.start);
+    terminateString(vm, objString);
+    char *modulePath = getFilePath(objString->value.start);
+    const char *sourceCode = readFile(modulePath);
     
-    ObjThread *moduleThread = loadModule(vm, moduleName, sourceCode);
+    ObjThread *moduleThread = loadModule(vm, moduleName, sourceCode, modulePath);
+    free(modulePath);
     return OBJ_TO_VALUE(moduleThread);
 }
 
@@ -95,6 +100,15 @@ static bool primSystemClock(VM *vm UNUSED, Value *args UNUSED)
     RET_NUM((double)time(NULL));
 }
 
+//System.monotonic: 返回以秒为单位的单调时钟,精确到纳秒.
+//起点不确定,只用于计算两次调用之间经过的时间
+static bool primSystemMonotonic(VM *vm UNUSED, Value *args UNUSED)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    RET_NUM(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
 //System.importModule(_): 导入并编译模块args[1],把模块挂载到vm->allModules
 static bool primSystemImportModule(VM *vm, Value *args)
 {
@@ -141,6 +155,9 @@ static bool primSystemGetModuleVariable(VM *vm, Value *args)
         return false;
     }
     
+    //出错时要以C字符串拼出错误信息
+    terminateString(vm, VALUE_TO_OBJSTR(args[1]));
+    terminateString(vm, VALUE_TO_OBJSTR(args[2]));
     Value result = getModuleVariable(vm, args[1], args[2]);
     if (VALUE_IS_NULL(result))
     {
@@ -152,20 +169,33 @@ static bool primSystemGetModuleVariable(VM *vm, Value *args)
 }
 
 //System.writeString_(_): 输出字符串args[1]
-static bool primSystemWriteString(VM *vm UNUSED, Value *args)
+static bool primSystemWriteString(VM *vm, Value *args)
 {
     ObjString *objString = VALUE_TO_OBJSTR(args[1]);
-    ASSERT(objString->value.start[objString->value.length] == '\0', "string isn`t terminated!");
-    printString(objString->value.start);
+    flattenString(vm, objString);
+    printString(objString->value.start, objString->value.length);
+    RET_VALUE(args[1]);
+}
+
+//System.writeNum_(_): 直接格式化输出数字args[1],不创建字符串
+static bool primSystemWriteNum(VM *vm UNUSED, Value *args)
+{
+    char buf[NUM_STRING_MAX_LENGTH];
+    uint32_t length = formatNum(VALUE_TO_NUM(args[1]), buf);
+    printString(buf, length);
     RET_VALUE(args[1]);
 }
 
 //System.inputString_(): 输出字符串args[1]
 static bool primSystemInputString(VM *vm UNUSED, Value *args UNUSED)
 {
-    const char *str = inputString();
+    char buf[1024];
+    const char *str = inputString(buf, sizeof(buf));
     ObjString *objString = newObjString(vm, str, strlen(str));
     ASSERT(objString->value.start[objString->value.length] == '\0', "string isn`t terminated!");
+    
+    //外部输入在构造时就校验utf8编码,之后的下标和码点访问直接用结果
+    stringIsValidUtf8(objString);
     RET_VALUE(OBJ_TO_VALUE(objString));
 }
 
@@ -193,14 +223,92 @@ static bool primSystemGetRand(VM *vm, Value *args)
     
 }
 
+//System.gc(): 立即进行一次垃圾回收
+static bool primSystemGC(VM *vm, Value *args)
+{
+    startGC(vm);
+    RET_NULL;
+}
+
+//System.gcPauses: 返回最近各次gc暂停的时长列表,单位微秒
+static bool primSystemGCPauses(VM *vm, Value *args UNUSED)
+{
+    PauseStats *stats = &vm->pauseStats;
+    uint32_t count = stats->count < GC_PAUSE_HISTORY ? stats->count : GC_PAUSE_HISTORY;
+    ObjList *objList = newObjList(vm, count);
+    
+    //从最早的一次开始按时间顺序存入list
+    uint32_t first = stats->count - count;
+    uint32_t idx = 0;
+    while (idx < count)
+    {
+        objList->elements.datas[idx] = NUM_TO_VALUE(stats->pauses[(first + idx) % GC_PAUSE_HISTORY]);
+        idx++;
+    }
+    RET_OBJ(objList);
+}
+
+//System.gcMaxPause: 返回gc最长一次暂停的时长,单位微秒
+static bool primSystemGCMaxPause(VM *vm, Value *args UNUSED)
+{
+    RET_NUM(vm->pauseStats.maxPause);
+}
+
+//System.inlineCacheStats: 返回各个执行过的方法的内联缓存统计,每项为
+//[方法名, 命中次数, 未命中次数, 调用点缓存已满而未能填入的未命中次数],
+//最后一项多的方法有megamorphic的调用点.统计由vm在方法调用时累计,
+//只有定义了INLINE_CACHE才有统计,否则返回空list
+static bool primSystemInlineCacheStats(VM *vm, Value *args UNUSED)
+{
+    ObjList *objList = newObjList(vm, 0);
+#ifdef INLINE_CACHE
+    pushTmpRoot(vm, (ObjHeader *)objList);
+    uint32_t idx = 0;
+    while (idx < vm->inlineCacheStatNum)
+    {
+        InlineCacheStat *stat = &vm->inlineCacheStats[idx];
+        if (stat->hits + stat->misses == 0)
+        {
+            idx++;
+            continue;
+        }
+        
+        String *name = &vm->allMethodNames.datas[idx];
+        Value nameValue = OBJ_TO_VALUE(newObjString(vm, name->str, name->length));
+        pushTmpRoot(vm, VALUE_TO_OBJ(nameValue));
+        ObjList *item = newObjList(vm, 4);
+        item->elements.datas[0] = nameValue;
+        item->elements.datas[1] = NUM_TO_VALUE(stat->hits);
+        item->elements.datas[2] = NUM_TO_VALUE(stat->misses);
+        item->elements.datas[3] = NUM_TO_VALUE(stat->megamorphicMisses);
+        popTmpRoot(vm);
+        
+        Value itemValue = OBJ_TO_VALUE(item);
+        pushTmpRoot(vm, (ObjHeader *)item);
+        ValueBufferAdd(vm, &objList->elements, itemValue);
+        LIST_WRITE_BARRIER(vm, objList, objList->elements.count - 1, objList->elements.count, itemValue);
+        popTmpRoot(vm);
+        idx++;
+    }
+    popTmpRoot(vm);
+#endif
+    RET_OBJ(objList);
+}
+
 void coreSystemBind(VM *vm, ObjModule *coreModule)
 {
     Class *systemClass = VALUE_TO_CLASS(getCoreClassValue(coreModule, "System"));
     PRIM_METHOD_BIND(systemClass->objHeader.class, "clock", primSystemClock);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "monotonic", primSystemMonotonic);
     PRIM_METHOD_BIND(systemClass->objHeader.class, "importModule(_)", primSystemImportModule);
     PRIM_METHOD_BIND(systemClass->objHeader.class, "getModuleVariable(_,_)", primSystemGetModuleVariable);
     PRIM_METHOD_BIND(systemClass->objHeader.class, "writeString_(_)", primSystemWriteString);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "writeNum_(_)", primSystemWriteNum);
     PRIM_METHOD_BIND(systemClass->objHeader.class, "inputString_()", primSystemInputString);
     PRIM_METHOD_BIND(systemClass->objHeader.class, "getRand(_,_)", primSystemGetRand);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "gc()", primSystemGC);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "gcPauses", primSystemGCPauses);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "gcMaxPause", primSystemGCMaxPause);
+    PRIM_METHOD_BIND(systemClass->objHeader.class, "inlineCacheStats", primSystemInlineCacheStats);
 }
 
@@ -11,11 +11,13 @@
 #include "core.h"
 
 extern Value getCoreClassValue(ObjModule *objModule, const char *name);
-extern ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode);
+extern ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode, const char *modulePath);
 extern ObjModule *getModule(VM *vm, Value moduleName);
 extern char *readModule(const char *moduleName);
+extern char *getFilePath(const char *moduleName);
 extern bool validateString(VM *vm, Value arg);
 extern bool validateIntValue(VM *vm, double value);
+extern uint32_t formatNum(double num, char *buf);
 
 void coreSystemBind(VM *vm, ObjModule *coreModule);
 
@@ -27,6 +27,11 @@ static bool primThreadNew(VM *vm, Value *args)
 static bool primThreadAbort(VM *vm, Value *args)
 {
     //此函数后续未处理,暂时放着
+    //线程退出后vm会以C字符串打印字符串类型的err,趁它还在栈上时处理
+    if (VALUE_IS_OBJSTR(args[1]))
+    {
+        terminateString(vm, VALUE_TO_OBJSTR(args[1]));
+    }
     vm->curThread->errorObj = args[1]; //保存退出参数
     return VALUE_IS_NULL(args[1]);
 }
@@ -6,15 +6,19 @@
 #include "vm.h"
 #include "obj_thread.h"
 #include "compiler.h"
+#include "bytecode_cache.h"
 #include "obj_range.h"
 #include "obj_map.h"
 #include "unicodeUtf8.h"
+#include "dtoa.h"
+#include "gc.h"
 /* Core 标准库 */
 #include "core.System/core.System.h"
 #include "core.Range/core.Range.h"
 #include "core.Map/core.Map.h"
 #include "core.List/core.List.h"
 #include "core.String/core.String.h"
+#include "core.StringBuilder/core.StringBuilder.h"
 #include "core.Num/core.Num.h"
 #include "core.Null/core.Null.h"
 #include "core.Function/core.Function.h"
@@ -54,28 +58,147 @@ char *readFile(const char *path)
     return fileContent;
 }
 
-//将数字转换为字符串
-ObjString *num2str(VM *vm, double num)
+//两位数字的查找表,整数转换时一次写两位
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+//小数点前超过14位或小数点后第5位才开始有效时,用科学计数法
+#define NUM_FIXED_MAX_EXPONENT 14
+#define NUM_FIXED_MIN_EXPONENT (-4)
+
+//把整数value的十进制形式写入buf,返回写入的字符数
+static uint32_t formatUint(uint64_t value, char *buf)
+{
+    char tmp[20];
+    char *cur = tmp + sizeof(tmp);
+    while (value >= 100)
+    {
+        cur -= 2;
+        memcpy(cur, digitPairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10)
+    {
+        cur -= 2;
+        memcpy(cur, digitPairs + value * 2, 2);
+    }
+    else
+    {
+        *--cur = (char)('0' + value);
+    }
+    uint32_t length = (uint32_t)(tmp + sizeof(tmp) - cur);
+    memcpy(buf, cur, length);
+    return length;
+}
+
+//把最短表示的数字串digits * 10^exponent按%g的格式写入buf
+static uint32_t formatDigits(const char *digits, uint32_t length, int exponent, char *buf)
+{
+    char *cur = buf;
+    int point = (int)length + exponent;    //小数点在第point个数字之后
+    if (point - 1 >= NUM_FIXED_MAX_EXPONENT || point - 1 < NUM_FIXED_MIN_EXPONENT)
+    {
+        //d.ddde+XX,指数至少两位
+        *cur++ = digits[0];
+        if (length > 1)
+        {
+            *cur++ = '.';
+            memcpy(cur, digits + 1, length - 1);
+            cur += length - 1;
+        }
+        int exp10 = point - 1;
+        *cur++ = 'e';
+        *cur++ = exp10 < 0 ? '-' : '+';
+        exp10 = exp10 < 0 ? -exp10 : exp10;
+        if (exp10 < 10)
+        {
+            *cur++ = '0';
+        }
+        cur += formatUint((uint64_t)exp10, cur);
+    }
+    else if (point <= 0)
+    {
+        //0.000ddd
+        *cur++ = '0';
+        *cur++ = '.';
+        memset(cur, '0', (size_t)-point);
+        cur += -point;
+        memcpy(cur, digits, length);
+        cur += length;
+    }
+    else if ((uint32_t)point >= length)
+    {
+        //ddd000
+        memcpy(cur, digits, length);
+        cur += length;
+        memset(cur, '0', point - length);
+        cur += point - length;
+    }
+    else
+    {
+        //ddd.ddd
+        memcpy(cur, digits, point);
+        cur += point;
+        *cur++ = '.';
+        memcpy(cur, digits + point, length - point);
+        cur += length - point;
+    }
+    *cur = '\0';
+    return (uint32_t)(cur - buf);
+}
+
+//把数字的字符串形式写入buf,返回写入的字符数,不含结尾的'\0'.
+//buf至少要有NUM_STRING_MAX_LENGTH字节.
+//结果是转换回来仍与num相等的最短表示,与locale无关
+uint32_t formatNum(double num, char *buf)
 {
     //nan不是一个确定的值,因此nan和nan是不相等的
     if (num != num)
     {
-        return newObjString(vm, "nan", 3);
+        memcpy(buf, "nan", 4);
+        return 3;
     }
     
     if (num == INFINITY)
     {
-        return newObjString(vm, "infinity", 8);
+        memcpy(buf, "infinity", 9);
+        return 8;
     }
     
     if (num == -INFINITY)
     {
-        return newObjString(vm, "-infinity", 9);
+        memcpy(buf, "-infinity", 10);
+        return 9;
     }
     
-    //以下24字节的缓冲区足以容纳双精度到字符串的转换
-    char buf[24] = { '\0' };
-    int len = sprintf(buf, "%.14g", num);
+    char *cur = buf;
+    if (signbit(num))
+    {
+        *cur++ = '-';
+        num = -num;
+    }
+    
+    //整数直接转换
+    if (num < 1e14 && num == (double)(uint64_t)num)
+    {
+        cur += formatUint((uint64_t)num, cur);
+        *cur = '\0';
+        return (uint32_t)(cur - buf);
+    }
+    
+    char digits[DTOA_MAX_DIGITS];
+    int exponent;
+    uint32_t length = shortestDigits(num, digits, &exponent);
+    return (uint32_t)(cur - buf) + formatDigits(digits, length, exponent, cur);
+}
+
+//将数字转换为字符串
+ObjString *num2str(VM *vm, double num)
+{
+    char buf[NUM_STRING_MAX_LENGTH] = { '\0' };
+    uint32_t len = formatNum(num, buf);
     return newObjString(vm, buf, len);
 }
 
@@ -181,11 +304,12 @@ bool validateKey(VM *vm, Value arg)
         VALUE_IS_NUM(arg) ||
         VALUE_IS_OBJSTR(arg) ||
         VALUE_IS_OBJRANGE(arg) ||
-        VALUE_IS_CLASS(arg))
+        VALUE_IS_CLASS(arg) ||
+        VALUE_IS_OBJINSTANCE(arg))
     {
         return true;
     }
-    SET_ERROR_FALSE(vm, "key must be value type!");
+    SET_ERROR_FALSE(vm, "key must be value type or instance!");
 }
 
 //从码点value创建字符串
@@ -194,19 +318,8 @@ Value makeStringFromCodePoint(VM *vm, int value)
     uint32_t byteNum = getByteNumOfEncodeUtf8(value);
     ASSERT(byteNum != 0, "utf8 encode bytes should be between 1 and 4!");
     
-    //+1是为了结尾的'\0'
-    ObjString *objString = ALLOCATE_EXTRA(vm, ObjString, byteNum + 1);
-    
-    if (objString == NULL)
-    {
-        MEM_ERROR("allocate memory failed in runtime!");
-    }
-    
-    initObjHeader(vm, &objString->objHeader, OT_STRING, vm->stringClass);
-    objString->value.length = byteNum;
-    objString->value.start[byteNum] = '\0';
+    ObjString *objString = allocateObjString(vm, byteNum);
     encodeUtf8((uint8_t *)objString->value.start, value);
-    hashObjString(objString);
     return OBJ_TO_VALUE(objString);
 }
 
@@ -256,6 +369,34 @@ ObjString *newObjStringFromSub(VM *vm, ObjString *sourceStr,
     uint8_t *source = (uint8_t *)sourceStr->value.start;
     uint32_t totalLength = 0, idx = 0;
     
+    //从合法的utf8编码中正向截取时,结果就是源串中的一段字节,可以建成切片:
+    //逐字节截取会跳过开头落在字符中间的后续字节,最后一个字符则完整保留
+    if ((direction == 1 || count == 1) && stringIsValidUtf8(sourceStr))
+    {
+        uint32_t begin = (uint32_t)startIndex, end = (uint32_t)startIndex + count;
+        while (begin < end && (source[begin] & 0xc0) == 0x80)
+        {
+            begin++;
+        }
+        if (begin < end)
+        {
+            uint32_t last = end - 1;
+            while ((source[last] & 0xc0) == 0x80)
+            {
+                last--;
+            }
+            uint32_t lastEnd = last + getByteNumOfDecodeUtf8(source[last]);
+            end = lastEnd > end ? lastEnd : end;
+        }
+        else
+        {
+            end = begin;
+        }
+        ObjString *result = newStringSlice(vm, sourceStr, begin, end - begin);
+        result->utf8 = sourceStr->utf8 == UTF8_ASCII ? UTF8_ASCII : UTF8_VALID;
+        return result;
+    }
+    
     //计算count个utf8编码的字符总共需要的字节数,后面好申请空间
     while (idx < count)
     {
@@ -263,17 +404,7 @@ ObjString *newObjStringFromSub(VM *vm, ObjString *sourceStr,
         idx++;
     }
     
-    //+1是为了结尾的'\0'
-    ObjString *result = ALLOCATE_EXTRA(vm, ObjString, totalLength + 1);
-    
-    if (result == NULL)
-    {
-        MEM_ERROR("allocate memory failed in runtime!");
-    }
-    initObjHeader(vm, &result->objHeader, OT_STRING, vm->stringClass);
-    result->value.start[totalLength] = '\0';
-    result->value.length = totalLength;
-    
+    ObjString *result = allocateObjString(vm, totalLength);
     uint8_t *dest = (uint8_t *)result->value.start;
     idx = 0;
     while (idx < count)
@@ -289,38 +420,27 @@ ObjString *newObjStringFromSub(VM *vm, ObjString *sourceStr,
         idx++;
     }
     
-    hashObjString(result);
     return result;
 }
 
-//使用Boyer-Moore-Horspool字符串匹配算法在haystack中查找needle,大海捞针
-int findString(ObjString *haystack, ObjString *needle)
+//用Boyer-Moore-Horspool算法在haystack的[from, haystackLength)中查找needle,大海捞针.
+//needle不为空,且不比待查找的部分长
+static int searchHorspool(const char *haystack, uint32_t haystackLength,
+    const char *needle, uint32_t needleLength, uint32_t from)
 {
-    //如果待查找的patten为空则为找到
-    if (needle->value.length == 0)
-    {
-        return 0;    //返回起始下标0
-    }
-    
-    //若待搜索的字符串比原串还长 肯定搜不到
-    if (needle->value.length > haystack->value.length)
-    {
-        return -1;
-    }
-    
     //构建"bad-character shift表"以确定窗口滑动的距离
-    //数组shift的值便是滑动距离
-    uint32_t shift[UINT8_MAX];
+    //数组shift的值便是滑动距离,每个字节值都要有一项
+    uint32_t shift[UINT8_MAX + 1];
     //needle中最后一个字符的下标
-    uint32_t needleEnd = needle->value.length - 1;
+    uint32_t needleEnd = needleLength - 1;
     
     //一、 先假定"bad character"不属于needle(即pattern),
     //对于这种情况,滑动窗口跨过整个needle
     uint32_t idx = 0;
-    while (idx < UINT8_MAX)
+    while (idx <= UINT8_MAX)
     {
         // 默认为滑过整个needle的长度
-        shift[idx] = needle->value.length;
+        shift[idx] = needleLength;
         idx++;
     }
     
@@ -330,30 +450,28 @@ int findString(ObjString *haystack, ObjString *needle)
     idx = 0;
     while (idx < needleEnd)
     {
-        char c = needle->value.start[idx];
         //idx从前往后遍历needle,当needle中有重复的字符c时,
         //后面的字符c会覆盖前面的同名字符c,这保证了数组shilf中字符是needle中最末位置的字符,
         //从而保证了shilf[c]的值是needle中最末端同名字符与needle末端的偏移量
-        shift[(uint8_t)c] = needleEnd - idx;
+        shift[(uint8_t)needle[idx]] = needleEnd - idx;
         idx++;
     }
     
     //Boyer-Moore-Horspool是从后往前比较,这是处理bad-character高效的地方,
     //因此获取needle中最后一个字符,用于同haystack的窗口中最后一个字符比较
-    char lastChar = needle->value.start[needleEnd];
+    char lastChar = needle[needleEnd];
     
     //长度差便是滑动窗口的滑动范围
-    uint32_t range = haystack->value.length - needle->value.length;
+    uint32_t range = haystackLength - needleLength;
     
     //从haystack中扫描needle,寻找第1个匹配的字符 如果遍历完了就停止
-    idx = 0;
+    idx = from;
     while (idx <= range)
     {
         //拿needle中最后一个字符同haystack窗口的最后一个字符比较
         //(因为Boyer-Moore-Horspool是从后往前比较), 如果匹配,看整个needle是否匹配
-        char c = haystack->value.start[idx + needleEnd];
-        if (lastChar == c &&
-            memcmp(haystack->value.start + idx, needle->value.start, needleEnd) == 0)
+        char c = haystack[idx + needleEnd];
+        if (lastChar == c && memcmp(haystack + idx, needle, needleEnd) == 0)
         {
             //找到了就返回匹配的位置
             return (int)idx;
@@ -367,6 +485,173 @@ int findString(ObjString *haystack, ObjString *needle)
     return -1;
 }
 
+//有SIMD时,一次比较一块连续的窗口:窗口的首字节和末字节都与needle相同时才逐字节比较,
+//其余窗口一次排除.有AVX2时一块32个窗口,只有SSE2时16个.
+//定义NO_SIMD时只用Boyer-Moore-Horspool,便于对比
+#if defined(__AVX2__) && !defined(NO_SIMD)
+#include <immintrin.h>
+
+#define SEARCH_BLOCK 32
+typedef __m256i SearchVector;
+
+static inline SearchVector searchBroadcast(char c)
+{
+    return _mm256_set1_epi8(c);
+}
+
+//块中首字节与first相同、末字节与last相同的窗口,每个窗口占1位
+static inline uint32_t searchBlock(const char *window, uint32_t needleEnd,
+    SearchVector first, SearchVector last)
+{
+    __m256i head = _mm256_loadu_si256((const __m256i *)window);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(window + needleEnd));
+    __m256i match = _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last));
+    return (uint32_t)_mm256_movemask_epi8(match);
+}
+
+#elif defined(__SSE2__) && !defined(NO_SIMD)
+#include <emmintrin.h>
+
+#define SEARCH_BLOCK 16
+typedef __m128i SearchVector;
+
+static inline SearchVector searchBroadcast(char c)
+{
+    return _mm_set1_epi8(c);
+}
+
+static inline uint32_t searchBlock(const char *window, uint32_t needleEnd,
+    SearchVector first, SearchVector last)
+{
+    __m128i head = _mm_loadu_si128((const __m128i *)window);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(window + needleEnd));
+    __m128i match = _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last));
+    return (uint32_t)_mm_movemask_epi8(match);
+}
+
+#endif
+
+//在haystack中从下标from开始查找needle,返回第一次出现的下标,找不到返回-1
+int findStringFrom(ObjString *haystack, ObjString *needle, uint32_t from)
+{
+    const char *hay = haystack->value.start;
+    const char *pattern = needle->value.start;
+    uint32_t hayLength = haystack->value.length;
+    uint32_t needleLength = needle->value.length;
+    
+    //如果待查找的patten为空则为找到
+    if (needleLength == 0)
+    {
+        return from <= hayLength ? (int)from : -1;
+    }
+    
+    //若待搜索的字符串比原串还长 肯定搜不到
+    if (from > hayLength || needleLength > hayLength - from)
+    {
+        return -1;
+    }
+    
+    //单个字节时memchr最快
+    if (needleLength == 1)
+    {
+        const char *found = memchr(hay + from, pattern[0], hayLength - from);
+        return found == NULL ? -1 : (int)(found - hay);
+    }
+    
+    uint32_t idx = from;
+#ifdef SEARCH_BLOCK
+    uint32_t needleEnd = needleLength - 1;
+    uint32_t range = hayLength - needleLength;
+    SearchVector first = searchBroadcast(pattern[0]);
+    SearchVector last = searchBroadcast(pattern[needleEnd]);
+    
+    //块中最后一个窗口的末字节不能越过haystack
+    while (idx + SEARCH_BLOCK - 1 <= range)
+    {
+        uint32_t mask = searchBlock(hay + idx, needleEnd, first, last);
+        while (mask != 0)
+        {
+            uint32_t offset = idx + (uint32_t)__builtin_ctz(mask);
+            if (memcmp(hay + offset + 1, pattern + 1, needleLength - 2) == 0)
+            {
+                return (int)offset;
+            }
+            mask &= mask - 1;
+        }
+        idx += SEARCH_BLOCK;
+    }
+    
+    //剩下不足一块时用Boyer-Moore-Horspool
+    if (idx > range)
+    {
+        return -1;
+    }
+#endif
+    return searchHorspool(hay, hayLength, pattern, needleLength, idx);
+}
+
+//在haystack中查找needle,返回第一次出现的下标,找不到返回-1
+int findString(ObjString *haystack, ObjString *needle)
+{
+    return findStringFrom(haystack, needle, 0);
+}
+
+//在haystack中查找needle,返回最后一次出现的下标,找不到返回-1
+int findLastString(ObjString *haystack, ObjString *needle)
+{
+    const char *hay = haystack->value.start;
+    const char *pattern = needle->value.start;
+    uint32_t needleLength = needle->value.length;
+    
+    if (needleLength > haystack->value.length)
+    {
+        return -1;
+    }
+    
+    //从最后一个窗口往前找,end是尚未检查的窗口数
+    uint32_t end = haystack->value.length - needleLength + 1;
+    if (needleLength == 0)
+    {
+        return (int)(end - 1);
+    }
+    
+#ifdef SEARCH_BLOCK
+    if (needleLength > 1)
+    {
+        uint32_t needleEnd = needleLength - 1;
+        SearchVector first = searchBroadcast(pattern[0]);
+        SearchVector last = searchBroadcast(pattern[needleEnd]);
+        while (end >= SEARCH_BLOCK)
+        {
+            uint32_t base = end - SEARCH_BLOCK;
+            uint32_t mask = searchBlock(hay + base, needleEnd, first, last);
+            while (mask != 0)
+            {
+                //从块中靠后的窗口开始比较
+                uint32_t bit = 31 - (uint32_t)__builtin_clz(mask);
+                if (memcmp(hay + base + bit + 1, pattern + 1, needleLength - 2) == 0)
+                {
+                    return (int)(base + bit);
+                }
+                mask &= ~(1u << bit);
+            }
+            end = base;
+        }
+    }
+#endif
+    
+    //逐个窗口比较首字节,相同时再比较整个窗口
+    while (end > 0)
+    {
+        end--;
+        if (hay[end] == pattern[0] && memcmp(hay + end, pattern, needleLength) == 0)
+        {
+            return (int)end;
+        }
+    }
+    return -1;
+}
+
 //返回核心类name的value结构
 Value getCoreClassValue(ObjModule *objModule, const char *name)
 {
@@ -383,16 +668,30 @@ Value getCoreClassValue(ObjModule *objModule, const char *name)
 //从modules中获取名为moduleName的模块
 ObjModule *getModule(VM *vm, Value moduleName)
 {
-    Value value = mapGet(vm->allModules, moduleName);
-    if (value.type == VT_UNDEFINED)
+    Value value = mapGet(vm, vm->allModules, moduleName);
+    if (VALUE_IS_UNDEFINED(value))
     {
         return NULL;
     }
-    return (ObjModule *)(value.objHeader);
+    return VALUE_TO_OBJMODULE(value);
 }
 
-//载入模块moduleName并编译
-ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode)
+//创建执行模块函数fn的线程
+static ObjThread *newModuleThread(VM *vm, ObjFn *fn)
+{
+    pushTmpRoot(vm, (ObjHeader *)fn);
+    ObjClosure *objClosure = newObjClosure(vm, fn);
+    pushTmpRoot(vm, (ObjHeader *)objClosure);
+    ObjThread *moduleThread = newObjThread(vm, objClosure);
+    popTmpRoot(vm);  // objClosure
+    popTmpRoot(vm);  // fn
+    
+    return moduleThread;
+}
+
+//载入模块moduleName并编译,
+//modulePath是模块的源码文件,不为NULL时优先使用字节码缓存,编译后再更新缓存
+ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode, const char *modulePath)
 {
     //确保模块已经载入到 vm->allModules
     //先查看是否已经导入了该模块,避免重新导入
@@ -405,8 +704,13 @@ ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode)
         ObjString *modName = VALUE_TO_OBJSTR(moduleName);
         ASSERT(modName->value.start[modName->value.length] == '\0', "string.value.start is not terminated!");
         
+        //模块名可能是刚创建的字符串,在其做为key加入allModules之前避免被gc回收
+        pushTmpRoot(vm, (ObjHeader *)modName);
         module = newObjModule(vm, modName->value.start);
+        pushTmpRoot(vm, (ObjHeader *)module);
         mapSet(vm, vm->allModules, moduleName, OBJ_TO_VALUE(module));
+        popTmpRoot(vm);  // module
+        popTmpRoot(vm);  // modName
         
         //继承核心模块中的变量
         ObjModule *coreModule = getModule(vm, CORE_MODULE);
@@ -421,15 +725,24 @@ ObjThread *loadModule(VM *vm, Value moduleName, const char *moduleCode)
         }
     }
     
-    ObjFn *fn = compileModule(vm, module, moduleCode);
-    ObjClosure *objClosure = newObjClosure(vm, fn);
-    ObjThread *moduleThread = newObjThread(vm, objClosure);
-    
-    return moduleThread;
+    ObjFn *fn = NULL;
+    if (modulePath != NULL)
+    {
+        fn = loadBytecodeCache(vm, module, modulePath, moduleCode);
+    }
+    if (fn == NULL)
+    {
+        fn = compileModule(vm, module, moduleCode);
+        if (modulePath != NULL)
+        {
+            saveBytecodeCache(vm, fn, modulePath, moduleCode);
+        }
+    }
+    return newModuleThread(vm, fn);
 }
 
 //获取文件全路径
-static char *getFilePath(const char *moduleName)
+char *getFilePath(const char *moduleName)
 {
     uint32_t rootDirLength = rootDir == NULL ? 0 : strlen(rootDir);
     uint32_t nameLength = strlen(moduleName);
@@ -467,16 +780,29 @@ static bool primObjectNot(VM *vm UNUSED, Value *args)
     RET_VALUE(VT_TO_VALUE(VT_FALSE));
 }
 
+//字符串比较或哈希之前须先展平rope
+static void flattenValue(VM *vm, Value value)
+{
+    if (VALUE_IS_OBJSTR(value))
+    {
+        flattenString(vm, VALUE_TO_OBJSTR(value));
+    }
+}
+
 //args[0] == args[1]: 返回object是否相等
-static bool primObjectEqual(VM *vm UNUSED, Value *args)
+static bool primObjectEqual(VM *vm, Value *args)
 {
+    flattenValue(vm, args[0]);
+    flattenValue(vm, args[1]);
     Value boolValue = BOOL_TO_VALUE(valueIsEqual(args[0], args[1]));
     RET_VALUE(boolValue);
 }
 
 //args[0] != args[1]: 返回object是否不等
-static bool primObjectNotEqual(VM *vm UNUSED, Value *args)
+static bool primObjectNotEqual(VM *vm, Value *args)
 {
+    flattenValue(vm, args[0]);
+    flattenValue(vm, args[1]);
     Value boolValue = BOOL_TO_VALUE(!valueIsEqual(args[0], args[1]));
     RET_VALUE(boolValue);
 }
@@ -491,7 +817,7 @@ static bool primObjectIs(VM *vm, Value *args)
     }
     
     Class *thisClass = getClassOfObj(vm, args[0]);
-    Class *baseClass = (Class *)(args[1].objHeader);
+    Class *baseClass = VALUE_TO_CLASS(args[1]);
     
     //有可能是多级继承,因此自下而上遍历基类链
     while (baseClass != NULL)
@@ -512,11 +838,19 @@ static bool primObjectIs(VM *vm, Value *args)
 //args[0].tostring: 返回args[0]所属class的名字
 static bool primObjectToString(VM *vm UNUSED, Value *args)
 {
-    Class *class = args[0].objHeader->class;
+    Class *class = VALUE_TO_OBJ(args[0])->class;
     Value nameValue = OBJ_TO_VALUE(class->name);
     RET_VALUE(nameValue);
 }
 
+//args[0].hashCode:返回args[0]的哈希码,类和实例等对象用标识哈希.
+//作为map的key时,实例的类可以覆写hashCode与==(_)自定义相等
+static bool primObjectHashCode(VM *vm, Value *args)
+{
+    flattenValue(vm, args[0]);
+    RET_NUM(hashValue(args[0]));
+}
+
 //args[0].type:返回对象args[0]的类
 static bool primObjectType(VM *vm, Value *args)
 {
@@ -548,32 +882,81 @@ static bool primClassToString(VM *vm UNUSED, Value *args)
 }
 
 //args[0].same(args[1], args[2]): 返回args[1]和args[2]是否相等
-static bool primObjectmetaSame(VM *vm UNUSED, Value *args)
+static bool primObjectmetaSame(VM *vm, Value *args)
 {
+    flattenValue(vm, args[1]);
+    flattenValue(vm, args[2]);
     Value boolValue = BOOL_TO_VALUE(valueIsEqual(args[1], args[2]));
     RET_VALUE(boolValue);
 }
 
 //执行模块
-VMResult executeModule(VM *vm, Value moduleName, const char *moduleCode)
+VMResult executeModule(VM *vm, Value moduleName, const char *moduleCode, const char *modulePath)
 {
-    ObjThread *objThread = loadModule(vm, moduleName, moduleCode);
+    ObjThread *objThread = loadModule(vm, moduleName, moduleCode, modulePath);
     return executeInstruction(vm, objThread);
 }
 
+//符号的fnv-1a哈希值
+static uint32_t hashSymbol(const char *symbol, uint32_t length)
+{
+    uint32_t hashCode = 2166136261;
+    uint32_t idx = 0;
+    while (idx < length)
+    {
+        hashCode ^= (uint8_t)symbol[idx++];
+        hashCode *= 16777619;
+    }
+    return hashCode;
+}
+
+//把索引为index的符号录入哈希索引,线性探测找空槽
+static void insertSymbolHash(SymbolTable *table, uint32_t index)
+{
+    uint32_t mask = table->hashCapacity - 1;
+    uint32_t slot = hashSymbol(table->datas[index].str, table->datas[index].length) & mask;
+    while (table->hashIndex[slot] != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    table->hashIndex[slot] = index + 1;
+}
+
+//以newCapacity个槽重建table的哈希索引
+static void rehashSymbolTable(VM *vm, SymbolTable *table, uint32_t newCapacity)
+{
+    table->hashIndex = (uint32_t *)memManager(vm, table->hashIndex,
+        table->hashCapacity * sizeof(uint32_t), newCapacity * sizeof(uint32_t));
+    table->hashCapacity = newCapacity;
+    memset(table->hashIndex, 0, newCapacity * sizeof(uint32_t));
+    uint32_t index = 0;
+    while (index < table->count)
+    {
+        insertSymbolHash(table, index++);
+    }
+}
+
 //table中查找符号symbol 找到后返回索引,否则返回-1
 int getIndexFromSymbolTable(SymbolTable *table, const char *symbol, uint32_t length)
 {
     ASSERT(length != 0, "length of symbol is 0!");
-    uint32_t index = 0;
-    while (index < table->count)
+    if (table->hashCapacity == 0)
+    {
+        return -1;
+    }
+    uint32_t mask = table->hashCapacity - 1;
+    uint32_t slot = hashSymbol(symbol, length) & mask;
+    
+    //装载因子不超过1/2,总能遇到空槽结束探测
+    while (table->hashIndex[slot] != 0)
     {
+        uint32_t index = table->hashIndex[slot] - 1;
         if (length == table->datas[index].length &&
             memcmp(table->datas[index].str, symbol, length) == 0)
         {
             return (int)index;
         }
-        index++;
+        slot = (slot + 1) & mask;
     }
     return -1;
 }
@@ -587,10 +970,45 @@ int addSymbol(VM *vm, SymbolTable *table, const char *symbol, uint32_t length)
     memcpy(string.str, symbol, length);
     string.str[length] = '\0';
     string.length = length;
-    StringBufferAdd(vm, table, string);
+    
+    if (table->count == table->capacity)
+    {
+        uint32_t newCapacity = ceilToPowerOf2(table->count + 1);
+        table->datas = (String *)memManager(vm, table->datas,
+            table->capacity * sizeof(String), newCapacity * sizeof(String));
+        table->capacity = newCapacity;
+    }
+    table->datas[table->count++] = string;
+    
+    //哈希索引的装载因子超过1/2时扩容
+    if (table->count * 2 > table->hashCapacity)
+    {
+        rehashSymbolTable(vm, table, table->hashCapacity == 0 ? 8 : table->hashCapacity * 2);
+    }
+    else
+    {
+        insertSymbolHash(table, table->count - 1);
+    }
     return (int)table->count - 1;
 }
 
+//删除table中索引不小于count的符号,使table只保留前count个符号
+void truncateSymbolTable(VM *vm, SymbolTable *table, uint32_t count)
+{
+    if (count >= table->count)
+    {
+        return;
+    }
+    while (table->count > count)
+    {
+        String *symbol = &table->datas[--table->count];
+        DEALLOCATE_ARRAY(vm, symbol->str, symbol->length + 1);
+    }
+    
+    //开放定址无法直接删除,重建哈希索引
+    rehashSymbolTable(vm, table, table->hashCapacity);
+}
+
 //确保符号已添加到符号表
 int ensureSymbolExist(VM *vm, SymbolTable *table, const char *symbol, uint32_t length)
 {
@@ -621,13 +1039,20 @@ void bindMethod(VM *vm, Class *class, uint32_t index, Method method)
         Method emptyPad = { MT_NONE, { 0 }};
         MethodBufferFillWrite(vm, &class->methods, emptyPad, index - class->methods.count + 1);
     }
+    else if (class->methods.datas[index].type != MT_NONE)
+    {
+        //内联缓存中可能还记录着被替换的方法,使缓存了本类的缓存项都过期
+        class->methodVersion++;
+    }
     class->methods.datas[index] = method;
+    WRITE_BARRIER(vm, class);
 }
 
 //绑定基类
 void bindSuperClass(VM *vm, Class *subClass, Class *superClass)
 {
     subClass->superClass = superClass;
+    WRITE_BARRIER(vm, subClass);
     
     //继承基类属性数
     subClass->fieldNum += superClass->fieldNum;
@@ -647,6 +1072,34 @@ static const char *coreModuleCode =
 static const char *extenModuleCode =
 #include "exten.script.inc"
 
+#ifdef CORE_IMAGE
+//构建时由coreImageBuilder预编译上面的核心脚本生成,定义了coreModuleImage和extenModuleImage
+#include "core.image.inc"
+#define CORE_SCRIPT_IMAGE(image) image, sizeof(image), #image
+#else
+#define CORE_SCRIPT_IMAGE(image) NULL, 0, #image
+#endif
+
+#ifdef CORE_IMAGE_BUILDER
+//由映像生成器实现,把编译好的核心脚本输出为名为imageName的字节数组
+extern void emitCoreImage(VM *vm, const char *imageName, ObjFn *fn, const char *sourceCode);
+#endif
+
+//在核心模块中执行核心脚本sourceCode,有预编译的映像时直接载入映像,省去编译
+static void executeCoreScript(VM *vm, ObjModule *coreModule, const char *sourceCode,
+    const Byte *image, uint32_t imageSize, const char *imageName UNUSED)
+{
+    ObjFn *fn = undumpBytecode(vm, coreModule, image, imageSize, sourceCode);
+    if (fn == NULL)
+    {
+        fn = compileModule(vm, coreModule, sourceCode);
+#ifdef CORE_IMAGE_BUILDER
+        emitCoreImage(vm, imageName, fn, sourceCode);
+#endif
+    }
+    executeInstruction(vm, newModuleThread(vm, fn));
+}
+
 //编译核心模块
 void buildCore(VM *vm)
 {
@@ -655,7 +1108,9 @@ void buildCore(VM *vm)
     ObjModule *coreModule = newObjModule(vm, NULL);
     
     //创建核心模块,录入到vm->allModules
+    pushTmpRoot(vm, (ObjHeader *)coreModule);
     mapSet(vm, vm->allModules, CORE_MODULE, OBJ_TO_VALUE(coreModule));
+    popTmpRoot(vm);
     
     //创建object类并绑定方法
     vm->objectClass = defineClass(vm, coreModule, "object");
@@ -665,6 +1120,9 @@ void buildCore(VM *vm)
     PRIM_METHOD_BIND(vm->objectClass, "is(_)", primObjectIs);
     PRIM_METHOD_BIND(vm->objectClass, "toString", primObjectToString);
     PRIM_METHOD_BIND(vm->objectClass, "type", primObjectType);
+    PRIM_METHOD_BIND(vm->objectClass, "hashCode", primObjectHashCode);
+    vm->hashCodeIndex = getIndexFromSymbolTable(&vm->allMethodNames, "hashCode", 8);
+    vm->equalIndex = getIndexFromSymbolTable(&vm->allMethodNames, "==(_)", 5);
     
     //定义classOfClass类,它是所有meta类的meta类和基类
     vm->classOfClass = defineClass(vm, coreModule, "class");
@@ -691,7 +1149,7 @@ void buildCore(VM *vm)
     vm->classOfClass->objHeader.class = vm->classOfClass; //元信息类回路,meta类终点
     
     //执行核心模块
-    executeModule(vm, CORE_MODULE, coreModuleCode);
+    executeCoreScript(vm, coreModule, coreModuleCode, CORE_SCRIPT_IMAGE(coreModuleImage));
     
     /* Core 标准库 */
     //Bool类
@@ -706,6 +1164,8 @@ void buildCore(VM *vm)
     coreNumBind(vm, coreModule);
     //字符串类
     coreStringBind(vm, coreModule);
+    //StringBuilder类
+    coreStringBuilderBind(vm, coreModule);
     //List类
     coreListBind(vm, coreModule);
     //map类
@@ -716,7 +1176,7 @@ void buildCore(VM *vm)
     coreSystemBind(vm, coreModule);
     
     /* Exten 扩展库 */
-    executeModule(vm, CORE_MODULE, extenModuleCode);
+    executeCoreScript(vm, coreModule, extenModuleCode, CORE_SCRIPT_IMAGE(extenModuleImage));
     
     // 扩展库绑定至coreModule
     #include "exten.Bind.inc"
@@ -726,13 +1186,20 @@ void buildCore(VM *vm)
     
     //在核心自举过程中创建了很多ObjString对象,创建过程中需要调用initObjHeader初始化对象头,
     //使其class指向vm->stringClass.但那时的vm->stringClass尚未初始化,因此现在更正.
-    ObjHeader *objHeader = vm->allObjects;
-    while (objHeader != NULL)
+    //自举期间可能已经发生过gc,部分字符串已晋升到老生代或尚在等待增量清扫,都要更正
+    ObjHeader *generations[] = { vm->allObjects, vm->oldObjects, vm->unswept[0], vm->unswept[1] };
+    uint32_t gen = 0;
+    while (gen < 4)
     {
-        if (objHeader->type == OT_STRING)
+        ObjHeader *objHeader = generations[gen];
+        while (objHeader != NULL)
         {
-            objHeader->class = vm->stringClass;
+            if (objHeader->type == OT_STRING)
+            {
+                objHeader->class = vm->stringClass;
+            }
+            objHeader = objHeader->next;
         }
-        objHeader = objHeader->next;
+        gen++;
     }
 }
@@ -7,6 +7,10 @@ extern char *rootDir;
 
 #define CORE_MODULE VT_TO_VALUE(VT_NULL)
 
+//32字节的缓冲区足以容纳双精度数字转换成的字符串,
+//最长的如"-0.000012345678901234567"及"-1.2345678901234567e-308"
+#define NUM_STRING_MAX_LENGTH 32
+
 //返回值类型是Value类型,且是放在args[0], args是Value数组
 //RET_VALUE的参数就是Value类型,无须转换直接赋值.
 //它是后面"RET_其它类型"的基础
@@ -49,12 +53,14 @@ extern char *rootDir;
 
 char *readFile(const char *sourceFile);
 
-VMResult executeModule(VM *vm, Value moduleName, const char *moduleCode);
+VMResult executeModule(VM *vm, Value moduleName, const char *moduleCode, const char *modulePath);
 
 int getIndexFromSymbolTable(SymbolTable *table, const char *symbol, uint32_t length);
 
 int addSymbol(VM *vm, SymbolTable *table, const char *symbol, uint32_t length);
 
+void truncateSymbolTable(VM *vm, SymbolTable *table, uint32_t count);
+
 void buildCore(VM *vm);
 
 void bindMethod(VM *vm, Class *class, uint32_t index, Method method);
@@ -0,0 +1,51 @@
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+'''
+编译基准:生成一个5万行的模块,考察编译大模块的耗时.
+模块中有大量互不相同的模块变量与方法名,主要压测符号表的查找.
+用法: python3 compile_big.py <Tiderip>
+'''
+
+UNIT_NUM = 8330    # 每个单元6行
+GROUP_SIZE = 500   # 每个类中的单元数,类不宜过多,以免运行时为各类建方法表的开销盖过编译
+ROUNDS = 5
+
+modulePath = os.path.join(tempfile.gettempdir(), 'compile_big.vt')
+cachePath = modulePath + 'c'
+
+lines = []
+for group in range(0, UNIT_NUM, GROUP_SIZE):
+    units = range(group, min(group + GROUP_SIZE, UNIT_NUM))
+    for i in units:
+        lines.append('Tide V%d = %d' % (i, i))
+    lines.append('class C%d {' % group)
+    for i in units:
+        lines.append('    static m%d(a) {' % i)
+        lines.append('        return a + V%d' % i)
+        lines.append('    }')
+        lines.append('    static n%d(a, b) { return a * b + V%d }' % (i, i))
+    lines.append('}')
+    for i in units:
+        lines.append('Tide R%d = C%d.m%d(V%d)' % (i, group, i, i))
+lines.append('System.println(R%d)' % (UNIT_NUM - 1))
+
+with open(modulePath, 'w') as f:
+    f.write('\n'.join(lines) + '\n')
+
+best = None
+for r in range(ROUNDS):
+    # 删除字节码缓存,确保每轮都重新编译
+    if os.path.exists(cachePath):
+        os.remove(cachePath)
+    start = time.perf_counter()
+    subprocess.run([sys.argv[1], modulePath], check=True, stdout=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    best = elapsed if best is None else min(best, elapsed)
+
+if os.path.exists(cachePath):
+    os.remove(cachePath)
+print('%d lines, best of %d: %.3fs' % (len(lines), ROUNDS, best))
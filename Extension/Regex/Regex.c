@@ -19,6 +19,23 @@ bool primRegexParse(VM *vm, Value *args)
     bool flagICASE = VALUE_IS_TRUE(args[3]);        // 是否匹配大小写
     bool flagNEWLINE = VALUE_IS_TRUE(args[4]);      // 是否识别换行符
     
+    //regcomp需要以'\0'结尾的字符串
+    terminateString(vm, objPattern);
+    
+    const size_t nmatch = 1;    //定义匹配结果最大允许数
+    regmatch_t pmatch[1];   //定义匹配结果在待匹配串中的下标范围
+    int eflags = 0;
+#ifdef REG_STARTEND
+    //指明待匹配串的范围,regexec就不必用strlen求长度,切片也不必以'\0'结尾.
+    //否则循环匹配剩余字符串时,每次都要扫描整个剩余部分
+    flattenString(vm, objBuf);
+    pmatch[0].rm_so = 0;
+    pmatch[0].rm_eo = objBuf->value.length;
+    eflags = REG_STARTEND;
+#else
+    terminateString(vm, objBuf);
+#endif
+    
     char *pattern = objPattern->value.start;
     char *buf = objBuf->value.start;
     
@@ -40,40 +57,30 @@ bool primRegexParse(VM *vm, Value *args)
         regcomp(&reg, pattern, REG_EXTENDED);    //编译正则模式串
     }
     
-    const size_t nmatch = 1;    //定义匹配结果最大允许数
-    regmatch_t pmatch[1];   //定义匹配结果在待匹配串中的下标范围
-    int status = regexec(&reg, buf, nmatch, pmatch, 0); //匹配,status存储匹配结果(bool)
-    
-    int len = (pmatch[0].rm_eo - pmatch[0].rm_so);
-    char retString[len];    //存储匹配结果
-    
-    int retEndIndex = pmatch[0].rm_eo;
+    int status = regexec(&reg, buf, nmatch, pmatch, eflags); //匹配,status存储匹配结果(bool)
+    regfree(&reg);  //释放正则表达式
     
-    if (status == REG_NOMATCH)
+    if (status != 0)
     { //如果没匹配上
         RET_NULL    // 返回null
     }
-    else if (status == 0)
-    {  //如果匹配上了
-        for (int i = pmatch[0].rm_so, j = 0; i < pmatch[0].rm_eo; i++)
-        {    //遍历输出匹配范围的字符串
-            retString[j++] = buf[i];
-        }
-    }
-    regfree(&reg);  //释放正则表达式
     
-    int proLen = (int)(strlen(buf) - retEndIndex);
-    char processString[proLen];
-    for (int i = retEndIndex, j = 0; i < strlen(buf); i++)
-    {
-        processString[j++] = buf[i];
-    }
+    //匹配结果与剩余字符串都是待匹配串的子串,较长时与其共用字符
+    uint32_t matchStart = (uint32_t)pmatch[0].rm_so;
+    uint32_t matchEnd = (uint32_t)pmatch[0].rm_eo;
+    uint32_t bufLength = objBuf->value.length;
     
     ObjList *objList = newObjList(vm, 0);
-    ObjString *objString = newObjString(vm, (const char *)retString, len);
-    ObjString *objProString = newObjString(vm, (const char *)processString, proLen);
+    pushTmpRoot(vm, (ObjHeader *)objList);  //创建字符串时可能触发gc
+    ObjString *objString = newStringSlice(vm, objBuf, matchStart, matchEnd - matchStart);
+    pushTmpRoot(vm, (ObjHeader *)objString);    //扩容list时可能触发gc
     ValueBufferAdd(vm, &objList->elements, OBJ_TO_VALUE(objString));    // 匹配结果
+    popTmpRoot(vm);
+    ObjString *objProString = newStringSlice(vm, objBuf, matchEnd, bufLength - matchEnd);
+    pushTmpRoot(vm, (ObjHeader *)objProString);
     ValueBufferAdd(vm, &objList->elements, OBJ_TO_VALUE(objProString)); // 剩余字符串
+    popTmpRoot(vm);
+    popTmpRoot(vm);
     RET_OBJ(objList);
 }
 
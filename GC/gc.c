@@ -0,0 +1,932 @@
+#include "gc.h"
+#include "compiler.h"
+#include "obj_list.h"
+#include "obj_range.h"
+#include "obj_string_builder.h"
+#include <time.h>
+
+//把obj的[start, end)部分放入灰对象数组,待标黑
+static void pushGray(VM *vm, ObjHeader *obj, uint32_t start, uint32_t end,
+    bool isCounted, bool isDirtyRange)
+{
+    //若超过了容量就扩容
+    if (vm->grays.count >= vm->grays.capacity)
+    {
+        vm->grays.capacity = vm->grays.count * 2;
+        vm->grays.grayObjects =
+            (GrayEntry *)realloc(vm->grays.grayObjects, vm->grays.capacity * sizeof(GrayEntry));
+        if (vm->grays.grayObjects == NULL)
+        {
+            MEM_ERROR("reallocate grayObjects failed!");
+        }
+    }
+
+    GrayEntry *gray = &vm->grays.grayObjects[vm->grays.count++];
+    gray->obj = obj;
+    gray->start = start;
+    gray->end = end;
+    gray->isCounted = isCounted;
+    gray->isDirtyRange = isDirtyRange;
+}
+
+//标灰obj:即把obj收集到数组vm->grays.grayObjects
+void grayObject(VM *vm, ObjHeader *obj)
+{
+    vm->grays.visited++;
+
+    //如果isDark为true表示已经标记过,直接返回.
+    //minor gc只处理新生代,老对象视为已标记
+    if (obj == NULL || obj->isDark || (obj->isOld && vm->gcPhase == GC_MINOR))
+    {
+        return;
+    }
+
+    //标记为可达
+    obj->isDark = true;
+    pushGray(vm, obj, 0, UINT32_MAX, false, false);
+}
+
+//标灰value
+void grayValue(VM *vm, Value value)
+{
+    //只有对象才需要灰化,因为只有对象才有对象头
+    if (!VALUE_IS_OBJ(value))
+    {
+        vm->grays.visited++;
+        return;
+    }
+    grayObject(vm, VALUE_TO_OBJ(value));
+}
+
+//标灰buffer->datas中的value
+static void grayBuffer(VM *vm, ValueBuffer *buffer)
+{
+    uint32_t idx = 0;
+    while (idx < buffer->count)
+    {
+        grayValue(vm, buffer->datas[idx]);
+        idx++;
+    }
+}
+
+//标黑class
+static void blackClass(VM *vm, Class *class)
+{
+    //标灰meta类
+    grayObject(vm, (ObjHeader *)class->objHeader.class);
+
+    //标灰父类
+    grayObject(vm, (ObjHeader *)class->superClass);
+
+    //标灰方法
+    uint32_t idx = 0;
+    while (idx < class->methods.count)
+    {
+        if (class->methods.datas[idx].type == MT_SCRIPT)
+        {
+            grayObject(vm, (ObjHeader *)class->methods.datas[idx].obj);
+        }
+        idx++;
+    }
+
+    //标灰类名
+    grayObject(vm, (ObjHeader *)class->name);
+
+    //累计类大小
+    vm->markedBytes += sizeof(Class);
+    vm->markedBytes += sizeof(Method) * class->methods.capacity;
+}
+
+//标黑闭包
+static void blackClosure(VM *vm, ObjClosure *objClosure)
+{
+    //标灰闭包中的函数
+    grayObject(vm, (ObjHeader *)objClosure->fn);
+
+    //标灰包中的upvalue
+    uint32_t idx = 0;
+    while (idx < objClosure->fn->upvalueNum)
+    {
+        grayObject(vm, (ObjHeader *)objClosure->upvalues[idx]);
+        idx++;
+    }
+
+    //累计闭包大小
+    vm->markedBytes += sizeof(ObjClosure);
+    vm->markedBytes += sizeof(ObjUpvalue *) * objClosure->fn->upvalueNum;
+}
+
+//标黑objThread
+static void blackThread(VM *vm, ObjThread *objThread)
+{
+    //标灰frame
+    uint32_t idx = 0;
+    while (idx < objThread->usedFrameNum)
+    {
+        grayObject(vm, (ObjHeader *)objThread->frames[idx].closure);
+        idx++;
+    }
+
+    //标灰运行时栈中每个slot
+    Value *slot = objThread->stack;
+    while (slot < objThread->esp)
+    {
+        grayValue(vm, *slot);
+        slot++;
+    }
+
+    //标灰本线程中所有的upvalue
+    ObjUpvalue *upvalue = objThread->openUpvalues;
+    while (upvalue != NULL)
+    {
+        grayObject(vm, (ObjHeader *)upvalue);
+        upvalue = upvalue->next;
+    }
+
+    //标灰caller
+    grayObject(vm, (ObjHeader *)objThread->caller);
+    grayValue(vm, objThread->errorObj);
+
+    //累计线程大小
+    vm->markedBytes += sizeof(ObjThread);
+    vm->markedBytes += objThread->frameCapacity * sizeof(Frame);
+    vm->markedBytes += objThread->stackCapacity * sizeof(Value);
+}
+
+//标黑fn
+static void blackFn(VM *vm, ObjFn *fn)
+{
+    //标灰常量
+    grayBuffer(vm, &fn->constants);
+    
+#ifdef INLINE_CACHE
+    //标灰内联缓存中的类和脚本方法
+    uint32_t idx = 0;
+    while (idx < fn->inlineCaches.count)
+    {
+        InlineCache *cache = &fn->inlineCaches.datas[idx];
+        uint32_t entryIdx = 0;
+        while (entryIdx < cache->entryNum)
+        {
+            InlineCacheEntry *entry = &cache->entries[entryIdx];
+            grayObject(vm, (ObjHeader *)entry->class);
+            if (entry->method.type == MT_SCRIPT)
+            {
+                grayObject(vm, (ObjHeader *)entry->method.obj);
+            }
+            entryIdx++;
+        }
+        idx++;
+    }
+#endif
+
+    //标灰所属模块
+    grayObject(vm, (ObjHeader *)fn->module);
+
+    //累计ObjFn的空间
+    vm->markedBytes += sizeof(ObjFn);
+    vm->markedBytes += sizeof(uint8_t) * fn->instrStream.capacity;
+    vm->markedBytes += sizeof(Value) * fn->constants.capacity;
+#ifdef INLINE_CACHE
+    vm->markedBytes += sizeof(InlineCache) * fn->inlineCaches.capacity;
+#endif
+#ifdef DEBUG
+    //再加上debug信息占用的内存
+    vm->markedBytes += sizeof(Int) * fn->debug->lineNo.capacity;
+#endif
+}
+
+//标黑objInstance
+static void blackInstance(VM *vm, ObjInstance *objInstance)
+{
+    //标灰元类
+    grayObject(vm, (ObjHeader *)objInstance->objHeader.class);
+
+    //标灰实例中所有域,域的个数在class->fieldNum
+    uint32_t idx = 0;
+    while (idx < objInstance->objHeader.class->fieldNum)
+    {
+        grayValue(vm, objInstance->fields[idx]);
+        idx++;
+    }
+
+    //累计objInstance空间
+    vm->markedBytes += sizeof(ObjInstance);
+    vm->markedBytes += sizeof(Value) * objInstance->objHeader.class->fieldNum;
+}
+
+//标黑objList:标灰其中[start, end)的元素,isCounted为false时累计list的大小
+static void blackList(VM *vm, ObjList *objList, uint32_t start, uint32_t end, bool isCounted)
+{
+    //标灰list的elements,list在分步扫描期间可能已经变短
+    uint32_t idx = start;
+    while (idx < end && idx < objList->elements.count)
+    {
+        grayValue(vm, objList->elements.datas[idx]);
+        idx++;
+    }
+
+    if (isCounted)
+    {
+        return;
+    }
+
+    //累计objList大小
+    vm->markedBytes += sizeof(ObjList);
+    vm->markedBytes += sizeof(Value) * objList->elements.capacity;
+}
+
+//标黑objMap:标灰其中[start, end)的entry,isCounted为false时累计map的大小
+static void blackMap(VM *vm, ObjMap *objMap, uint32_t start, uint32_t end, bool isCounted)
+{
+    //标灰entry,entry只会追加在末尾,重建时会整体移动,由写屏障重新扫描整个map
+    uint32_t idx = start;
+    while (idx < end && idx < objMap->entryCount)
+    {
+        Entry *entry = &objMap->entries[idx];
+        //跳过无效的entry
+        if (!VALUE_IS_UNDEFINED(entry->key))
+        {
+            grayValue(vm, entry->key);
+            grayValue(vm, entry->value);
+        }
+        idx++;
+    }
+
+    if (isCounted)
+    {
+        return;
+    }
+
+    //累计ObjMap大小
+    vm->markedBytes += sizeof(ObjMap);
+    vm->markedBytes += (sizeof(uint8_t) + sizeof(uint32_t)) * objMap->capacity;
+    vm->markedBytes += sizeof(uint32_t) * objMap->arrayCapacity;
+    vm->markedBytes += sizeof(Entry) * objMap->entryCapacity;
+}
+
+//标黑objModule
+static void blackModule(VM *vm, ObjModule *objModule)
+{
+    //标灰模块中所有模块变量
+    grayBuffer(vm, &objModule->moduleVarValue);
+
+    //标灰模块名
+    grayObject(vm, (ObjHeader *)objModule->name);
+
+    //累计ObjModule大小
+    vm->markedBytes += sizeof(ObjModule);
+    vm->markedBytes += sizeof(String) * objModule->moduleVarName.capacity;
+    vm->markedBytes += sizeof(uint32_t) * objModule->moduleVarName.hashCapacity;
+    vm->markedBytes += sizeof(Value) * objModule->moduleVarValue.capacity;
+}
+
+//标黑range
+static void blackRange(VM *vm)
+{
+    //ObjRange中没有大数据,只有from和to,
+    //其空间属于sizeof(ObjRange),因此不用额外标记
+    vm->markedBytes += sizeof(ObjRange);
+}
+
+//标黑objString
+static void blackString(VM *vm, ObjString *objString)
+{
+    switch (objString->kind)
+    {
+    case SK_ROPE:
+        //rope尚未展平,标灰左右两部分
+        grayObject(vm, (ObjHeader *)ROPE_LEFT(objString));
+        grayObject(vm, (ObjHeader *)ROPE_RIGHT(objString));
+        vm->markedBytes += sizeof(ObjString) + sizeof(ObjString *) * 2;
+        break;
+    case SK_SLICE:
+        //切片的字符属于父串
+        grayObject(vm, (ObjHeader *)SLICE_PARENT(objString));
+        vm->markedBytes += sizeof(ObjString) + sizeof(ObjString *);
+        break;
+    default:
+        //累计ObjString空间 +1是结尾的'\0'
+        vm->markedBytes += sizeof(ObjString) + objString->value.length + 1;
+        break;
+    }
+    if (objString->codePointIndex != NULL)
+    {
+        vm->markedBytes += CODE_POINT_INDEX_SIZE(objString->codePointIndex->count);
+    }
+}
+
+//标黑objStringBuilder
+static void blackStringBuilder(VM *vm, ObjStringBuilder *objBuilder)
+{
+    //buffer归toString的结果所有时由结果字符串累计其空间
+    if (objBuilder->result != NULL)
+    {
+        grayObject(vm, (ObjHeader *)objBuilder->result);
+        vm->markedBytes += sizeof(ObjStringBuilder);
+        return;
+    }
+    vm->markedBytes += sizeof(ObjStringBuilder) + objBuilder->capacity;
+}
+
+//标黑objUpvalue
+static void blackUpvalue(VM *vm, ObjUpvalue *objUpvalue)
+{
+    //标灰objUpvalue的closedUpvalue
+    grayValue(vm, objUpvalue->closedUpvalue);
+
+    //累计objUpvalue大小
+    vm->markedBytes += sizeof(ObjUpvalue);
+}
+
+//标黑obj
+static void blackObject(VM *vm, ObjHeader *obj)
+{
+    switch (obj->type)
+    {
+    case OT_CLASS:
+        blackClass(vm, (Class *)obj);
+        break;
+    case OT_CLOSURE:
+        blackClosure(vm, (ObjClosure *)obj);
+        break;
+    case OT_THREAD:
+        blackThread(vm, (ObjThread *)obj);
+        break;
+    case OT_FUNCTION:
+        blackFn(vm, (ObjFn *)obj);
+        break;
+    case OT_INSTANCE:
+        blackInstance(vm, (ObjInstance *)obj);
+        break;
+    case OT_LIST:
+        blackList(vm, (ObjList *)obj, 0, UINT32_MAX, false);
+        break;
+    case OT_MAP:
+        blackMap(vm, (ObjMap *)obj, 0, UINT32_MAX, false);
+        break;
+    case OT_MODULE:
+        blackModule(vm, (ObjModule *)obj);
+        break;
+    case OT_RANGE:
+        blackRange(vm);
+        break;
+    case OT_STRING:
+        blackString(vm, (ObjString *)obj);
+        break;
+    case OT_UPVALUE:
+        blackUpvalue(vm, (ObjUpvalue *)obj);
+        break;
+    case OT_STRING_BUILDER:
+        blackStringBuilder(vm, (ObjStringBuilder *)obj);
+        break;
+    }
+}
+
+//本步剩余的预算budget个slot能扫描到的位置,每次至少扫描一个元素
+static uint32_t chunkEnd(uint32_t start, uint32_t end, uint32_t budget)
+{
+    if (start < end && end - start > budget)
+    {
+        return start + (budget > 0 ? budget : 1);
+    }
+    return end;
+}
+
+//按list的dirty范围重新扫描,最多扫描budget个元素,未扫描完就放回灰对象数组
+static void rescanDirtyRange(VM *vm, ObjList *objList, uint32_t budget)
+{
+    uint32_t start = objList->dirtyStart;
+    uint32_t end = objList->dirtyEnd < objList->elements.count ?
+        objList->dirtyEnd : objList->elements.count;
+    uint32_t stop = chunkEnd(start, end, budget);
+    if (stop < end)
+    {
+        objList->dirtyStart = stop;
+        pushGray(vm, &objList->objHeader, 0, 0, true, true);
+    }
+    else
+    {
+        //扫描完毕才移出记忆集,此后的写入重新记录范围
+        objList->objHeader.isRemembered = false;
+    }
+    blackList(vm, objList, start, stop, true);
+}
+
+//标黑那些已经标灰的对象,即保留那些标灰的对象.
+//工作量按访问的slot数计算,每个对象另计1,最多处理maxWork.
+//大的list和map按剩余的预算分段扫描,未扫描的部分放回灰对象数组,下一步继续
+static void blackObjectInGray(VM *vm, uint32_t maxWork)
+{
+    //所有要保留的对象都已经收集到了vm->grays.grayObjects中,
+    //现在逐一标黑
+    uint32_t work = 0;
+    while (vm->grays.count > 0 && work < maxWork)
+    {
+        GrayEntry gray = vm->grays.grayObjects[--vm->grays.count];
+        uint32_t visited = vm->grays.visited;
+        if (gray.isDirtyRange)
+        {
+            rescanDirtyRange(vm, (ObjList *)gray.obj, maxWork - work);
+        }
+        else if (gray.obj->type == OT_LIST || gray.obj->type == OT_MAP)
+        {
+            //map的每个entry有key和value两个slot
+            uint32_t slotsPerElement = gray.obj->type == OT_MAP ? 2 : 1;
+            uint32_t end = chunkEnd(gray.start, gray.end, (maxWork - work) / slotsPerElement);
+
+            //先放回未扫描的部分,本段标灰的元素在它之上,会先于它处理,
+            //这样灰对象数组不会随着大list的元素个数增长
+            uint32_t length = gray.obj->type == OT_LIST ?
+                ((ObjList *)gray.obj)->elements.count : ((ObjMap *)gray.obj)->entryCount;
+            if (end < gray.end && end < length)
+            {
+                pushGray(vm, gray.obj, end, gray.end, true, false);
+            }
+
+            if (gray.obj->type == OT_LIST)
+            {
+                blackList(vm, (ObjList *)gray.obj, gray.start, end, gray.isCounted);
+            }
+            else
+            {
+                blackMap(vm, (ObjMap *)gray.obj, gray.start, end, gray.isCounted);
+            }
+        }
+        else
+        {
+            blackObject(vm, gray.obj);
+        }
+        work += 1 + (vm->grays.visited - visited);
+    }
+}
+
+//重新扫描已标记的对象obj,标灰其新写入的引用.
+//obj的大小已经累计过,不再重复累计
+static void rescanObject(VM *vm, ObjHeader *obj)
+{
+    uint32_t markedBytes = vm->markedBytes;
+    blackObject(vm, obj);
+    vm->markedBytes = markedBytes;
+}
+
+//释放obj自身及其占用的内存
+void freeObject(VM *vm, ObjHeader *obj)
+{
+    //根据对象类型分别处理
+    switch (obj->type)
+    {
+    case OT_CLASS:
+        MethodBufferClear(vm, &((Class *)obj)->methods);
+        break;
+
+    case OT_THREAD:
+    {
+        ObjThread *objThread = (ObjThread *)obj;
+        DEALLOCATE_ARRAY(vm, objThread->frames, objThread->frameCapacity);
+        DEALLOCATE_ARRAY(vm, objThread->stack, objThread->stackCapacity);
+        break;
+    }
+
+    case OT_FUNCTION:
+    {
+        ObjFn *fn = (ObjFn *)obj;
+        ValueBufferClear(vm, &fn->constants);
+#ifdef INLINE_CACHE
+        InlineCacheBufferClear(vm, &fn->inlineCaches);
+#endif
+        ByteBufferClear(vm, &fn->instrStream);
+#ifdef DEBUG
+        IntBufferClear(vm, &fn->debug->lineNo);
+        DEALLOCATE(vm, fn->debug->fnName);
+        DEALLOCATE(vm, fn->debug);
+#endif
+        break;
+    }
+
+    case OT_LIST:
+        ValueBufferClear(vm, &((ObjList *)obj)->elements);
+        break;
+
+    case OT_MAP:
+        clearMap(vm, (ObjMap *)obj);
+        break;
+
+    case OT_MODULE:
+        symbolTableClear(vm, &((ObjModule *)obj)->moduleVarName);
+        ValueBufferClear(vm, &((ObjModule *)obj)->moduleVarValue);
+        break;
+
+    case OT_STRING:
+    {
+        //展平后的rope及StringBuilder生成的字符串,字符在单独分配的缓冲区中
+        ObjString *objString = (ObjString *)obj;
+        if (objString->kind == SK_OWNED)
+        {
+            DEALLOCATE_ARRAY(vm, objString->value.start, objString->value.length + 1);
+        }
+        if (objString->codePointIndex != NULL)
+        {
+            memManager(vm, objString->codePointIndex,
+                       CODE_POINT_INDEX_SIZE(objString->codePointIndex->count), 0);
+        }
+        break;
+    }
+
+    case OT_STRING_BUILDER:
+    {
+        ObjStringBuilder *objBuilder = (ObjStringBuilder *)obj;
+        if (objBuilder->result == NULL)
+        {
+            DEALLOCATE_ARRAY(vm, objBuilder->buffer, objBuilder->capacity);
+        }
+        break;
+    }
+
+    case OT_RANGE:
+    case OT_CLOSURE:
+    case OT_INSTANCE:
+    case OT_UPVALUE:
+        break;
+    }
+
+    //最后再释放自己
+    DEALLOCATE(vm, obj);
+}
+
+//把对象obj加入记忆集,由写屏障WRITE_BARRIER调用
+void rememberObject(VM *vm, ObjHeader *obj)
+{
+    obj->isRemembered = true;
+    
+    //list默认整个重新扫描,由LIST_WRITE_BARRIER缩小范围
+    if (obj->type == OT_LIST)
+    {
+        ((ObjList *)obj)->dirtyStart = 0;
+        ((ObjList *)obj)->dirtyEnd = UINT32_MAX;
+    }
+
+    //记忆集由gc自己维护,不经过memManager,避免在写屏障中触发gc
+    if (vm->remembered.count >= vm->remembered.capacity)
+    {
+        vm->remembered.capacity = vm->remembered.count * 2;
+        vm->remembered.objects =
+            (ObjHeader **)realloc(vm->remembered.objects, vm->remembered.capacity * sizeof(ObjHeader *));
+        if (vm->remembered.objects == NULL)
+        {
+            MEM_ERROR("reallocate remembered set failed!");
+        }
+    }
+    vm->remembered.objects[vm->remembered.count++] = obj;
+}
+
+//重新扫描记忆集中的对象.list和map交给blackObjectInGray分段扫描
+static void rescanRemembered(VM *vm)
+{
+    while (vm->remembered.count > 0)
+    {
+        ObjHeader *obj = vm->remembered.objects[--vm->remembered.count];
+        if (obj->type == OT_LIST)
+        {
+            //list只扫描被写入过的元素,扫描完才移出记忆集
+            pushGray(vm, obj, 0, 0, true, true);
+            continue;
+        }
+
+        obj->isRemembered = false;
+        if (obj->type == OT_MAP)
+        {
+            pushGray(vm, obj, 0, UINT32_MAX, true, false);
+        }
+        else
+        {
+            rescanObject(vm, obj);
+        }
+    }
+}
+
+//清空记忆集
+static void clearRemembered(VM *vm)
+{
+    uint32_t idx = 0;
+    while (idx < vm->remembered.count)
+    {
+        vm->remembered.objects[idx]->isRemembered = false;
+        idx++;
+    }
+    vm->remembered.count = 0;
+}
+
+//当前线程的栈及tmpRoots中正在构造的对象会被直接写入引用,
+//它们不经过写屏障,所以在每次gc推进之后放入记忆集
+static void rememberMutatingObjects(VM *vm)
+{
+    if (vm->curThread != NULL)
+    {
+        WRITE_BARRIER(vm, vm->curThread);
+    }
+
+    uint32_t idx = 0;
+    while (idx < vm->tmpRootNum)
+    {
+        //正在构造的list可能已在记忆集中,要把范围扩大到整个list
+        ObjHeader *root = vm->tmpRoots[idx];
+        if (root->type == OT_LIST)
+        {
+            LIST_RANGE_BARRIER(vm, (ObjList *)root, 0, UINT32_MAX);
+        }
+        else
+        {
+            WRITE_BARRIER(vm, root);
+        }
+        idx++;
+    }
+}
+
+//标灰根对象
+static void grayRoots(VM *vm)
+{
+    //allModules不能被释放,模块变量及模块中的函数都经由它可达
+    grayObject(vm, (ObjHeader *)vm->allModules);
+
+    //标灰tmpRoots数组中的对象(不可达但是不想被回收,白名单)
+    uint32_t idx = 0;
+    while (idx < vm->tmpRootNum)
+    {
+        grayObject(vm, vm->tmpRoots[idx]);
+        idx++;
+    }
+
+    //标灰当前线程,不能被回收
+    grayObject(vm, (ObjHeader *)vm->curThread);
+
+    //编译过程中若申请的内存过高就标灰编译单元
+    if (vm->curParser != NULL)
+    {
+        grayCompileUnit(vm, vm->curParser);
+    }
+}
+
+//回收新生代中的白对象,幸存者晋升为老对象并接到老生代链表头部
+static void sweepNursery(VM *vm)
+{
+    ObjHeader **obj = &vm->allObjects;
+    while (*obj != NULL)
+    {
+        //回收白对象
+        if (!((*obj)->isDark))
+        {
+            ObjHeader *unreached = *obj;
+            *obj = unreached->next;
+            freeObject(vm, unreached);
+        }
+        else
+        {
+            (*obj)->isOld = true;
+            (*obj)->isDark = false;
+            obj = &(*obj)->next;
+        }
+    }
+
+    *obj = vm->oldObjects;
+    vm->oldObjects = vm->allObjects;
+    vm->allObjects = NULL;
+}
+
+//增量清扫标记阶段结束时的所有对象,最多处理maxWork个,清扫完毕返回true.
+//存活对象恢复为未标记状态并移入老生代
+static bool sweepUnswept(VM *vm, uint32_t maxWork)
+{
+    uint32_t work = 0;
+    while (work < maxWork)
+    {
+        //先清扫新生代部分,再清扫老生代部分
+        uint32_t part = vm->unswept[0] != NULL ? 0 : 1;
+        ObjHeader *obj = vm->unswept[part];
+        if (obj == NULL)
+        {
+            return true;
+        }
+        vm->unswept[part] = obj->next;
+
+        if (!obj->isDark)
+        {
+            //结束标记时allocatedBytes已只计存活对象,释放白对象不应再从中扣除,
+            //否则它会低于survivedBytes,推迟minor gc而使新生代远超nurserySize
+            uint32_t allocatedBytes = vm->allocatedBytes;
+            freeObject(vm, obj);
+            vm->allocatedBytes = allocatedBytes;
+        }
+        else
+        {
+            obj->isOld = true;
+            obj->isDark = false;
+            obj->next = vm->oldObjects;
+            vm->oldObjects = obj;
+        }
+        work++;
+    }
+    return vm->unswept[0] == NULL && vm->unswept[1] == NULL;
+}
+
+//获取单调时钟,单位微秒
+static double nowMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//记录一次gc暂停的时长
+static void recordPause(VM *vm, double pause)
+{
+    vm->pauseStats.pauses[vm->pauseStats.count % GC_PAUSE_HISTORY] = pause;
+    vm->pauseStats.count++;
+    if (pause > vm->pauseStats.maxPause)
+    {
+        vm->pauseStats.maxPause = pause;
+    }
+}
+
+//minor gc:只回收新生代.老对象视为已标记,
+//老对象到新对象的引用由记忆集提供
+void startMinorGC(VM *vm)
+{
+    double startTime = nowMicros();
+    //增量gc的清扫阶段也可以进行minor gc
+    GCPhase phase = vm->gcPhase;
+    vm->gcPhase = GC_MINOR;
+    vm->markedBytes = 0;
+
+    //当前线程与tmpRoots中的老对象可能刚被写入新对象,先放入记忆集
+    rememberMutatingObjects(vm);
+
+    //重新扫描记忆集中的老对象,标灰它们引用的新对象
+    rescanRemembered(vm);
+    grayRoots(vm);
+    blackObjectInGray(vm, UINT32_MAX);
+
+    //回收新生代中的白对象,幸存者晋升为老对象
+    sweepInternTable(vm, true);
+    sweepNursery(vm);
+
+    //老对象的大小已计入survivedBytes,在此基础上累加幸存的新对象
+    vm->allocatedBytes = vm->survivedBytes + vm->markedBytes;
+    vm->survivedBytes = vm->allocatedBytes;
+    vm->gcPhase = phase;
+    rememberMutatingObjects(vm);
+
+    double pause = nowMicros() - startTime;
+    recordPause(vm, pause);
+#ifdef DEBUG
+    printf("minor GC %lu promoted, take %.1fus.\n", (unsigned long)vm->markedBytes, pause);
+#endif
+}
+
+//开始一轮增量gc,进入标记阶段
+static void beginMark(VM *vm)
+{
+    //上一轮gc结束后所有对象都是白对象,
+    //此前记录的老对象引用新对象的关系随着整堆标记失效
+    clearRemembered(vm);
+    vm->markedBytes = 0;
+    vm->gcPhase = GC_MARK;
+    grayRoots(vm);
+}
+
+//结束标记阶段:重新扫描根对象和记忆集,直至没有灰对象,然后进入清扫阶段
+static void finishMark(VM *vm)
+{
+    //当前线程的栈和tmpRoots在标记期间可能被写入了白对象
+    if (vm->curThread != NULL && vm->curThread->objHeader.isDark)
+    {
+        rescanObject(vm, (ObjHeader *)vm->curThread);
+    }
+    uint32_t idx = 0;
+    while (idx < vm->tmpRootNum)
+    {
+        if (vm->tmpRoots[idx]->isDark)
+        {
+            rescanObject(vm, vm->tmpRoots[idx]);
+        }
+        idx++;
+    }
+    grayRoots(vm);
+
+    while (vm->grays.count > 0 || vm->remembered.count > 0)
+    {
+        rescanRemembered(vm);
+        blackObjectInGray(vm, UINT32_MAX);
+    }
+
+    //此时白对象都已死去,先从驻留表中删除,以免清扫期间又被查到
+    sweepInternTable(vm, false);
+
+    //标记期间暂停了minor gc,新生代与老生代一起交给增量清扫,
+    //此后分配的对象进入新的新生代
+    vm->unswept[0] = vm->allObjects;
+    vm->unswept[1] = vm->oldObjects;
+    vm->allObjects = vm->oldObjects = NULL;
+
+    //标记阶段统计出的即是存活对象的大小
+    vm->allocatedBytes = vm->markedBytes;
+    vm->survivedBytes = vm->markedBytes;
+    vm->gcPhase = GC_SWEEP;
+}
+
+//结束一轮增量gc
+static void finishSweep(VM *vm)
+{
+    vm->gcPhase = GC_IDLE;
+
+    //更新下一次触发gc的阀值,阀值随存活对象的大小增长
+    vm->config.nextGC = (uint32_t)(vm->survivedBytes * vm->config.heapGrowthFactor);
+    if (vm->config.nextGC < vm->config.minHeapSize)
+    {
+        vm->config.nextGC = vm->config.minHeapSize;
+    }
+#ifdef DEBUG
+    printf("GC %lu alive, next at %lu.\n",
+        (unsigned long)vm->survivedBytes, (unsigned long)vm->config.nextGC);
+#endif
+}
+
+//执行一次增量gc的推进,最多标记config.stepWork个slot或清扫config.stepWork个对象
+static void doGCStep(VM *vm)
+{
+    if (vm->gcPhase == GC_MARK)
+    {
+        //先重新扫描上一步之后被写入过的对象,其数量与期间的写入量相当,
+        //再按预算处理灰对象
+        rescanRemembered(vm);
+        blackObjectInGray(vm, vm->config.stepWork);
+        
+        //灰对象处理完后,之后写入的对象在结束标记时一并扫描
+        if (vm->grays.count == 0)
+        {
+            finishMark(vm);
+        }
+    }
+    else if (vm->gcPhase == GC_SWEEP)
+    {
+        if (sweepUnswept(vm, vm->config.stepWork))
+        {
+            finishSweep(vm);
+        }
+    }
+}
+
+//增量gc:在分配内存时调用,每次只推进一小步,把停顿分散到程序执行过程中
+void stepGC(VM *vm)
+{
+    double startTime = nowMicros();
+
+    if (vm->gcPhase == GC_IDLE)
+    {
+        beginMark(vm);
+    }
+    doGCStep(vm);
+
+    //标记期间暂停了minor gc,若分配速度远超标记速度,
+    //就不再增量推进而是一次完成本轮gc,避免堆无限增长
+    if (vm->gcPhase == GC_MARK && vm->allocatedBytes / 2 > vm->config.nextGC)
+    {
+        while (vm->gcPhase != GC_IDLE)
+        {
+            doGCStep(vm);
+        }
+    }
+    
+    //回到程序执行之前,把会被直接写入的对象放入记忆集.
+    //连续推进的各步之间程序不会执行,不必每步都放入,
+    //否则正在构造的大list每步都要从头重新扫描,永远扫描不完.
+    //无论推进后处于哪个阶段都要放入:刚结束标记时它们已被标记,清扫结束时已晋升为老对象,
+    //之后写入的新对象都要靠记忆集才能被minor gc扫描到
+    rememberMutatingObjects(vm);
+    vm->nextStepBytes = vm->allocatedBytes + vm->config.stepSize;
+
+    recordPause(vm, nowMicros() - startTime);
+}
+
+//立即运行垃圾回收器去释放未用的内存
+void startGC(VM *vm)
+{
+    double startTime = nowMicros();
+#ifdef DEBUG
+    printf("-- gc  before:%u   nextGC:%u  vm:%p  --\n",
+        vm->allocatedBytes, vm->config.nextGC, (void *)vm);
+#endif
+
+    //先完成进行中的增量gc,它开始之后才产生的垃圾需要再来一轮才能回收
+    while (vm->gcPhase != GC_IDLE)
+    {
+        doGCStep(vm);
+    }
+
+    beginMark(vm);
+    finishMark(vm);
+    sweepUnswept(vm, UINT32_MAX);
+    finishSweep(vm);
+
+    recordPause(vm, nowMicros() - startTime);
+}
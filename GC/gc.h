@@ -0,0 +1,62 @@
+#ifndef _GC_GC_H
+#define _GC_GC_H
+
+#include "vm.h"
+
+void grayObject(VM *vm, ObjHeader *obj);
+
+void grayValue(VM *vm, Value value);
+
+void freeObject(VM *vm, ObjHeader *obj);
+
+void rememberObject(VM *vm, ObjHeader *obj);
+
+void startMinorGC(VM *vm);
+
+void stepGC(VM *vm);
+
+void startGC(VM *vm);
+
+//写屏障需要记录的对象:
+//  增量标记阶段是已标记(灰或黑)的对象,因为它们可能不会再被扫描
+//  其它时候是minor gc不扫描的对象,即老对象及清扫阶段尚未清扫的存活对象
+#define NEED_REMEMBER(vm, obj) \
+    (!(obj)->isRemembered && ((vm)->gcPhase == GC_MARK ? \
+        (obj)->isDark : ((obj)->isOld || (obj)->isDark)))
+
+//被引用的对象可能会被漏标:标记阶段是白对象,其它时候是新对象
+#define MAY_BE_MISSED(vm, obj) \
+    ((vm)->gcPhase == GC_MARK ? !(obj)->isDark : !((obj)->isOld || (obj)->isDark))
+
+//写屏障:向对象obj写入引用后调用,必要时把obj放入记忆集以便重新扫描
+#define WRITE_BARRIER(vm, obj) \
+    do { \
+        ObjHeader *_owner = (ObjHeader *)(obj); \
+        if (NEED_REMEMBER(vm, _owner)) \
+        { \
+            rememberObject(vm, _owner); \
+        } \
+    } while (0)
+
+//写入的value可能被漏标时才需要写屏障.
+//增量标记阶段若obj已标记就直接标灰value,不必重新扫描obj;其它时候把obj放入记忆集
+#define WRITE_BARRIER_VALUE(vm, obj, value) \
+    do { \
+        Value _value = (value); \
+        if (VALUE_IS_OBJ(_value) && MAY_BE_MISSED(vm, VALUE_TO_OBJ(_value))) \
+        { \
+            if ((vm)->gcPhase == GC_MARK) \
+            { \
+                if (((ObjHeader *)(obj))->isDark) \
+                { \
+                    grayObject(vm, VALUE_TO_OBJ(_value)); \
+                } \
+            } \
+            else \
+            { \
+                WRITE_BARRIER(vm, obj); \
+            } \
+        } \
+    } while (0)
+
+#endif
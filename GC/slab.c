@@ -0,0 +1,317 @@
+#include "slab.h"
+#include "utils.h"
+#include <string.h>
+
+//页头之后才是块,块按SLAB_GRANULE对齐
+#define PAGE_HEADER_SIZE ((sizeof(SlabPage) + SLAB_GRANULE - 1) & ~(SLAB_GRANULE - 1))
+
+//由块地址求得所在的页
+#define PAGE_OF(ptr) ((SlabPage *)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_PAGE_SIZE - 1)))
+
+//size所属的尺寸类别
+#define CLASS_INDEX(size) (((size) - 1) / SLAB_GRANULE)
+
+//初始化slab
+void slabInit(Slab *slab)
+{
+    uint32_t idx = 0;
+    while (idx < SLAB_CLASS_NUM)
+    {
+        slab->partial[idx] = NULL;
+        slab->freeList[idx] = NULL;
+        slab->bumpCursor[idx] = slab->bumpLimit[idx] = NULL;
+        idx++;
+    }
+
+    //页集合由slab自己维护,不经过memManager
+    slab->pageSet.count = 0;
+    slab->pageSet.capacity = 64;
+    slab->pageSet.pages = (uintptr_t *)calloc(slab->pageSet.capacity, sizeof(uintptr_t));
+    if (slab->pageSet.pages == NULL)
+    {
+        MEM_ERROR("allocate slab page set failed!");
+    }
+}
+
+//页地址的哈希值,页地址的低位都是0,先去掉再散列
+static uint32_t hashPage(uintptr_t page, uint32_t capacity)
+{
+    uint64_t key = (uint64_t)(page / SLAB_PAGE_SIZE);
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+//page是否是slab页
+static bool pageSetContains(SlabPageSet *pageSet, uintptr_t page)
+{
+    uint32_t idx = hashPage(page, pageSet->capacity);
+    while (pageSet->pages[idx] != 0)
+    {
+        if (pageSet->pages[idx] == page)
+        {
+            return true;
+        }
+        idx = (idx + 1) & (pageSet->capacity - 1);
+    }
+    return false;
+}
+
+//把page加入页集合,调用前已确认page不在集合中
+static void pageSetAdd(SlabPageSet *pageSet, uintptr_t page)
+{
+    //装载因子保持在1/2以下
+    if ((pageSet->count + 1) * 2 > pageSet->capacity)
+    {
+        uint32_t oldCapacity = pageSet->capacity;
+        uintptr_t *oldPages = pageSet->pages;
+        pageSet->capacity = oldCapacity * 2;
+        pageSet->pages = (uintptr_t *)calloc(pageSet->capacity, sizeof(uintptr_t));
+        if (pageSet->pages == NULL)
+        {
+            MEM_ERROR("allocate slab page set failed!");
+        }
+        pageSet->count = 0;
+        uint32_t idx = 0;
+        while (idx < oldCapacity)
+        {
+            if (oldPages[idx] != 0)
+            {
+                pageSetAdd(pageSet, oldPages[idx]);
+            }
+            idx++;
+        }
+        free(oldPages);
+    }
+
+    uint32_t idx = hashPage(page, pageSet->capacity);
+    while (pageSet->pages[idx] != 0)
+    {
+        idx = (idx + 1) & (pageSet->capacity - 1);
+    }
+    pageSet->pages[idx] = page;
+    pageSet->count++;
+}
+
+//从页集合中删除page.线性探测不留墓碑,把其后的项往回移填补空位
+static void pageSetRemove(SlabPageSet *pageSet, uintptr_t page)
+{
+    uint32_t mask = pageSet->capacity - 1;
+    uint32_t hole = hashPage(page, pageSet->capacity);
+    while (pageSet->pages[hole] != page)
+    {
+        hole = (hole + 1) & mask;
+    }
+
+    uint32_t idx = hole;
+    while (true)
+    {
+        idx = (idx + 1) & mask;
+        if (pageSet->pages[idx] == 0)
+        {
+            break;
+        }
+        //若空位在该项的探测路径上就把它移过去
+        uint32_t home = hashPage(pageSet->pages[idx], pageSet->capacity);
+        if (((idx - home) & mask) >= ((idx - hole) & mask))
+        {
+            pageSet->pages[hole] = pageSet->pages[idx];
+            hole = idx;
+        }
+    }
+    pageSet->pages[hole] = 0;
+    pageSet->count--;
+}
+
+//把page挂到尺寸类别classIdx的空闲页链表头部
+static void linkPartial(Slab *slab, uint32_t classIdx, SlabPage *page)
+{
+    page->prev = NULL;
+    page->next = slab->partial[classIdx];
+    if (page->next != NULL)
+    {
+        page->next->prev = page;
+    }
+    slab->partial[classIdx] = page;
+    page->isPartial = true;
+}
+
+//把page从尺寸类别classIdx的空闲页链表中摘除
+static void unlinkPartial(Slab *slab, uint32_t classIdx, SlabPage *page)
+{
+    if (page->prev != NULL)
+    {
+        page->prev->next = page->next;
+    }
+    else
+    {
+        slab->partial[classIdx] = page->next;
+    }
+    if (page->next != NULL)
+    {
+        page->next->prev = page->prev;
+    }
+    page->prev = page->next = NULL;
+    page->isPartial = false;
+}
+
+//向系统申请一个块大小为blockSize的新页
+static SlabPage *newPage(Slab *slab, uint32_t blockSize)
+{
+    SlabPage *page = (SlabPage *)aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+    if (page == NULL)
+    {
+        return NULL;
+    }
+    page->prev = page->next = NULL;
+    page->freeList = NULL;
+    page->blockSize = blockSize;
+    page->usedNum = 0;
+    page->bumpOffset = PAGE_HEADER_SIZE;
+    page->isPartial = false;
+    pageSetAdd(&slab->pageSet, (uintptr_t)page);
+    return page;
+}
+
+//尺寸类别classIdx缓存的块用完后才调用:从空闲页中取出被释放的块组成的链表,
+//没有的话就把页中从未分配过的部分取作顺序分配区域,再从中分配一块.
+//取出的块一次全部计入页的usedNum,这样它们未分配完时页不会被当作空页释放
+static void *slabAllocSlow(Slab *slab, uint32_t classIdx)
+{
+    SlabPage *page = slab->partial[classIdx];
+    if (page == NULL)
+    {
+        page = newPage(slab, (classIdx + 1) * SLAB_GRANULE);
+        if (page == NULL)
+        {
+            return NULL;
+        }
+        linkPartial(slab, classIdx, page);
+    }
+
+    void *block;
+    if (page->freeList != NULL)
+    {
+        //页中切出过的块此后都算已分配
+        block = page->freeList;
+        slab->freeList[classIdx] = *(void **)block;
+        page->freeList = NULL;
+        page->usedNum = (page->bumpOffset - PAGE_HEADER_SIZE) / page->blockSize;
+    }
+    else
+    {
+        uint32_t blockNum = (SLAB_PAGE_SIZE - page->bumpOffset) / page->blockSize;
+        block = (uint8_t *)page + page->bumpOffset;
+        page->bumpOffset += blockNum * page->blockSize;
+        page->usedNum += blockNum;
+        slab->bumpCursor[classIdx] = (uint8_t *)block + page->blockSize;
+        slab->bumpLimit[classIdx] = (uint8_t *)page + page->bumpOffset;
+    }
+
+    //页已满就移出空闲页链表
+    if (page->freeList == NULL && page->bumpOffset + page->blockSize > SLAB_PAGE_SIZE)
+    {
+        unlinkPartial(slab, classIdx, page);
+    }
+    return block;
+}
+
+//从slab中分配一个能容纳size字节的块.
+//多数分配只是从尺寸类别缓存的块中弹出一块或切出一块,缓存用完时才查找空闲页
+static void *slabAlloc(Slab *slab, uint32_t size)
+{
+    uint32_t classIdx = CLASS_INDEX(size);
+    void *block = slab->freeList[classIdx];
+    if (block != NULL)
+    {
+        slab->freeList[classIdx] = *(void **)block;
+        return block;
+    }
+
+    uint8_t *cursor = slab->bumpCursor[classIdx];
+    if (cursor != slab->bumpLimit[classIdx])
+    {
+        slab->bumpCursor[classIdx] = cursor + (classIdx + 1) * SLAB_GRANULE;
+        return cursor;
+    }
+    return slabAllocSlow(slab, classIdx);
+}
+
+//把块block归还给所在的页page
+static void slabFreeBlock(Slab *slab, SlabPage *page, void *block)
+{
+    uint32_t classIdx = CLASS_INDEX(page->blockSize);
+    *(void **)block = page->freeList;
+    page->freeList = block;
+    page->usedNum--;
+
+    if (!page->isPartial)
+    {
+        linkPartial(slab, classIdx, page);
+    }
+
+    //空页还给系统,但每个尺寸类别至少保留一个页,避免反复申请释放
+    if (page->usedNum == 0 && (page->prev != NULL || page->next != NULL))
+    {
+        unlinkPartial(slab, classIdx, page);
+        pageSetRemove(&slab->pageSet, (uintptr_t)page);
+        free(page);
+    }
+}
+
+//释放ptr,ptr可以来自slab也可以来自系统分配器
+void slabFree(Slab *slab, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    SlabPage *page = PAGE_OF(ptr);
+    if (pageSetContains(&slab->pageSet, (uintptr_t)page))
+    {
+        slabFreeBlock(slab, page, ptr);
+    }
+    else
+    {
+        free(ptr);
+    }
+}
+
+//与realloc语义相同:不大于SLAB_MAX_SIZE的块由slab分配,更大的块交给系统分配器.
+//oldSize是ptr原来的大小,来自系统分配器的块无从得知其大小,拷贝时要用到
+void *slabRealloc(Slab *slab, void *ptr, uint32_t oldSize, uint32_t newSize)
+{
+    bool isSmall = newSize <= SLAB_MAX_SIZE;
+    if (ptr == NULL)
+    {
+        return isSmall ? slabAlloc(slab, newSize) : malloc(newSize);
+    }
+
+    SlabPage *page = PAGE_OF(ptr);
+    if (!pageSetContains(&slab->pageSet, (uintptr_t)page))
+    {
+        //原块来自系统分配器
+        if (!isSmall)
+        {
+            return realloc(ptr, newSize);
+        }
+        void *block = slabAlloc(slab, newSize);
+        if (block != NULL)
+        {
+            memcpy(block, ptr, oldSize < newSize ? oldSize : newSize);
+            free(ptr);
+        }
+        return block;
+    }
+
+    //仍在同一尺寸类别就原地返回
+    if (isSmall && CLASS_INDEX(newSize) == CLASS_INDEX(page->blockSize))
+    {
+        return ptr;
+    }
+    void *block = isSmall ? slabAlloc(slab, newSize) : malloc(newSize);
+    if (block != NULL)
+    {
+        memcpy(block, ptr, page->blockSize < newSize ? page->blockSize : newSize);
+        slabFreeBlock(slab, page, ptr);
+    }
+    return block;
+}
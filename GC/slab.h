@@ -0,0 +1,55 @@
+#ifndef _GC_SLAB_H
+#define _GC_SLAB_H
+
+#include "common.h"
+
+//小对象按16字节划分尺寸类别,由slab分配.更大的对象仍交给系统分配器
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE 512
+#define SLAB_CLASS_NUM (SLAB_MAX_SIZE / SLAB_GRANULE)
+
+//slab页大小,页按自身大小对齐,由块地址即可算出所在页
+#define SLAB_PAGE_SIZE (64 * 1024)
+
+typedef struct slabPage SlabPage;
+
+//slab页的页头,位于页的起始处
+struct slabPage
+{
+    //同一尺寸类别中尚有空闲块的页组成双向链表
+    SlabPage *prev;
+    SlabPage *next;
+    void *freeList;      //页内被释放的块组成的链表
+    uint32_t blockSize;  //本页中块的大小
+    uint32_t usedNum;    //已分配出去的块数,包括交给尺寸类别缓存而尚未分配的块
+    uint32_t bumpOffset; //从未分配过的区域的起始偏移
+    bool isPartial;      //是否在尺寸类别的空闲页链表中
+};
+
+typedef struct
+{
+    //所有slab页的页地址,开放定址的哈希表,用于判断一个指针是否来自slab
+    uintptr_t *pages;
+    uint32_t capacity;
+    uint32_t count;
+} SlabPageSet;
+
+typedef struct
+{
+    //各尺寸类别中尚有空闲块的页
+    SlabPage *partial[SLAB_CLASS_NUM];
+    //各尺寸类别缓存的块,分配时先从这里取,只需弹出链表头或移动游标:
+    //freeList取自某页被释放的块组成的链表,[bumpCursor, bumpLimit)取自某页中从未分配过的部分
+    void *freeList[SLAB_CLASS_NUM];
+    uint8_t *bumpCursor[SLAB_CLASS_NUM];
+    uint8_t *bumpLimit[SLAB_CLASS_NUM];
+    SlabPageSet pageSet;
+} Slab;
+
+void slabInit(Slab *slab);
+
+void *slabRealloc(Slab *slab, void *ptr, uint32_t oldSize, uint32_t newSize);
+
+void slabFree(Slab *slab, void *ptr);
+
+#endif
@@ -7,45 +7,56 @@
 
 DEFINE_BUFFER_METHOD(Method)
 
+DEFINE_BUFFER_METHOD(InlineCache)
+
 //判断a和b是否相等
 bool valueIsEqual(Value a, Value b)
 {
-    //类型不同则无须进行后面的比较
-    if (a.type != b.type)
+    //同为数字,比较数值
+    if (VALUE_IS_NUM(a) && VALUE_IS_NUM(b))
     {
-        return false;
+        return VALUE_TO_NUM(a) == VALUE_TO_NUM(b);
     }
     
-    //同为数字,比较数值
-    if (a.type == VT_NUM)
+    //不同为对象时,只有同一个单例值才相等
+    if (!VALUE_IS_OBJ(a) || !VALUE_IS_OBJ(b))
     {
-        return a.num == b.num;
+        return SINGLETON_IS_EQUAL(a, b);
     }
     
     //同为对象,若所指的对象是同一个则返回true
-    if (a.objHeader == b.objHeader)
+    ObjHeader *objA = VALUE_TO_OBJ(a);
+    ObjHeader *objB = VALUE_TO_OBJ(b);
+    if (objA == objB)
     {
         return true;
     }
     
     //对象类型不同无须比较
-    if (a.objHeader->type != b.objHeader->type)
+    if (objA->type != objB->type)
     {
         return false;
     }
     
     //以下处理类型相同的对象
     //若对象同为字符串
-    if (a.objHeader->type == OT_STRING)
+    if (objA->type == OT_STRING)
     {
         ObjString *strA = VALUE_TO_OBJSTR(a);
         ObjString *strB = VALUE_TO_OBJSTR(b);
-        return (strA->value.length == strB->value.length &&
+        ASSERT(!STRING_IS_ROPE(strA) && !STRING_IS_ROPE(strB), "rope must be flattened before compared!");
+        //内容相同的驻留字符串是同一个对象,地址不同就不相等
+        if (strA->isInterned && strB->isInterned)
+        {
+            return false;
+        }
+        return (stringHash(strA) == stringHash(strB) &&
+            strA->value.length == strB->value.length &&
             memcmp(strA->value.start, strB->value.start, strA->value.length) == 0);
     }
     
     //若对象同为range
-    if (a.objHeader->type == OT_RANGE)
+    if (objA->type == OT_RANGE)
     {
         ObjRange *rgA = VALUE_TO_OBJRANGE(a);
         ObjRange *rgB = VALUE_TO_OBJRANGE(b);
@@ -62,11 +73,17 @@ Class *newRawClass(VM *vm, const char *name, uint32_t fieldNum)
     
     //裸类没有元类
     initObjHeader(vm, &class->objHeader, OT_CLASS, NULL);
-    class->name = newObjString(vm, name, strlen(name));
+    class->name = NULL;
     class->fieldNum = fieldNum;
     class->superClass = NULL;   //默认没有基类
+    class->methodVersion = 0;
     MethodBufferInit(&class->methods);
     
+    //创建类名时可能触发gc,此时class还未被任何对象引用
+    pushTmpRoot(vm, (ObjHeader *)class);
+    class->name = newInternedString(vm, name, strlen(name));
+    popTmpRoot(vm);
+    
     return class;
 }
 
@@ -85,6 +102,9 @@ Class *newClass(VM *vm, ObjString *className, uint32_t fieldNum, Class *superCla
     Class *metaclass = newRawClass(vm, newClassName, 0);
     metaclass->objHeader.class = vm->classOfClass;
     
+    //在类创建完成之前metaclass只被局部变量引用,需避免被gc回收
+    pushTmpRoot(vm, (ObjHeader *)metaclass);
+    
     //绑定classOfClass为meta类的基类
     //所有类的meta类的基类都是classOfClass
     bindSuperClass(vm, metaclass, vm->classOfClass);
@@ -93,29 +113,36 @@ Class *newClass(VM *vm, ObjString *className, uint32_t fieldNum, Class *superCla
     memcpy(newClassName, className->value.start, className->value.length);
     newClassName[className->value.length] = '\0';
     Class *class = newRawClass(vm, newClassName, fieldNum);
+    pushTmpRoot(vm, (ObjHeader *)class);
     
     class->objHeader.class = metaclass;
     bindSuperClass(vm, class, superClass);
     
+    popTmpRoot(vm);  // class
+    popTmpRoot(vm);  // metaclass
+    
     return class;
 }
 
 //数字等Value也被视为对象,因此参数为Value.获得对象obj所属的类
 inline Class *getClassOfObj(VM *vm, Value object)
 {
-    switch (object.type)
+    if (VALUE_IS_OBJ(object))
+    {
+        return VALUE_TO_OBJ(object)->class;
+    }
+    if (VALUE_IS_NUM(object))
+    {
+        return vm->numClass;
+    }
+    if (VALUE_IS_NULL(object))
     {
-    case VT_NULL:
         return vm->nullClass;
-    case VT_FALSE:
-    case VT_TRUE:
+    }
+    if (VALUE_IS_TRUE(object) || VALUE_IS_FALSE(object))
+    {
         return vm->boolClass;
-    case VT_NUM:
-        return vm->numClass;
-    case VT_OBJ:
-        return VALUE_TO_OBJ(object)->class;
-    default:
-        NOT_REACHED();
     }
+    NOT_REACHED();
     return NULL;
 }
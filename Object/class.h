@@ -15,6 +15,33 @@ typedef enum
     MT_FN_CALL,  //有关函数对象的调用方法,用来实现函数重载
 } MethodType;   //方法类型
 
+#ifdef NAN_BOXING
+
+//NaN-boxing:非NaN的double就是数字本身,
+//其余值放在quiet NaN的尾数里:对象再置上符号位,低48位是对象指针;
+//单例值的低位是其ValueType加1,避开运算可能产生的NaN
+#define SIGN_BIT ((uint64_t)1 << 63)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define VT_TO_VALUE(vt) \
+   ((Value)(QNAN | ((uint64_t)(vt) + 1)))
+
+#define BOOL_TO_VALUE(boolean) (boolean ? VT_TO_VALUE(VT_TRUE) : VT_TO_VALUE(VT_FALSE))
+#define VALUE_TO_BOOL(value) ((value) == VT_TO_VALUE(VT_TRUE))
+
+#define NUM_TO_VALUE(num) numToValue(num)
+#define VALUE_TO_NUM(value) valueToNum(value)
+
+#define OBJ_TO_VALUE(objPtr) \
+   ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(objPtr)))
+
+#define VALUE_TO_OBJ(value) ((ObjHeader*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+//a和b至少有一个是null,true,false或undefined这样的单例值时判断二者是否相等
+#define SINGLETON_IS_EQUAL(a, b) ((a) == (b))
+
+#else
+
 #define VT_TO_VALUE(vt) \
    ((Value){vt, {0}})
 
@@ -32,7 +59,14 @@ typedef enum
 })
 
 #define VALUE_TO_OBJ(value) (value.objHeader)
+
+//a和b至少有一个是null,true,false或undefined这样的单例值时判断二者是否相等
+#define SINGLETON_IS_EQUAL(a, b) ((a).type == (b).type)
+
+#endif
+
 #define VALUE_TO_OBJSTR(value) ((ObjString*)VALUE_TO_OBJ(value))
+#define VALUE_TO_OBJSTRBUILDER(value) ((ObjStringBuilder*)VALUE_TO_OBJ(value))
 #define VALUE_TO_OBJFN(value) ((ObjFn*)VALUE_TO_OBJ(value))
 #define VALUE_TO_OBJRANGE(value) ((ObjRange*)VALUE_TO_OBJ(value))
 #define VALUE_TO_OBJINSTANCE(value) ((ObjInstance*)VALUE_TO_OBJ(value))
@@ -43,19 +77,28 @@ typedef enum
 #define VALUE_TO_OBJMODULE(value) ((ObjModule*)VALUE_TO_OBJ(value))
 #define VALUE_TO_CLASS(value) ((Class*)VALUE_TO_OBJ(value))
 
+#ifdef NAN_BOXING
+#define VALUE_IS_UNDEFINED(value) ((value) == VT_TO_VALUE(VT_UNDEFINED))
+#define VALUE_IS_NULL(value) ((value) == VT_TO_VALUE(VT_NULL))
+#define VALUE_IS_TRUE(value) ((value) == VT_TO_VALUE(VT_TRUE))
+#define VALUE_IS_FALSE(value) ((value) == VT_TO_VALUE(VT_FALSE))
+#define VALUE_IS_NUM(value) (((value) & QNAN) != QNAN)
+#define VALUE_IS_OBJ(value) (((value) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+#else
 #define VALUE_IS_UNDEFINED(value) ((value).type == VT_UNDEFINED)
 #define VALUE_IS_NULL(value) ((value).type == VT_NULL)
 #define VALUE_IS_TRUE(value) ((value).type == VT_TRUE)
 #define VALUE_IS_FALSE(value) ((value).type == VT_FALSE)
 #define VALUE_IS_NUM(value) ((value).type == VT_NUM)
 #define VALUE_IS_OBJ(value) ((value).type == VT_OBJ)
+#endif
 #define VALUE_IS_CERTAIN_OBJ(value, objType) (VALUE_IS_OBJ(value) && VALUE_TO_OBJ(value)->type == objType)
 #define VALUE_IS_OBJSTR(value) (VALUE_IS_CERTAIN_OBJ(value, OT_STRING))
 #define VALUE_IS_OBJINSTANCE(value) (VALUE_IS_CERTAIN_OBJ(value, OT_INSTANCE))
 #define VALUE_IS_OBJCLOSURE(value) (VALUE_IS_CERTAIN_OBJ(value, OT_CLOSURE))
 #define VALUE_IS_OBJRANGE(value) (VALUE_IS_CERTAIN_OBJ(value, OT_RANGE))
 #define VALUE_IS_CLASS(value) (VALUE_IS_CERTAIN_OBJ(value, OT_CLASS))
-#define VALUE_IS_0(value) (VALUE_IS_NUM(value) && (value).num == 0)
+#define VALUE_IS_0(value) (VALUE_IS_NUM(value) && VALUE_TO_NUM(value) == 0)
 
 //原生方法指针
 typedef bool (*Primitive)(VM *vm, Value *args);
@@ -75,6 +118,39 @@ typedef struct
 
 DECLARE_BUFFER_TYPE(Method)
 
+//只有定义了INLINE_CACHE,方法调用指令才带有2字节的内联缓存索引,并为调用点分配缓存.
+//方法本来就按索引直接从类的方法表中取得,缓存主要用于统计各调用点的接收者类型
+#define INLINE_CACHE_WAYS 4   //每个调用点最多缓存的接收者类数,超过即为megamorphic
+#ifdef INLINE_CACHE
+#define INLINE_CACHE_OPERAND_BYTES 2
+#else
+#define INLINE_CACHE_OPERAND_BYTES 0
+#endif
+
+typedef struct
+{
+    Class *class;   //接收者所属的类
+    Method method;  //在该类中查找到的方法
+    uint32_t maxStackSlotUsedNum;  //脚本方法所需的栈空间
+    uint32_t methodVersion;  //填入时类的methodVersion,不等于类的当前值说明方法已被重新绑定
+} InlineCacheEntry;
+
+//方法调用点的内联缓存.entries[0]是单态缓存,
+//接收者的类变化时再依次填入其余项成为多态缓存
+struct inlineCache
+{
+    uint32_t entryNum;
+    InlineCacheEntry entries[INLINE_CACHE_WAYS];
+};
+
+//内联缓存按方法统计的命中情况,vm->inlineCacheStats以方法在allMethodNames中的索引为下标
+typedef struct
+{
+    uint32_t hits;     //命中次数
+    uint32_t misses;   //未命中次数
+    uint32_t megamorphicMisses;  //调用点缓存已满而未能填入的未命中次数
+} InlineCacheStat;
+
 //类是对象的模板
 struct class
 {
@@ -83,6 +159,7 @@ struct class
     uint32_t fieldNum;       //本类的字段数,包括基类的字段数
     MethodBuffer methods;   //本类的方法
     ObjString *name;   //类名
+    uint32_t methodVersion;  //已有方法被重新绑定的次数,内联缓存据此判断缓存项是否过期
 };  //对象类
 
 typedef union
@@ -92,6 +169,23 @@ typedef union
     double num;
 } Bits64;
 
+#ifdef NAN_BOXING
+//NaN-boxing下数字与Value按位互相转换
+static inline Value numToValue(double num)
+{
+    Bits64 bits64;
+    bits64.num = num;
+    return bits64.bits64;
+}
+
+static inline double valueToNum(Value value)
+{
+    Bits64 bits64;
+    bits64.bits64 = value;
+    return bits64.num;
+}
+#endif
+
 #define CAPACITY_GROW_FACTOR 4
 #define MIN_CAPACITY 64
 
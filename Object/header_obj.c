@@ -9,7 +9,10 @@ void initObjHeader(VM *vm, ObjHeader *objHeader, ObjType objType, Class *class)
 {
     objHeader->type = objType;
     objHeader->isDark = false;
+    objHeader->isOld = false;
+    objHeader->isRemembered = false;
+    objHeader->hashCode = 0;
     objHeader->class = class;    //设置meta类
-    objHeader->next = vm->allObjects;
+    objHeader->next = vm->allObjects;   //新对象先进入新生代
     vm->allObjects = objHeader;
 }
@@ -15,13 +15,17 @@ typedef enum
     OT_FUNCTION,
     OT_CLOSURE,
     OT_INSTANCE,
-    OT_THREAD
+    OT_THREAD,
+    OT_STRING_BUILDER
 } ObjType;  //对象类型
 
 typedef struct objHeader
 {
-    ObjType type;
-    bool isDark;       //对象是否可达
+    uint8_t type;      //ObjType,只占1字节,与下面的标志位和hashCode共用8字节
+    bool isDark;       //对象是否可达,即三色标记中的灰或黑
+    bool isOld;        //对象是否已经历过gc而晋升为老对象
+    bool isRemembered; //对象是否已在记忆集中
+    uint32_t hashCode; //字符串是内容的哈希,其它对象是标识哈希,首次用到时生成,为0表示尚未生成
     Class *class;   //对象所属的类
     struct objHeader *next;   //用于链接所有已分配对象
 } ObjHeader;      //对象头,用于记录元信息和垃圾回收
@@ -36,6 +40,9 @@ typedef enum
     VT_OBJ   //值为对象,指向对象头
 } ValueType;     //value类型
 
+#ifdef NAN_BOXING
+typedef uint64_t Value;   //通用的值,8字节的NaN-boxing表示,编解码见class.h
+#else
 typedef struct
 {
     ValueType type;
@@ -45,6 +52,7 @@ typedef struct
         ObjHeader *objHeader;
     };
 } Value;   //通用的值结构
+#endif
 
 DECLARE_BUFFER_TYPE(Value)
 
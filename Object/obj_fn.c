@@ -13,6 +13,9 @@ ObjFn *newObjFn(VM *vm, ObjModule *objModule, uint32_t slotNum)
     initObjHeader(vm, &objFn->objHeader, OT_FUNCTION, vm->fnClass);
     ByteBufferInit(&objFn->instrStream);
     ValueBufferInit(&objFn->constants);
+#ifdef INLINE_CACHE
+    InlineCacheBufferInit(&objFn->inlineCaches);
+#endif
     objFn->module = objModule;
     objFn->maxStackSlotUsedNum = slotNum;
     objFn->upvalueNum = objFn->argNum = 0;
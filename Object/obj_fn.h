@@ -4,6 +4,11 @@
 #include "utils.h"
 #include "meta_obj.h"
 
+//调用点的内联缓存,定义在class.h中
+typedef struct inlineCache InlineCache;
+
+DECLARE_BUFFER_TYPE(InlineCache)
+
 typedef struct
 {
     char *fnName;     //函数名
@@ -15,6 +20,9 @@ typedef struct
     ObjHeader objHeader;
     ByteBuffer instrStream;  //函数编译后的指令流
     ValueBuffer constants;   // 函数中的常量表
+#ifdef INLINE_CACHE
+    InlineCacheBuffer inlineCaches;  //各方法调用点的内联缓存
+#endif
     
     ObjModule *module;    //本函数所属的模块
     
@@ -15,6 +15,7 @@ ObjList *newObjList(VM *vm, uint32_t elementNum)
     
     objList->elements.datas = elementArray;
     objList->elements.capacity = objList->elements.count = elementNum;
+    objList->dirtyStart = objList->dirtyEnd = 0;
     initObjHeader(vm, &objList->objHeader, OT_LIST, vm->listClass);
     return objList;
 }
@@ -41,6 +42,7 @@ void insertElement(VM *vm, ObjList *objList, uint32_t index, Value value)
     
     //在index处插入数值
     objList->elements.datas[index] = value;
+    LIST_WRITE_BARRIER(vm, objList, index, objList->elements.count, value);
 }
 
 //调整list容量
@@ -48,7 +50,7 @@ static void shrinkList(VM *vm, ObjList *objList, uint32_t newCapacity)
 {
     uint32_t oldSize = objList->elements.capacity * sizeof(Value);
     uint32_t newSize = newCapacity * sizeof(Value);
-    memManager(vm, objList->elements.datas, oldSize, newSize);
+    objList->elements.datas = (Value *)memManager(vm, objList->elements.datas, oldSize, newSize);
     objList->elements.capacity = newCapacity;
 }
 
@@ -57,11 +59,24 @@ Value removeElement(VM *vm, ObjList *objList, uint32_t index)
 {
     Value valueRemoved = objList->elements.datas[index];
     
+    //前移的元素可能落到gc已扫描过的位置,相当于被重新写入:
+    //增量标记中已标记的list可能只扫描了前面一部分,前移时逐个标灰;
+    //其它时候记忆集中的list只记录了写入范围,把[index, count)都记为写入过
+    bool isGrayMoved = vm->gcPhase == GC_MARK && objList->objHeader.isDark;
+    if (!isGrayMoved)
+    {
+        LIST_RANGE_BARRIER(vm, objList, index, objList->elements.count);
+    }
+    
     //使index后面的元素前移一位,覆盖index处的元素
     uint32_t idx = index;
-    while (idx < objList->elements.count)
+    while (idx + 1 < objList->elements.count)
     {
         objList->elements.datas[idx] = objList->elements.datas[idx + 1];
+        if (isGrayMoved)
+        {
+            grayValue(vm, objList->elements.datas[idx]);
+        }
         idx++;
     }
     
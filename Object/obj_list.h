@@ -3,13 +3,58 @@
 
 #include "class.h"
 #include "vm.h"
+#include "gc.h"
 
 typedef struct
 {
     ObjHeader objHeader;
     ValueBuffer elements;  //list中的元素
+    //list在记忆集中时,被写入过的元素范围[dirtyStart, dirtyEnd),
+    //重新扫描时只扫描此范围
+    uint32_t dirtyStart;
+    uint32_t dirtyEnd;
 } ObjList;  //list对象
 
+//把list放入记忆集并记录元素[start, end)被写入过,重新扫描时只扫描此范围.
+//list已在记忆集中(包括重新扫描尚未完成)时只扩大此范围
+#define LIST_RANGE_BARRIER(vm, objList, start, end) \
+    do { \
+        ObjList *_list = (objList); \
+        if (NEED_REMEMBER(vm, &_list->objHeader)) \
+        { \
+            rememberObject(vm, &_list->objHeader); \
+            _list->dirtyStart = (start); \
+            _list->dirtyEnd = (end); \
+        } \
+        else if (_list->objHeader.isRemembered) \
+        { \
+            if ((start) < _list->dirtyStart) _list->dirtyStart = (start); \
+            if ((end) > _list->dirtyEnd) _list->dirtyEnd = (end); \
+        } \
+    } while (0)
+
+//list的写屏障:元素[start, end)被写入了value.
+//增量标记阶段与WRITE_BARRIER_VALUE一样直接标灰value,
+//其它时候除了把list放入记忆集,还要记录写入的范围,避免重新扫描整个大list
+#define LIST_WRITE_BARRIER(vm, objList, start, end, value) \
+    do { \
+        Value _value = (value); \
+        if (VALUE_IS_OBJ(_value) && MAY_BE_MISSED(vm, VALUE_TO_OBJ(_value))) \
+        { \
+            if ((vm)->gcPhase == GC_MARK) \
+            { \
+                if ((objList)->objHeader.isDark) \
+                { \
+                    grayObject(vm, VALUE_TO_OBJ(_value)); \
+                } \
+            } \
+            else \
+            { \
+                LIST_RANGE_BARRIER(vm, objList, start, end); \
+            } \
+        } \
+    } while (0)
+
 ObjList *newObjList(VM *vm, uint32_t elementNum);
 
 Value removeElement(VM *vm, ObjList *objList, uint32_t index);
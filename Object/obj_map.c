@@ -3,23 +3,54 @@
 #include "vm.h"
 #include "obj_string.h"
 #include "obj_range.h"
+#include "gc.h"
+#include <string.h>
 
 //创建新map对象
 ObjMap *newObjMap(VM *vm)
 {
     ObjMap *objMap = ALLOCATE(vm, ObjMap);
     initObjHeader(vm, &objMap->objHeader, OT_MAP, vm->mapClass);
-    objMap->capacity = objMap->count = 0;
+    objMap->capacity = objMap->count = objMap->growthLeft = 0;
+    objMap->entryCount = objMap->entryCapacity = objMap->arrayCapacity = 0;
+    objMap->version = 0;
+    objMap->ctrl = NULL;
+    objMap->indices = NULL;
+    objMap->arrayIndex = NULL;
     objMap->entries = NULL;
     return objMap;
 }
 
+//把64位充分混合后取低32位(murmur3的fmix64).
+//map按2的幂取槽位,只用到哈希码的低位,而整数的double表示和对象地址的低位都很少变化
+static uint32_t mix64(uint64_t hashCode)
+{
+    hashCode ^= hashCode >> 33;
+    hashCode *= 0xff51afd7ed558ccdull;
+    hashCode ^= hashCode >> 33;
+    hashCode *= 0xc4ceb9fe1a85ec53ull;
+    hashCode ^= hashCode >> 33;
+    return (uint32_t)hashCode;
+}
+
 //计算数字的哈希码
 static uint32_t hashNum(double num)
 {
     Bits64 bits64;
-    bits64.num = num;
-    return bits64.bits32[0] ^ bits64.bits32[1];
+    bits64.num = num == 0 ? 0 : num;  //0与-0相等,哈希码也要相同
+    return mix64(bits64.bits64);
+}
+
+//对象的标识哈希,首次用到时由地址生成并缓存在对象头中.
+//对象不会被移动,地址在其存活期间不变
+static uint32_t identityHash(ObjHeader *objHeader)
+{
+    if (objHeader->hashCode == 0)
+    {
+        uint32_t hashCode = mix64((uint64_t)(uintptr_t)objHeader);
+        objHeader->hashCode = hashCode == 0 ? 1 : hashCode;
+    }
+    return objHeader->hashCode;
 }
 
 //计算对象的哈希码
@@ -27,210 +58,607 @@ static uint32_t hashObj(ObjHeader *objHeader)
 {
     switch (objHeader->type)
     {
-    case OT_CLASS:  //计算class的哈希值
-        return hashString(((Class *)objHeader)->name->value.start,
-            ((Class *)objHeader)->name->value.length);
-    
     case OT_RANGE:
     { //计算range对象哈希码
         ObjRange *objRange = (ObjRange *)objHeader;
         return hashNum(objRange->from) ^ hashNum(objRange->to);
     }
-    case OT_STRING:  //对于字符串,直接返回其hashCode
-        return ((ObjString *)objHeader)->hashCode;
-    default:
-        RUN_ERROR("the hashable are objstring, objrange and class.");
+    case OT_STRING:
+        ASSERT(!STRING_IS_ROPE((ObjString *)objHeader), "rope must be flattened before hashed!");
+        return stringHash((ObjString *)objHeader);
+    default:  //类和实例等只与自身相等,用标识哈希
+        return identityHash(objHeader);
     }
-    return 0;
 }
 
-//根据value的类型调用相应的哈希函数
-static uint32_t hashValue(Value value)
+//根据value的类型调用相应的哈希函数,不回调脚本方法
+uint32_t hashValue(Value value)
 {
-    switch (value.type)
+    if (VALUE_IS_OBJ(value))
+    {
+        return hashObj(VALUE_TO_OBJ(value));
+    }
+    if (VALUE_IS_NUM(value))
+    {
+        return hashNum(VALUE_TO_NUM(value));
+    }
+    if (VALUE_IS_FALSE(value))
     {
-    case VT_FALSE:
         return 0;
-    case VT_NULL:
+    }
+    if (VALUE_IS_NULL(value))
+    {
         return 1;
-    case VT_NUM:
-        return hashNum(value.num);
-    case VT_TRUE:
+    }
+    if (VALUE_IS_TRUE(value))
+    {
         return 2;
-    case VT_OBJ:
-        return hashObj(value.objHeader);
-    default:
-        RUN_ERROR("unsupport type hashed!");
     }
+    RUN_ERROR("unsupport type hashed!");
     return 0;
 }
 
-//在entries中添加entry,如果是新的key则返回true
-static bool addEntry(Entry *entries, uint32_t capacity, Value key, Value value)
+//实例的类用脚本方法覆写了methodIndex处的方法时返回该方法的闭包,否则返回NULL
+static ObjClosure *scriptMethodOfKey(Value key, uint32_t methodIndex)
 {
-    uint32_t index = hashValue(key) % capacity;
-    
-    //通过开放探测法去找可用的slot
+    if (!VALUE_IS_OBJINSTANCE(key))
+    {
+        return NULL;
+    }
+    Class *class = VALUE_TO_OBJ(key)->class;
+    if (methodIndex >= class->methods.count ||
+        class->methods.datas[methodIndex].type != MT_SCRIPT)
+    {
+        return NULL;
+    }
+    return (ObjClosure *)class->methods.datas[methodIndex].obj;
+}
+
+//计算key的哈希码,实例的类定义了hashCode时调用它
+static uint32_t hashKey(VM *vm, Value key)
+{
+    //rope的哈希码在展平时才算出
+    if (VALUE_IS_OBJSTR(key))
+    {
+        flattenString(vm, VALUE_TO_OBJSTR(key));
+    }
+    ObjClosure *method = scriptMethodOfKey(key, vm->hashCodeIndex);
+    if (method == NULL)
+    {
+        return hashValue(key);
+    }
+    Value args[1] = {key};
+    callScriptMethod(vm, method, args, 1);
+    if (!VALUE_IS_NUM(args[0]))
+    {
+        RUN_ERROR("hashCode must return a number!");
+    }
+    return hashNum(VALUE_TO_NUM(args[0]));
+}
+
+//判断key与map中已有的key是否相等,key的类定义了==(_)时调用它
+static bool keyIsEqual(VM *vm, Value key, Value other)
+{
+    ObjClosure *method = scriptMethodOfKey(key, vm->equalIndex);
+    if (method == NULL)
+    {
+        return valueIsEqual(key, other);
+    }
+    Value args[2] = {key, other};
+    callScriptMethod(vm, method, args, 2);
+    return !VALUE_IS_FALSE(args[0]) && !VALUE_IS_NULL(args[0]);
+}
+
+//控制字节:最高位为1表示槽位空闲,为0时低7位是key哈希值的标签
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xfe
+
+//哈希值的低7位作为标签存入控制字节,其余位用来选定探测的起始组
+#define HASH_TAG(hashCode) ((uint8_t)((hashCode) & 0x7f))
+#define HASH_GROUP(hashCode) ((hashCode) >> 7)
+
+//探测以组为单位,一组槽位的控制字节一次比较完,查找通常只访问一个组的控制字节和一个Entry.
+//有SSE2时一组16个槽,否则一组8个槽,用NEON或64位整数按字节并行比较.
+//比较结果是掩码,每个匹配的槽在其中占1位(SSE2)或1字节的最高位.
+//定义NO_SIMD时总用64位整数比较,便于对比
+#if defined(__SSE2__) && !defined(NO_SIMD)
+#include <emmintrin.h>
+
+#define MAP_GROUP_WIDTH 16
+#define MASK_SHIFT 0
+typedef uint32_t GroupMask;
+
+//组内控制字节等于tag的槽
+static inline GroupMask matchTag(const uint8_t *group, uint8_t tag)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+}
+
+//组内的空槽
+static inline GroupMask matchEmpty(const uint8_t *group)
+{
+    return matchTag(group, CTRL_EMPTY);
+}
+
+//组内空闲(空或已删除)的槽
+static inline GroupMask matchFree(const uint8_t *group)
+{
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+#elif defined(__ARM_NEON) && !defined(NO_SIMD)
+#include <arm_neon.h>
+
+#define MAP_GROUP_WIDTH 8
+#define MASK_SHIFT 3
+typedef uint64_t GroupMask;
+
+static inline GroupMask matchTag(const uint8_t *group, uint8_t tag)
+{
+    uint8x8_t equal = vceq_u8(vld1_u8(group), vdup_n_u8(tag));
+    return vget_lane_u64(vreinterpret_u64_u8(equal), 0) & 0x8080808080808080ull;
+}
+
+static inline GroupMask matchEmpty(const uint8_t *group)
+{
+    return matchTag(group, CTRL_EMPTY);
+}
+
+static inline GroupMask matchFree(const uint8_t *group)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(vld1_u8(group)), 0) & 0x8080808080808080ull;
+}
+
+#else
+
+#define MAP_GROUP_WIDTH 8
+#define MASK_SHIFT 3
+typedef uint64_t GroupMask;
+
+//按小端序读入一组控制字节,使第i个槽对应第i个字节
+static inline uint64_t loadGroup(const uint8_t *group)
+{
+    uint64_t word;
+    memcpy(&word, group, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+//找出等于tag的字节.借位可能使紧挨在匹配字节之后的字节被误报,
+//但被误报的总是在用的槽,比较key时自然排除
+static inline GroupMask matchTag(const uint8_t *group, uint8_t tag)
+{
+    uint64_t word = loadGroup(group) ^ (0x0101010101010101ull * tag);
+    return (word - 0x0101010101010101ull) & ~word & 0x8080808080808080ull;
+}
+
+//空槽最高位为1而次低位为0,已删除的槽次低位为1
+static inline GroupMask matchEmpty(const uint8_t *group)
+{
+    uint64_t word = loadGroup(group);
+    return word & (~word << 6) & 0x8080808080808080ull;
+}
+
+static inline GroupMask matchFree(const uint8_t *group)
+{
+    return loadGroup(group) & 0x8080808080808080ull;
+}
+
+#endif
+
+//掩码中最低的匹配槽在组内的序号
+#define LOWEST_SLOT(mask) ((uint32_t)__builtin_ctzll(mask) >> MASK_SHIFT)
+
+//能容纳count个key的最小索引表容量
+static uint32_t capacityFor(uint32_t count)
+{
+    uint32_t capacity = MAP_GROUP_WIDTH;
+    while (MAP_MAX_LOAD(capacity) < count)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+//在objMap的索引表中查找key所在的槽位,未找到返回-1.
+//从哈希值选定的组开始按三角数跳跃探测,组数为2的幂时能遍历所有组.
+//growthLeft保证不空的槽位不超过7/8,总会遇到有空槽的组而结束.
+//脚本的==(_)可能改动map甚至使索引表重新分配,此时手上的槽位都已失效,要从头探测
+static int findSlot(VM *vm, ObjMap *objMap, Value key, uint32_t hashCode)
+{
+restart:
+    if (objMap->capacity == 0)
+    {
+        return -1;
+    }
+    uint32_t version = objMap->version;
+    uint32_t groupMask = objMap->capacity / MAP_GROUP_WIDTH - 1;
+    uint32_t group = HASH_GROUP(hashCode) & groupMask;
+    uint8_t tag = HASH_TAG(hashCode);
+    uint32_t step = 0;
     while (true)
     {
-        //找到空闲的slot,说明目前没有此key,直接赋值返回
-        if (entries[index].key.type == VT_UNDEFINED)
+        const uint8_t *ctrl = objMap->ctrl + group * MAP_GROUP_WIDTH;
+        GroupMask match = matchTag(ctrl, tag);
+        while (match != 0)
         {
-            entries[index].key = key;
-            entries[index].value = value;
-            return true;       //新的key就返回true
-        }
-        else if (valueIsEqual(entries[index].key, key))
-        { //key已经存在,仅仅更新值就行
-            entries[index].value = value;
-            return false;    // 未增加新的key就返回false
+            uint32_t slot = group * MAP_GROUP_WIDTH + LOWEST_SLOT(match);
+            bool isEqual = keyIsEqual(vm, key, objMap->entries[objMap->indices[slot]].key);
+            if (objMap->version != version)
+            {
+                goto restart;
+            }
+            if (isEqual)
+            {
+                return (int)slot;
+            }
+            match &= match - 1;
         }
         
-        //开放探测定址,尝试下一个slot
-        index = (index + 1) % capacity;
+        //组内有空槽说明key从未被放到更远处
+        if (matchEmpty(ctrl) != 0)
+        {
+            return -1;
+        }
+        step++;
+        group = (group + step) & groupMask;
     }
 }
 
-//使对象objMap的容量调整到newCapacity
-static void resizeMap(VM *vm, ObjMap *objMap, uint32_t newCapacity)
+//在哈希值为hashCode的key的探测序列上找第一个空闲的槽位
+static uint32_t findFreeSlot(ObjMap *objMap, uint32_t hashCode)
 {
-    // 1 先建立个新的entry数组
-    Entry *newEntries = ALLOCATE_ARRAY(vm, Entry, newCapacity);
-    uint32_t idx = 0;
-    while (idx < newCapacity)
+    uint32_t groupMask = objMap->capacity / MAP_GROUP_WIDTH - 1;
+    uint32_t group = HASH_GROUP(hashCode) & groupMask;
+    uint32_t step = 0;
+    while (true)
     {
-        newEntries[idx].key = VT_TO_VALUE(VT_UNDEFINED);
-        newEntries[idx].value = VT_TO_VALUE(VT_FALSE);
-        idx++;
+        GroupMask match = matchFree(objMap->ctrl + group * MAP_GROUP_WIDTH);
+        if (match != 0)
+        {
+            return group * MAP_GROUP_WIDTH + LOWEST_SLOT(match);
+        }
+        step++;
+        group = (group + step) & groupMask;
     }
-    
-    // 2 再遍历老的数组,把有值的部分插入到新数组
-    if (objMap->capacity > 0)
+}
+
+//在哈希部分查找哈希码为hashCode的key所在的entry,未找到返回NULL
+static Entry *findHashEntry(VM *vm, ObjMap *objMap, Value key, uint32_t hashCode)
+{
+    int slot = findSlot(vm, objMap, key, hashCode);
+    return slot == -1 ? NULL : &objMap->entries[objMap->indices[slot]];
+}
+
+//在数组部分查找下标为pos的entry,未找到返回NULL
+static Entry *findArrayEntry(ObjMap *objMap, uint32_t pos)
+{
+    uint32_t index = objMap->arrayIndex[pos];
+    return index == 0 ? NULL : &objMap->entries[index - 1];
+}
+
+//若key是可以放进数组部分的整数,就计入nums.
+//nums[0]是key 0的个数,nums[i]是落在[2^(i-1), 2^i)中的key的个数
+static void countArrayKey(Value key, uint32_t *nums)
+{
+    if (!VALUE_IS_NUM(key))
+    {
+        return;
+    }
+    double num = VALUE_TO_NUM(key);
+    if (num >= 0 && num < (double)(1u << MAP_MAX_ARRAY_BITS) && (uint32_t)num == num)
+    {
+        uint32_t k = (uint32_t)num;
+        nums[k == 0 ? 0 : 32 - __builtin_clz(k)]++;
+    }
+}
+
+//选出使数组部分一半以上被用到的最大的2的幂作为数组部分的大小,
+//arrayKeys带回将落在数组部分中的key的个数
+static uint32_t computeArraySize(const uint32_t *nums, uint32_t *arrayKeys)
+{
+    uint32_t arrayCapacity = 0;
+    uint32_t total = 0;
+    *arrayKeys = 0;
+    uint32_t bits = 0;
+    while (bits <= MAP_MAX_ARRAY_BITS)
     {
-        Entry *entryArr = objMap->entries;
-        idx = 0;
-        while (idx < objMap->capacity)
+        //大小为2^bits的数组部分容纳nums[0]到nums[bits]中的key
+        total += nums[bits];
+        if (total > (1u << bits) / 2)
         {
-            //该slot有值
-            if (entryArr[idx].key.type != VT_UNDEFINED)
-            {
-                addEntry(newEntries, newCapacity,
-                    entryArr[idx].key, entryArr[idx].value);
-            }
-            idx++;
+            arrayCapacity = 1u << bits;
+            *arrayKeys = total;
         }
+        bits++;
     }
-    
-    // 3 将老entry数组空间回收
-    DEALLOCATE_ARRAY(vm, objMap->entries, objMap->count);
-    objMap->entries = newEntries;     //更新指针为新的entry数组
-    objMap->capacity = newCapacity;    //更新容量
+    return arrayCapacity;
 }
 
-//在objMap中查找key对应的entry
-static Entry *findEntry(ObjMap *objMap, Value key)
+//把entries[index]登记到数组部分或索引表,hashCode只在登记到索引表时使用
+static void linkEntry(ObjMap *objMap, uint32_t index, uint32_t hashCode)
 {
-    //objMap为空则返回null
-    if (objMap->capacity == 0)
+    uint32_t pos;
+    if (mapArrayPos(objMap, objMap->entries[index].key, &pos))
     {
-        return NULL;
+        objMap->arrayIndex[pos] = index + 1;
+        return;
+    }
+    uint32_t slot = findFreeSlot(objMap, hashCode);
+    if (objMap->ctrl[slot] == CTRL_EMPTY)
+    {
+        objMap->growthLeft--;
     }
+    objMap->ctrl[slot] = HASH_TAG(hashCode);
+    objMap->indices[slot] = index;
+}
 
-//以下开放定址探测
-//用哈希值对容量取模计算槽位(slot)
-    uint32_t index = hashValue(key) % objMap->capacity;
-    Entry *entry;
-    while (true)
+//重建objMap:压实entries,去掉已删除的entry,
+//并按整数key的疏密重新划分数组部分和哈希部分.
+//newKey是随后要插入的key,一并计入以留出它的位置,不插入时为VT_UNDEFINED
+static void rebuildMap(VM *vm, ObjMap *objMap, Value newKey)
+{
+restart:;
+    // 1 统计整数key,确定数组部分、索引表和entries的大小,都留出一半的余量
+    uint32_t nums[MAP_MAX_ARRAY_BITS + 1] = {0};
+    uint32_t idx = 0;
+    while (idx < objMap->entryCount)
     {
-        entry = &objMap->entries[index];
-        
-        //若该slot中的entry正好是该key的entry,找到返回
-        if (valueIsEqual(entry->key, key))
+        if (!VALUE_IS_UNDEFINED(objMap->entries[idx].key))
         {
-            return entry;
+            countArrayKey(objMap->entries[idx].key, nums);
         }
-        
-        //key为VT_UNDEFINED且value为VT_TRUE表示探测链未断,可继续探测.
-        //key为VT_UNDEFINED且value为VT_FALSE表示探测链结束,探测结束.
-        if (VALUE_IS_UNDEFINED(entry->key) && VALUE_IS_FALSE(entry->value))
+        idx++;
+    }
+    uint32_t total = objMap->count;
+    if (!VALUE_IS_UNDEFINED(newKey))
+    {
+        countArrayKey(newKey, nums);
+        total++;
+    }
+    uint32_t arrayKeys;
+    uint32_t newArrayCapacity = computeArraySize(nums, &arrayKeys);
+    uint32_t hashKeys = total - arrayKeys;
+    uint32_t newCapacity = hashKeys == 0 ? 0 : capacityFor(hashKeys + hashKeys / 2 + 1);
+    uint32_t newEntryCapacity = total + total / 2 + 1;
+    
+    // 2 在改动map之前算好各key的哈希码.
+    //回调脚本的hashCode时可能触发gc,此时map必须完好
+    uint32_t version = objMap->version;
+    uint32_t *hashCodes = ALLOCATE_ARRAY(vm, uint32_t, objMap->entryCount);
+    uint32_t hashCount = objMap->entryCount;
+    idx = 0;
+    while (idx < hashCount)
+    {
+        Value key = objMap->entries[idx].key;
+        hashCodes[idx] = VALUE_IS_UNDEFINED(key) ? 0 : hashKey(vm, key);
+        if (objMap->version != version)
+        { //hashCode改动了map,上面算出的大小和哈希码都不再可信
+            DEALLOCATE_ARRAY(vm, hashCodes, hashCount);
+            goto restart;
+        }
+        idx++;
+    }
+    
+    // 3 建立新的索引表、数组部分和entry数组,老数组暂存起来
+    uint8_t *oldCtrl = objMap->ctrl;
+    uint32_t *oldIndices = objMap->indices;
+    uint32_t *oldArrayIndex = objMap->arrayIndex;
+    Entry *oldEntries = objMap->entries;
+    uint32_t oldCapacity = objMap->capacity;
+    uint32_t oldArrayCapacity = objMap->arrayCapacity;
+    uint32_t oldEntryCapacity = objMap->entryCapacity;
+    uint32_t oldEntryCount = objMap->entryCount;
+    
+    uint8_t *newCtrl = ALLOCATE_ARRAY(vm, uint8_t, newCapacity);
+    uint32_t *newIndices = ALLOCATE_ARRAY(vm, uint32_t, newCapacity);
+    uint32_t *newArrayIndex = ALLOCATE_ARRAY(vm, uint32_t, newArrayCapacity);
+    Entry *newEntries = ALLOCATE_ARRAY(vm, Entry, newEntryCapacity);
+    if (newCapacity > 0)
+    {
+        memset(newCtrl, CTRL_EMPTY, newCapacity);
+    }
+    if (newArrayCapacity > 0)
+    {
+        memset(newArrayIndex, 0, sizeof(uint32_t) * newArrayCapacity);
+    }
+    objMap->ctrl = newCtrl;
+    objMap->indices = newIndices;
+    objMap->arrayIndex = newArrayIndex;
+    objMap->entries = newEntries;
+    objMap->capacity = newCapacity;
+    objMap->growthLeft = MAP_MAX_LOAD(newCapacity);
+    objMap->arrayCapacity = newArrayCapacity;
+    objMap->entryCapacity = newEntryCapacity;
+    objMap->entryCount = 0;
+    objMap->version++;
+    
+    // 4 按原顺序把在用的entry搬到新数组并重新登记,key各不相同,无须查重
+    idx = 0;
+    while (idx < oldEntryCount)
+    {
+        if (!VALUE_IS_UNDEFINED(oldEntries[idx].key))
         {
-            return NULL;    //未找到
+            objMap->entries[objMap->entryCount] = oldEntries[idx];
+            linkEntry(objMap, objMap->entryCount, hashCodes[idx]);
+            objMap->entryCount++;
         }
-        
-        //继续向下探测
-        index = (index + 1) % objMap->capacity;
+        idx++;
     }
+    
+    //entry去掉已删除的之后整体前移了,增量标记中分段扫描的map要从头重新扫描
+    if (vm->gcPhase == GC_MARK)
+    {
+        WRITE_BARRIER(vm, objMap);
+    }
+    
+    // 5 将老数组空间回收
+    DEALLOCATE_ARRAY(vm, hashCodes, oldEntryCount);
+    DEALLOCATE_ARRAY(vm, oldCtrl, oldCapacity);
+    DEALLOCATE_ARRAY(vm, oldIndices, oldCapacity);
+    DEALLOCATE_ARRAY(vm, oldArrayIndex, oldArrayCapacity);
+    DEALLOCATE_ARRAY(vm, oldEntries, oldEntryCapacity);
+}
+
+//哈希码为hashCode的新key是否还有位置,没有就要先重建
+static bool hasRoomFor(ObjMap *objMap, Value key, uint32_t hashCode)
+{
+    if (objMap->entryCount == objMap->entryCapacity)
+    {
+        return false;
+    }
+    uint32_t pos;
+    if (mapArrayPos(objMap, key, &pos))
+    {
+        return true;
+    }
+    if (objMap->capacity == 0)
+    {
+        return false;
+    }
+    //可以复用墓碑时不占用新的空槽
+    return objMap->growthLeft > 0 ||
+        objMap->ctrl[findFreeSlot(objMap, hashCode)] == CTRL_DELETED;
 }
 
 //在objMap中实现key与value的关联:objMap[key]=value
 void mapSet(VM *vm, ObjMap *objMap, Value key, Value value)
 {
-    //当容量利用率达到80%时扩容
-    if (objMap->count + 1 > objMap->capacity * MAP_LOAD_PERCENT)
+    //数组部分的key不必计算哈希码.
+    //重建后key可能落到两部分中的另一部分,而重建时回调的脚本也可能改动map,
+    //所以重建后要重新查找
+    uint32_t pos;
+    uint32_t hashCode;
+    Entry *entry;
+    while (true)
     {
-        uint32_t newCapacity = objMap->capacity * CAPACITY_GROW_FACTOR;
-        if (newCapacity < MIN_CAPACITY)
+        hashCode = 0;
+        if (mapArrayPos(objMap, key, &pos))
+        {
+            entry = findArrayEntry(objMap, pos);
+        }
+        else
+        {
+            hashCode = hashKey(vm, key);
+            entry = findHashEntry(vm, objMap, key, hashCode);
+        }
+        if (entry != NULL || hasRoomFor(objMap, key, hashCode))
         {
-            newCapacity = MIN_CAPACITY;
+            break;
         }
-        resizeMap(vm, objMap, newCapacity);
+        rebuildMap(vm, objMap, key);
     }
     
-    //若创建了新的key则使objMap->count加1
-    if (addEntry(objMap->entries, objMap->capacity, key, value))
+    if (entry != NULL)
+    {   //key已经存在,仅更新值,位置不变
+        entry->value = value;
+    }
+    else
     {
+        //字符串key驻留后再存入,查找时用驻留的字符串就只需比较地址
+        if (VALUE_IS_OBJSTR(key))
+        {
+            key = OBJ_TO_VALUE(internString(vm, VALUE_TO_OBJSTR(key)));
+        }
+        
+        //新的key追加到entries末尾
+        entry = &objMap->entries[objMap->entryCount];
+        entry->key = key;
+        entry->value = value;
+        linkEntry(objMap, objMap->entryCount, hashCode);
+        objMap->entryCount++;
         objMap->count++;
+        objMap->version++;
     }
+    WRITE_BARRIER_VALUE(vm, objMap, key);
+    WRITE_BARRIER_VALUE(vm, objMap, value);
 }
 
 //从map中查找key对应的value: map[key]
-Value mapGet(ObjMap *objMap, Value key)
+Value mapGet(VM *vm, ObjMap *objMap, Value key)
 {
-    Entry *entry = findEntry(objMap, key);
-    if (entry == NULL)
+    uint32_t pos;
+    Entry *entry;
+    if (mapArrayPos(objMap, key, &pos))
+    {
+        entry = findArrayEntry(objMap, pos);
+    }
+    else
     {
-        return VT_TO_VALUE(VT_UNDEFINED);
+        entry = findHashEntry(vm, objMap, key, hashKey(vm, key));
     }
-    return entry->value;
+    return entry == NULL ? VT_TO_VALUE(VT_UNDEFINED) : entry->value;
 }
 
-//回收objMap.entries占用的空间
+//回收objMap的索引表、数组部分和entries占用的空间
 void clearMap(VM *vm, ObjMap *objMap)
 {
-    DEALLOCATE_ARRAY(vm, objMap->entries, objMap->count);
+    DEALLOCATE_ARRAY(vm, objMap->ctrl, objMap->capacity);
+    DEALLOCATE_ARRAY(vm, objMap->indices, objMap->capacity);
+    DEALLOCATE_ARRAY(vm, objMap->arrayIndex, objMap->arrayCapacity);
+    DEALLOCATE_ARRAY(vm, objMap->entries, objMap->entryCapacity);
+    objMap->ctrl = NULL;
+    objMap->indices = NULL;
+    objMap->arrayIndex = NULL;
     objMap->entries = NULL;
-    objMap->capacity = objMap->count = 0;
+    objMap->capacity = objMap->count = objMap->growthLeft = 0;
+    objMap->entryCount = objMap->entryCapacity = objMap->arrayCapacity = 0;
+    objMap->version++;
 }
 
 //删除objMap中的key,返回map[key]
 Value removeKey(VM *vm, ObjMap *objMap, Value key)
 {
-    Entry *entry = findEntry(objMap, key);
-    
-    if (entry == NULL)
+    Entry *entry;
+    uint32_t pos;
+    if (mapArrayPos(objMap, key, &pos))
     {
-        return VT_TO_VALUE(VT_NULL);
+        entry = findArrayEntry(objMap, pos);
+        if (entry == NULL)
+        {
+            return VT_TO_VALUE(VT_NULL);
+        }
+        objMap->arrayIndex[pos] = 0;
     }
-
-//设置开放定址的伪删除
+    else
+    {
+        int slot = findSlot(vm, objMap, key, hashKey(vm, key));
+        if (slot == -1)
+        {
+            return VT_TO_VALUE(VT_NULL);
+        }
+        entry = &objMap->entries[objMap->indices[slot]];
+        
+        //所在组中还有空槽,说明从未有探测越过此组,可以直接置为空槽,否则留下墓碑
+        uint8_t *group = objMap->ctrl + (slot & ~(MAP_GROUP_WIDTH - 1));
+        if (matchEmpty(group) != 0)
+        {
+            objMap->ctrl[slot] = CTRL_EMPTY;
+            objMap->growthLeft++;
+        }
+        else
+        {
+            objMap->ctrl[slot] = CTRL_DELETED;
+        }
+    }
+    
+    //entries中留下空洞,保持其余entry的顺序,重建时再压实
     Value value = entry->value;
     entry->key = VT_TO_VALUE(VT_UNDEFINED);
-    entry->value = VT_TO_VALUE(VT_TRUE);   //值为真,伪删除
+    entry->value = VT_TO_VALUE(VT_NULL);
     
     objMap->count--;
+    objMap->version++;
     if (objMap->count == 0)
     { //若删除该entry后map为空就回收该空间
         clearMap(vm, objMap);
     }
-    else if (objMap->count < objMap->capacity / (CAPACITY_GROW_FACTOR) * MAP_LOAD_PERCENT &&
-        objMap->count > MIN_CAPACITY)
+    else if (objMap->entryCapacity > MAP_GROUP_WIDTH && objMap->count < objMap->entryCapacity / 4)
     {   //若map容量利用率太低,就缩小map空间
-        uint32_t newCapacity = objMap->capacity / CAPACITY_GROW_FACTOR;
-        if (newCapacity < MIN_CAPACITY)
-        {
-            newCapacity = MIN_CAPACITY;
-        }
-        resizeMap(vm, objMap, newCapacity);
+        rebuildMap(vm, objMap, VT_TO_VALUE(VT_UNDEFINED));
     }
     
     return value;
@@ -2,8 +2,13 @@
 #define _OBJECT_MAP_H
 
 #include "header_obj.h"
+#include "class.h"
 
-#define MAP_LOAD_PERCENT 0.8
+//索引表的装载因子上限为7/8
+#define MAP_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+//数组部分最大为2^MAP_MAX_ARRAY_BITS
+#define MAP_MAX_ARRAY_BITS 30
 
 typedef struct
 {
@@ -11,19 +16,51 @@ typedef struct
     Value value;
 } Entry;   //key->value对儿
 
+//map的entry按插入顺序稠密存放在entries中,迭代时顺序遍历.
+//查找entry有两条路:
+//  数组部分:0到arrayCapacity-1的整数key,以key为下标直接在arrayIndex中找到entry;
+//  哈希部分:其余的key,经开放定址的索引表找到entry,每个槽有一个控制字节和一个entry下标.
+//两部分的大小在重建时按整数key的疏密重新划分,key随之在两部分间迁移
 typedef struct
 {
     ObjHeader objHeader;
-    uint32_t capacity; //Entry的容量(即总数),包括已使用和未使用Entry的数量
-    uint32_t count;  //map中使用的Entry的数量
-    Entry *entries; //Entry数组
+    uint32_t capacity; //索引表的槽数,为0或2的幂
+    uint32_t count;  //map中key的数量
+    uint32_t growthLeft;  //索引表在重建前还能占用的空槽数
+    uint32_t entryCount;  //entries中已使用的数量,含已删除的
+    uint32_t entryCapacity;  //entries的容量
+    uint32_t arrayCapacity;  //数组部分的大小,为0或2的幂
+    uint32_t version;  //增删key或重建时加1,回调脚本的hashCode和==(_)之后据此判断map是否被改动
+    uint8_t *ctrl;   //各槽的控制字节,标明槽位空闲、已删除或是key哈希值的标签
+    uint32_t *indices;   //各槽所指entry在entries中的下标
+    uint32_t *arrayIndex;   //整数key k所在entry的下标加1,为0表示没有这个key
+    Entry *entries; //entry数组,已删除的entry其key为VT_UNDEFINED
 } ObjMap;
 
+//key是落在数组部分的整数时返回true,并由pos带回其下标
+static inline bool mapArrayPos(ObjMap *objMap, Value key, uint32_t *pos)
+{
+    if (!VALUE_IS_NUM(key))
+    {
+        return false;
+    }
+    double num = VALUE_TO_NUM(key);
+    //NaN与任何数比较都为假,不会落入数组部分
+    if (num >= 0 && num < objMap->arrayCapacity && (uint32_t)num == num)
+    {
+        *pos = (uint32_t)num;
+        return true;
+    }
+    return false;
+}
+
 ObjMap *newObjMap(VM *vm);
 
+uint32_t hashValue(Value value);
+
 void mapSet(VM *vm, ObjMap *objMap, Value key, Value value);
 
-Value mapGet(ObjMap *objMap, Value key);
+Value mapGet(VM *vm, ObjMap *objMap, Value key);
 
 void clearMap(VM *vm, ObjMap *objMap);
 
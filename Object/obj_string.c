@@ -3,54 +3,617 @@
 #include "vm.h"
 #include "utils.h"
 #include "common.h"
+#include "unicodeUtf8.h"
 #include <stdlib.h>
 
-//fnv-1a算法
-uint32_t hashString(char *str, uint32_t length)
+//wyhash的常数
+static const uint64_t wyp0 = 0xa0761d6478bd642full;
+static const uint64_t wyp1 = 0xe7037ed1a0b428dbull;
+static const uint64_t wyp2 = 0x8ebc6af09c88c6e3ull;
+static const uint64_t wyp3 = 0x589965cc75374cc3ull;
+
+//64位乘法,a与b分别得到128位积的低64位与高64位
+static inline void wymum(uint64_t *a, uint64_t *b)
 {
-    uint32_t hashCode = 2166136261, idx = 0;
-    while (idx < length)
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    carry += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+//按机器字节序读取,哈希码只在进程内使用,不必跨平台一致
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+//wyhash算法,每次处理8字节,长串每轮处理48字节
+uint32_t hashString(const char *str, uint32_t length)
+{
+    const uint8_t *p = (const uint8_t *)str;
+    uint64_t seed = wymix(wyp0, wyp1);
+    uint64_t a, b;
+    if (length <= 16)
     {
-        hashCode ^= str[idx];
-        hashCode *= 16777619;
-        idx++;
+        if (length >= 4)
+        {
+            //两段各8字节,可以重叠,覆盖4到16字节
+            uint32_t mid = (length >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + mid);
+            b = (read32(p + length - 4) << 32) | read32(p + length - 4 - mid);
+        }
+        else if (length > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
     }
-    return hashCode;
+    else
+    {
+        uint32_t left = length;
+        if (left > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(read64(p) ^ wyp1, read64(p + 8) ^ seed);
+                see1 = wymix(read64(p + 16) ^ wyp2, read64(p + 24) ^ see1);
+                see2 = wymix(read64(p + 32) ^ wyp3, read64(p + 40) ^ see2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (left > 16)
+        {
+            seed = wymix(read64(p) ^ wyp1, read64(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        //最后16字节,可能与前面重叠
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
+    }
+    a ^= wyp1;
+    b ^= seed;
+    wymum(&a, &b);
+    uint64_t hash = wymix(a ^ wyp0 ^ length, b ^ wyp1);
+    
+    //哈希码为0表示尚未计算,因此不能返回0
+    uint32_t hashCode = (uint32_t)(hash ^ (hash >> 32));
+    return hashCode == 0 ? 1 : hashCode;
 }
 
 //为string计算哈希码并将值存储到string->hash
 void hashObjString(ObjString *objString)
 {
-    objString->hashCode =
+    objString->objHeader.hashCode =
         hashString(objString->value.start, objString->value.length);
 }
 
+//分配可容纳length个字符的ObjString,内容由调用者填写.
+//哈希码首次用到时才由stringHash计算
+ObjString *allocateObjString(VM *vm, uint32_t length)
+{
+    //+1是为了结尾的'\0'
+    ObjString *objString = ALLOCATE_EXTRA(vm, ObjString, length + 1);
+    if (objString == NULL)
+    {
+        MEM_ERROR("Allocating ObjString failed!");
+    }
+    initObjHeader(vm, &objString->objHeader, OT_STRING, vm->stringClass);
+    objString->isInterned = false;
+    objString->utf8 = UTF8_UNCHECKED;
+    objString->codePointIndex = NULL;
+    objString->kind = SK_INLINE;
+    objString->value.length = length;
+    objString->value.start = objString->chars;
+    objString->value.start[length] = '\0';
+    return objString;
+}
+
 //以str字符串创建ObjString对象,允许空串""
 ObjString *newObjString(VM *vm, const char *str, uint32_t length)
 {
     //length为0时str必为NULL length不为0时str不为NULL
     ASSERT(length == 0 || str != NULL, "str length don`t match str!");
     
-    //+1是为了结尾的'\0'
-    ObjString *objString = ALLOCATE_EXTRA(vm, ObjString, length + 1);
+    ObjString *objString = allocateObjString(vm, length);
     
-    if (objString != NULL)
+    //支持空字符串: str为null,length为0
+    //如果非空则复制其内容
+    if (length > 0)
+    {
+        memcpy(objString->value.start, str, length);
+    }
+    return objString;
+}
+
+//以chars为字符数据创建字符串,不复制.chars须是由memManager分配的length+1字节,
+//以'\0'结尾,此后归字符串所有,随字符串释放
+ObjString *newObjStringFromBuffer(VM *vm, char *chars, uint32_t length)
+{
+    ObjString *objString = ALLOCATE(vm, ObjString);
+    if (objString == NULL)
+    {
+        MEM_ERROR("Allocating ObjString failed!");
+    }
+    initObjHeader(vm, &objString->objHeader, OT_STRING, vm->stringClass);
+    objString->isInterned = false;
+    objString->utf8 = UTF8_UNCHECKED;
+    objString->codePointIndex = NULL;
+    objString->kind = SK_OWNED;
+    objString->value.length = length;
+    objString->value.start = chars;
+    return objString;
+}
+
+//创建表示left与right相加的rope,不复制字符.
+//哈希码首次用到时才计算,left和right须是可达的
+ObjString *newRope(VM *vm, ObjString *left, ObjString *right)
+{
+    ObjString *rope = ALLOCATE_EXTRA(vm, ObjString, sizeof(ObjString *) * 2);
+    if (rope == NULL)
     {
-        initObjHeader(vm, &objString->objHeader, OT_STRING, vm->stringClass);
-        objString->value.length = length;
-        
-        //支持空字符串: str为null,length为0
-        //如果非空则复制其内容
-        if (length > 0)
+        MEM_ERROR("Allocating ObjString failed!");
+    }
+    initObjHeader(vm, &rope->objHeader, OT_STRING, vm->stringClass);
+    rope->isInterned = false;
+    rope->utf8 = UTF8_UNCHECKED;
+    rope->codePointIndex = NULL;
+    rope->kind = SK_ROPE;
+    rope->value.length = left->value.length + right->value.length;
+    rope->value.start = NULL;
+    ROPE_LEFT(rope) = left;
+    ROPE_RIGHT(rope) = right;
+    return rope;
+}
+
+//把objString的字符依次复制到dest,不含结尾的'\0'.
+//objString可以是rope,拼接循环产生的rope很深,因此用栈代替递归
+void copyStringChars(ObjString *objString, char *dest)
+{
+    if (!STRING_IS_ROPE(objString))
+    {
+        memcpy(dest, objString->value.start, objString->value.length);
+        return;
+    }
+    
+    uint32_t capacity = 64, count = 0;
+    ObjString **stack = (ObjString **)malloc(sizeof(ObjString *) * capacity);
+    if (stack == NULL)
+    {
+        MEM_ERROR("Allocating rope stack failed!");
+    }
+    
+    stack[count++] = objString;
+    while (count > 0)
+    {
+        ObjString *node = stack[--count];
+        if (!STRING_IS_ROPE(node))
+        {
+            memcpy(dest, node->value.start, node->value.length);
+            dest += node->value.length;
+            continue;
+        }
+        if (count + 2 > capacity)
         {
-            memcpy(objString->value.start, str, length);
+            capacity *= 2;
+            stack = (ObjString **)realloc(stack, sizeof(ObjString *) * capacity);
+            if (stack == NULL)
+            {
+                MEM_ERROR("Allocating rope stack failed!");
+            }
         }
-        objString->value.start[length] = '\0';
-        hashObjString(objString);
+        //先压右边,使左边先出栈
+        stack[count++] = ROPE_RIGHT(node);
+        stack[count++] = ROPE_LEFT(node);
     }
-    else
+    free(stack);
+}
+
+//把rope的字符复制到新分配的缓冲区,rope就此变成普通字符串
+void flattenRope(VM *vm, ObjString *rope)
+{
+    //先分配缓冲区,期间的gc仍会经rope标记左右两部分
+    char *chars = ALLOCATE_ARRAY(vm, char, rope->value.length + 1);
+    if (chars == NULL)
+    {
+        MEM_ERROR("Allocating ObjString failed!");
+    }
+    copyStringChars(rope, chars);
+    chars[rope->value.length] = '\0';
+    rope->kind = SK_OWNED;
+    rope->value.start = chars;
+}
+
+//创建source中从offset起length个字节的子串.
+//子串较长时建成与父串共用字符的切片,不复制.source须是可达的
+ObjString *newStringSlice(VM *vm, ObjString *source, uint32_t offset, uint32_t length)
+{
+    ASSERT(offset + length <= source->value.length, "slice out of bound!");
+    flattenString(vm, source);
+    
+    //切片的父串总是持有字符的字符串,切片的切片直接指向最初的父串
+    ObjString *parent = source;
+    if (source->kind == SK_SLICE)
+    {
+        parent = SLICE_PARENT(source);
+        offset += (uint32_t)(source->value.start - parent->value.start);
+    }
+    
+    if (length < SLICE_MIN_LENGTH || length < parent->value.length / SLICE_MAX_RATIO)
+    {
+        return newObjString(vm, parent->value.start + offset, length);
+    }
+    
+    ObjString *slice = ALLOCATE_EXTRA(vm, ObjString, sizeof(ObjString *));
+    if (slice == NULL)
+    {
+        MEM_ERROR("Allocating ObjString failed!");
+    }
+    initObjHeader(vm, &slice->objHeader, OT_STRING, vm->stringClass);
+    slice->isInterned = false;
+    slice->utf8 = UTF8_UNCHECKED;
+    slice->codePointIndex = NULL;
+    slice->kind = SK_SLICE;
+    slice->value.length = length;
+    slice->value.start = parent->value.start + offset;
+    SLICE_PARENT(slice) = parent;
+    return slice;
+}
+
+//确保字符串的字符以'\0'结尾,以便传给C库函数.
+//展平rope;切片到父串结尾之前就结束的,复制一份自己的字符
+void terminateString(VM *vm, ObjString *objString)
+{
+    flattenString(vm, objString);
+    if (objString->kind != SK_SLICE ||
+        objString->value.start[objString->value.length] == '\0')
+    {
+        return;
+    }
+    char *chars = ALLOCATE_ARRAY(vm, char, objString->value.length + 1);
+    if (chars == NULL)
     {
         MEM_ERROR("Allocating ObjString failed!");
     }
+    memcpy(chars, objString->value.start, objString->value.length);
+    chars[objString->value.length] = '\0';
+    objString->kind = SK_OWNED;
+    objString->value.start = chars;
+}
+
+//检查字符串是否是合法的utf8编码,是否全是ascii字符,结果记在字符串中
+bool stringIsValidUtf8(ObjString *objString)
+{
+    ASSERT(!STRING_IS_ROPE(objString), "rope must be flattened first!");
+    if (objString->utf8 != UTF8_UNCHECKED)
+    {
+        return objString->utf8 != UTF8_INVALID;
+    }
+    
+    const uint8_t *chars = (const uint8_t *)objString->value.start;
+    uint32_t length = objString->value.length;
+    if (objString->kind == SK_SLICE)
+    {
+        //父串合法时,切片只要没有从字符中间开始或结束就是合法的,不必逐字节检查
+        ObjString *parent = SLICE_PARENT(objString);
+        const uint8_t *parentEnd = (const uint8_t *)parent->value.start + parent->value.length;
+        bool valid = stringIsValidUtf8(parent) &&
+            (length == 0 || !IS_UTF8_CONTINUATION(chars[0])) &&
+            (chars + length == parentEnd || !IS_UTF8_CONTINUATION(chars[length]));
+        objString->utf8 = !valid ? UTF8_INVALID :
+            parent->utf8 == UTF8_ASCII ? UTF8_ASCII : UTF8_VALID;
+        return valid;
+    }
+    
+    bool isAscii;
+    bool valid = validateUtf8(chars, length, &isAscii);
+    objString->utf8 = !valid ? UTF8_INVALID : isAscii ? UTF8_ASCII : UTF8_VALID;
+    return valid;
+}
+
+//字符串是否全是ascii字符
+bool stringIsAscii(ObjString *objString)
+{
+    stringIsValidUtf8(objString);
+    return objString->utf8 == UTF8_ASCII;
+}
+
+//建立码点索引.与迭代码点时一致,下标0和其后每个不是utf8后续字节的字节
+//都是一个码点的开始,因此不合法的utf8编码也能建立索引
+static void buildCodePointIndex(VM *vm, ObjString *objString)
+{
+    const uint8_t *chars = (const uint8_t *)objString->value.start;
+    uint32_t length = objString->value.length;
+    uint32_t count = countUtf8CodePoints(chars, length);
+    if (length > 0 && IS_UTF8_CONTINUATION(chars[0]))
+    {
+        count++;
+    }
+    
+    CodePointIndex *index = (CodePointIndex *)memManager(vm, NULL, 0, CODE_POINT_INDEX_SIZE(count));
+    if (index == NULL)
+    {
+        MEM_ERROR("Allocating CodePointIndex failed!");
+    }
+    index->count = count;
+    
+    uint32_t codePoint = 0, idx = 0;
+    while (idx < length)
+    {
+        if (idx == 0 || !IS_UTF8_CONTINUATION(chars[idx]))
+        {
+            if (codePoint % CODE_POINT_STRIDE == 0)
+            {
+                index->offsets[codePoint / CODE_POINT_STRIDE] = idx;
+            }
+            codePoint++;
+        }
+        idx++;
+    }
+    objString->codePointIndex = index;
+}
+
+//返回字符串的码点数.可能触发gc,objString须是可达的
+uint32_t stringCodePointCount(VM *vm, ObjString *objString)
+{
+    if (stringIsAscii(objString))
+    {
+        return objString->value.length;
+    }
+    if (objString->codePointIndex == NULL)
+    {
+        buildCodePointIndex(vm, objString);
+    }
+    return objString->codePointIndex->count;
+}
+
+//返回第index个码点的字节下标,index须小于码点数.
+//从索引中最近的记录往后走,最多走CODE_POINT_STRIDE-1个码点
+uint32_t stringCodePointOffset(VM *vm, ObjString *objString, uint32_t index)
+{
+    ASSERT(index < stringCodePointCount(vm, objString), "code point index out of bound!");
+    if (stringIsAscii(objString))
+    {
+        return index;
+    }
+    if (objString->codePointIndex == NULL)
+    {
+        buildCodePointIndex(vm, objString);
+    }
+    
+    const char *chars = objString->value.start;
+    uint32_t offset = objString->codePointIndex->offsets[index / CODE_POINT_STRIDE];
+    uint32_t remaining = index % CODE_POINT_STRIDE;
+    while (remaining > 0)
+    {
+        offset++;
+        while (IS_UTF8_CONTINUATION(chars[offset]))
+        {
+            offset++;
+        }
+        remaining--;
+    }
+    return offset;
+}
+
+void internTableInit(InternTable *table)
+{
+    table->strings = table->young = NULL;
+    table->count = table->capacity = 0;
+    table->youngCount = table->youngCapacity = 0;
+}
+
+//在驻留表中查找内容为str的字符串,未找到返回NULL
+static ObjString *findInterned(InternTable *table, const char *str, uint32_t length, uint32_t hashCode)
+{
+    if (table->capacity == 0)
+    {
+        return NULL;
+    }
+    uint32_t mask = table->capacity - 1;
+    uint32_t idx = hashCode & mask;
+    ObjString *objString;
+    while ((objString = table->strings[idx]) != NULL)
+    {
+        if (objString->objHeader.hashCode == hashCode &&
+            objString->value.length == length &&
+            (length == 0 || memcmp(objString->value.start, str, length) == 0))
+        {
+            return objString;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return NULL;
+}
+
+//把objString放入驻留表的空槽,调用者须保证其内容不在表中且表中有空槽
+static void insertInterned(InternTable *table, ObjString *objString)
+{
+    uint32_t mask = table->capacity - 1;
+    uint32_t idx = objString->objHeader.hashCode & mask;
+    while (table->strings[idx] != NULL)
+    {
+        idx = (idx + 1) & mask;
+    }
+    table->strings[idx] = objString;
+    table->count++;
+}
+
+//驻留表的装载因子保持在1/2以下
+static void growInternTable(InternTable *table)
+{
+    uint32_t oldCapacity = table->capacity;
+    ObjString **oldStrings = table->strings;
+    table->capacity = oldCapacity == 0 ? 64 : oldCapacity * 2;
+    table->strings = (ObjString **)calloc(table->capacity, sizeof(ObjString *));
+    if (table->strings == NULL)
+    {
+        MEM_ERROR("allocate intern table failed!");
+    }
+    table->count = 0;
+    uint32_t idx = 0;
+    while (idx < oldCapacity)
+    {
+        if (oldStrings[idx] != NULL)
+        {
+            insertInterned(table, oldStrings[idx]);
+        }
+        idx++;
+    }
+    free(oldStrings);
+}
+
+//把objString登记为驻留字符串
+static void addInterned(InternTable *table, ObjString *objString)
+{
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        growInternTable(table);
+    }
+    insertInterned(table, objString);
+    objString->isInterned = true;
+    
+    //新生代的字符串在minor gc时可能死去,单独记下
+    if (!objString->objHeader.isOld)
+    {
+        if (table->youngCount == table->youngCapacity)
+        {
+            table->youngCapacity = table->youngCapacity == 0 ? 64 : table->youngCapacity * 2;
+            table->young = (ObjString **)realloc(table->young, table->youngCapacity * sizeof(ObjString *));
+            if (table->young == NULL)
+            {
+                MEM_ERROR("allocate intern table failed!");
+            }
+        }
+        table->young[table->youngCount++] = objString;
+    }
+}
+
+//返回内容为str的驻留字符串,没有就新建一个
+ObjString *newInternedString(VM *vm, const char *str, uint32_t length)
+{
+    uint32_t hashCode = hashString(str, length);
+    ObjString *objString = findInterned(&vm->internTable, str, length, hashCode);
+    if (objString == NULL)
+    {
+        objString = newObjString(vm, str, length);
+        objString->objHeader.hashCode = hashCode;
+        addInterned(&vm->internTable, objString);
+    }
     return objString;
 }
+
+//返回与objString内容相同的驻留字符串,没有就把objString本身驻留
+ObjString *internString(VM *vm, ObjString *objString)
+{
+    if (objString->isInterned)
+    {
+        return objString;
+    }
+    flattenString(vm, objString);
+    ObjString *interned = findInterned(&vm->internTable, objString->value.start,
+        objString->value.length, stringHash(objString));
+    if (interned == NULL)
+    {
+        addInterned(&vm->internTable, objString);
+        interned = objString;
+    }
+    return interned;
+}
+
+//从驻留表中删除objString.线性探测表删除时要把后面同一探测链上的字符串前移填补空槽
+static void removeInterned(InternTable *table, ObjString *objString)
+{
+    uint32_t mask = table->capacity - 1;
+    uint32_t idx = objString->objHeader.hashCode & mask;
+    while (table->strings[idx] != objString)
+    {
+        idx = (idx + 1) & mask;
+    }
+    table->strings[idx] = NULL;
+    table->count--;
+    
+    uint32_t next = (idx + 1) & mask;
+    while (table->strings[next] != NULL)
+    {
+        //next处的字符串的理想槽位home不在(idx, next]之间时,才能前移到idx
+        uint32_t home = table->strings[next]->objHeader.hashCode & mask;
+        if (((next - home) & mask) >= ((next - idx) & mask))
+        {
+            table->strings[idx] = table->strings[next];
+            table->strings[next] = NULL;
+            idx = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+//gc标记结束后、清扫之前调用,从驻留表删除即将被回收的白字符串.
+//minor gc只回收新生代,只需检查上次gc后新驻留的字符串;
+//完整的标记结束后所有存活对象都已标记,要检查整个表
+void sweepInternTable(VM *vm, bool isMinor)
+{
+    InternTable *table = &vm->internTable;
+    uint32_t idx = 0;
+    if (isMinor)
+    {
+        while (idx < table->youngCount)
+        {
+            //驻留后才被增量清扫晋升的字符串已是老对象,不在本次回收之列
+            ObjHeader *header = &table->young[idx]->objHeader;
+            if (!header->isOld && !header->isDark)
+            {
+                removeInterned(table, table->young[idx]);
+            }
+            idx++;
+        }
+    }
+    else
+    {
+        while (idx < table->capacity)
+        {
+            ObjString *objString = table->strings[idx];
+            //前移可能把未检查的字符串移到当前槽,所以删除后原地再查一次
+            if (objString != NULL && !objString->objHeader.isDark)
+            {
+                removeInterned(table, objString);
+                continue;
+            }
+            idx++;
+        }
+    }
+    //幸存者此后都会成为老对象
+    table->youngCount = 0;
+}
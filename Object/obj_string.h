@@ -3,17 +3,132 @@
 
 #include "header_obj.h"
 
+//字符串的存储方式
+typedef enum
+{
+    SK_INLINE,  //字符在chars中
+    SK_OWNED,   //字符在单独分配的缓冲区中,随字符串释放
+    SK_ROPE,    //尚未展平的rope,value.start为NULL,chars中存放左右两部分
+    SK_SLICE    //与父串共用字符,chars中存放父串.切片不一定以'\0'结尾
+} StringKind;
+
+//字符串是否是合法的utf8编码,首次用到时才检查
+typedef enum
+{
+    UTF8_UNCHECKED,
+    UTF8_ASCII,    //全是ascii字符,字节下标就是码点下标
+    UTF8_VALID,
+    UTF8_INVALID
+} Utf8State;
+
+//码点索引中每隔多少个码点记录一次字节下标
+#define CODE_POINT_STRIDE 64
+
+//非ascii字符串的稀疏码点索引,首次按码点下标访问时建立
 typedef struct
+{
+    uint32_t count;      //码点数
+    uint32_t offsets[];  //第i*CODE_POINT_STRIDE个码点的字节下标
+} CodePointIndex;
+
+#define CODE_POINT_INDEX_SIZE(count) (sizeof(CodePointIndex) + \
+    sizeof(uint32_t) * (((count) + CODE_POINT_STRIDE - 1) / CODE_POINT_STRIDE))
+
+//字符串的哈希值存放在objHeader.hashCode中,首次用到时才计算.
+//字符串相加的结果较长时先不复制字符,而是建成记录左右两部分的rope,
+//首次按字节访问前由flattenString展平.
+//较长的子串不复制字符,而是指向父串字符的切片
+typedef struct objString
 {
     ObjHeader objHeader;
-    uint32_t hashCode;  //字符串的哈希值
+    bool isInterned;  //是否在驻留表中.内容相同的驻留字符串只有一个,可以直接比较地址
+    uint8_t kind;     //StringKind
+    uint8_t utf8;     //Utf8State
+    CodePointIndex *codePointIndex;  //尚未建立时为NULL,ascii字符串不需要
     CharValue value;
+    char chars[];
 } ObjString;
 
-uint32_t hashString(char *str, uint32_t length);
+//相加结果短于此长度时直接复制,不建rope
+#define ROPE_MIN_LENGTH 64
+
+//子串短于此长度,或不足父串的1/SLICE_MAX_RATIO时复制出来,
+//以免为很小的子串建切片,或者小切片使很大的父串无法回收
+#define SLICE_MIN_LENGTH 64
+#define SLICE_MAX_RATIO 8
+
+#define STRING_IS_ROPE(objString) ((objString)->kind == SK_ROPE)
+#define ROPE_LEFT(objString) (((ObjString **)(objString)->chars)[0])
+#define ROPE_RIGHT(objString) (((ObjString **)(objString)->chars)[1])
+#define SLICE_PARENT(objString) (((ObjString **)(objString)->chars)[0])
+
+//字符串驻留表:按内容查找唯一的字符串对象.
+//它是弱引用的,不会使字符串存活,gc时从中删除死去的字符串.
+//驻留表由gc维护,不经过memManager,以免增删时触发gc
+typedef struct
+{
+    ObjString **strings;  //开放定址的线性探测表,NULL为空槽
+    uint32_t count;
+    uint32_t capacity;    //0或2的幂
+    ObjString **young;    //上次gc后新驻留的新生代字符串,minor gc只需检查这些
+    uint32_t youngCount;
+    uint32_t youngCapacity;
+} InternTable;
+
+uint32_t hashString(const char *str, uint32_t length);
 
 void hashObjString(ObjString *objString);
 
+ObjString *allocateObjString(VM *vm, uint32_t length);
+
 ObjString *newObjString(VM *vm, const char *str, uint32_t length);
 
+ObjString *newObjStringFromBuffer(VM *vm, char *chars, uint32_t length);
+
+ObjString *newRope(VM *vm, ObjString *left, ObjString *right);
+
+void copyStringChars(ObjString *objString, char *dest);
+
+void flattenRope(VM *vm, ObjString *rope);
+
+ObjString *newStringSlice(VM *vm, ObjString *source, uint32_t offset, uint32_t length);
+
+void terminateString(VM *vm, ObjString *objString);
+
+bool stringIsValidUtf8(ObjString *objString);
+
+bool stringIsAscii(ObjString *objString);
+
+uint32_t stringCodePointCount(VM *vm, ObjString *objString);
+
+uint32_t stringCodePointOffset(VM *vm, ObjString *objString, uint32_t index);
+
+//按字节访问字符串之前调用,展平rope.可能触发gc,objString须是可达的.
+//需要以'\0'结尾的C字符串时改用terminateString
+static inline void flattenString(VM *vm, ObjString *objString)
+{
+    if (STRING_IS_ROPE(objString))
+    {
+        flattenRope(vm, objString);
+    }
+}
+
+//字符串的哈希码.创建字符串时不计算,很多字符串(如读入的文件内容)从不作为map的key
+static inline uint32_t stringHash(ObjString *objString)
+{
+    if (objString->objHeader.hashCode == 0)
+    {
+        hashObjString(objString);
+    }
+    return objString->objHeader.hashCode;
+}
+
+void internTableInit(InternTable *table);
+
+ObjString *newInternedString(VM *vm, const char *str, uint32_t length);
+
+ObjString *internString(VM *vm, ObjString *objString);
+
+void sweepInternTable(VM *vm, bool isMinor);
+
 #endif
@@ -0,0 +1,99 @@
+#include "obj_string_builder.h"
+#include <string.h>
+#include "vm.h"
+#include "gc.h"
+
+//buffer的最小容量
+#define MIN_BUILDER_CAPACITY 16
+
+//新建空的StringBuilder对象
+ObjStringBuilder *newObjStringBuilder(VM *vm)
+{
+    ObjStringBuilder *objBuilder = ALLOCATE(vm, ObjStringBuilder);
+    initObjHeader(vm, &objBuilder->objHeader, OT_STRING_BUILDER, vm->stringBuilderClass);
+    objBuilder->buffer = NULL;
+    objBuilder->length = objBuilder->capacity = 0;
+    objBuilder->result = NULL;
+    return objBuilder;
+}
+
+//在末尾预留length个字符的空间并返回其地址,调用者在其中写入字符.
+//可能触发gc,objBuilder须是可达的
+char *reserveStringBuilder(VM *vm, ObjStringBuilder *objBuilder, uint32_t length)
+{
+    //+1是为了结尾的'\0'
+    uint32_t needed = objBuilder->length + length + 1;
+    uint32_t newCapacity = needed < MIN_BUILDER_CAPACITY ?
+        MIN_BUILDER_CAPACITY : ceilToPowerOf2(needed);
+    if (objBuilder->result != NULL)
+    {
+        //buffer已归上次toString的结果所有,复制一份再修改
+        char *newBuffer = ALLOCATE_ARRAY(vm, char, newCapacity);
+        memcpy(newBuffer, objBuilder->buffer, objBuilder->length);
+        objBuilder->buffer = newBuffer;
+        objBuilder->capacity = newCapacity;
+        objBuilder->result = NULL;
+    }
+    else if (needed > objBuilder->capacity)
+    {
+        //容量按2的幂增长,追加的均摊开销为O(1)
+        objBuilder->buffer = (char *)memManager(vm, objBuilder->buffer,
+            objBuilder->capacity, newCapacity);
+        objBuilder->capacity = newCapacity;
+    }
+    char *dest = objBuilder->buffer + objBuilder->length;
+    objBuilder->length += length;
+    objBuilder->buffer[objBuilder->length] = '\0';
+    return dest;
+}
+
+//在末尾追加str的length个字符.str不能指向objBuilder自己的buffer
+void appendStringBuilder(VM *vm, ObjStringBuilder *objBuilder, const char *str, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    char *dest = reserveStringBuilder(vm, objBuilder, length);
+    memcpy(dest, str, length);
+}
+
+//以已追加的内容生成字符串.buffer收缩到恰好的大小后直接交给字符串,不复制字符
+ObjString *stringBuilderToString(VM *vm, ObjStringBuilder *objBuilder)
+{
+    if (objBuilder->result != NULL)
+    {
+        return objBuilder->result;
+    }
+    if (objBuilder->length == 0)
+    {
+        return newObjString(vm, NULL, 0);
+    }
+    
+    if (objBuilder->capacity != objBuilder->length + 1)
+    {
+        objBuilder->buffer = (char *)memManager(vm, objBuilder->buffer,
+            objBuilder->capacity, objBuilder->length + 1);
+        objBuilder->capacity = objBuilder->length + 1;
+    }
+    ObjString *result = newObjStringFromBuffer(vm, objBuilder->buffer, objBuilder->length);
+    objBuilder->result = result;
+    WRITE_BARRIER(vm, objBuilder);
+    return result;
+}
+
+//清空内容.buffer仍归自己所有时留着复用
+void clearStringBuilder(ObjStringBuilder *objBuilder)
+{
+    if (objBuilder->result != NULL)
+    {
+        objBuilder->buffer = NULL;
+        objBuilder->capacity = 0;
+        objBuilder->result = NULL;
+    }
+    else if (objBuilder->buffer != NULL)
+    {
+        objBuilder->buffer[0] = '\0';
+    }
+    objBuilder->length = 0;
+}
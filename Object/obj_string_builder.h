@@ -0,0 +1,27 @@
+#ifndef _OBJECT_STRING_BUILDER_H
+#define _OBJECT_STRING_BUILDER_H
+
+#include "obj_string.h"
+
+//可变的字符串缓冲区,追加的均摊开销为O(1).
+//toString把buffer直接交给结果字符串而不复制,此后再修改builder时才复制一份
+typedef struct
+{
+    ObjHeader objHeader;
+    char *buffer;       //已追加的字符,以'\0'结尾,尚未追加过时为NULL
+    uint32_t length;    //除结尾'\0'之外的字符个数
+    uint32_t capacity;  //buffer的大小
+    ObjString *result;  //上次toString的结果,不为NULL时buffer归它所有
+} ObjStringBuilder;
+
+ObjStringBuilder *newObjStringBuilder(VM *vm);
+
+char *reserveStringBuilder(VM *vm, ObjStringBuilder *objBuilder, uint32_t length);
+
+void appendStringBuilder(VM *vm, ObjStringBuilder *objBuilder, const char *str, uint32_t length);
+
+ObjString *stringBuilderToString(VM *vm, ObjStringBuilder *objBuilder);
+
+void clearStringBuilder(ObjStringBuilder *objBuilder);
+
+#endif
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "utils.h"
 #include "unicodeUtf8.h"
+#include "atod.h"
 #include <string.h>
 #include "obj_string.h"
 #include <ctype.h>
@@ -150,28 +151,58 @@ static void parseOctNum(Parser *parser)
     }
 }
 
+//把start开始的length个base进制数字转换为数字,超出uint64_t范围后按double累加
+static double digitsToNum(const char *start, uint32_t length, uint32_t base)
+{
+    uint64_t value = 0;
+    double bigValue = 0;
+    bool overflow = false;
+    uint32_t idx = 0;
+    while (idx < length)
+    {
+        char c = start[idx++];
+        uint32_t digit = isdigit(c) ? (uint32_t)(c - '0') : (uint32_t)(tolower(c) - 'a' + 10);
+        if (!overflow && value <= (UINT64_MAX - digit) / base)
+        {
+            value = value * base + digit;
+        }
+        else
+        {
+            if (!overflow)
+            {
+                bigValue = (double)value;
+                overflow = true;
+            }
+            bigValue = bigValue * base + digit;
+        }
+    }
+    return overflow ? bigValue : (double)value;
+}
+
 //解析八进制 十进制 十六进制 仅支持前缀形式,后缀形式不支持
 static void parseNum(Parser *parser)
 {
+    const char *start = parser->curToken.start;
     //十六进制的0x前缀
     if (parser->curChar == '0' && matchNextChar(parser, 'x'))
     {
         getNextChar(parser);  //跳过'x'
         parseHexNum(parser);   //解析十六进制数字
-        parser->curToken.value =
-            NUM_TO_VALUE(strtol(parser->curToken.start, NULL, 16));
+        parser->curToken.value = NUM_TO_VALUE(
+            digitsToNum(start + 2, (uint32_t)(parser->nextCharPtr - start - 3), 16));
     }
     else if (parser->curChar == '0'
         && isdigit(lookAheadChar(parser)))
     {  // 八进制
         parseOctNum(parser);
-        parser->curToken.value =
-            NUM_TO_VALUE(strtol(parser->curToken.start, NULL, 8));
+        parser->curToken.value = NUM_TO_VALUE(
+            digitsToNum(start, (uint32_t)(parser->nextCharPtr - start - 1), 8));
     }
     else
     {      //解析十进制
         parseDecNum(parser);
-        parser->curToken.value = NUM_TO_VALUE(strtod(parser->curToken.start, NULL));
+        parser->curToken.value = NUM_TO_VALUE(
+            decimalToDouble(start, (uint32_t)(parser->nextCharPtr - start - 1)));
     }
     //nextCharPtr会指向第1个不合法字符的下一个字符,因此-1
     parser->curToken.length =
@@ -305,7 +336,8 @@ static void parseString(Parser *parser)
     }
     
     //用识别到的字符串新建字符串对象存储到curToken的value中
-    ObjString *objString = newObjString(parser->vm, (const char *)str.datas, str.count);
+    //字符串字面量都驻留,相同的字面量共用一个对象
+    ObjString *objString = newInternedString(parser->vm, (const char *)str.datas, str.count);
     parser->curToken.value = OBJ_TO_VALUE(objString);
     ByteBufferClear(parser->vm, &str);
 }
@@ -605,8 +637,10 @@ void initParser(VM *vm, Parser *parser, const char *file,
     parser->curToken.type = TOKEN_UNKNOWN;
     parser->curToken.start = NULL;
     parser->curToken.length = 0;
+    parser->curToken.value = VT_TO_VALUE(VT_UNDEFINED);
     parser->preToken = parser->curToken;
     parser->interpolationExpectRightParenNum = 0;
     parser->vm = vm;
     parser->curModule = objModule;
+    parser->curCompileUnit = NULL;
 }
@@ -1,16 +1,66 @@
 #include "vm.h"
 #include <stdlib.h>
+#include <string.h>
 #include "core.h"
+#include "gc.h"
+
+//GCC与Clang支持标签地址(labels as values),执行指令时采用直接线索化分派.
+//定义NO_COMPUTED_GOTO可退回到可移植的switch分派
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
 //初始化虚拟机
 void initVM(VM *vm)
 {
+    slabInit(&vm->slab);
     vm->allocatedBytes = 0;
     vm->allObjects = NULL;
+    vm->oldObjects = NULL;
+    vm->survivedBytes = 0;
+    vm->markedBytes = 0;
+    vm->gcPhase = GC_IDLE;
+    vm->nextStepBytes = 0;
+    vm->unswept[0] = vm->unswept[1] = NULL;
+    vm->pauseStats.count = 0;
+    vm->pauseStats.maxPause = 0;
     vm->curParser = NULL;
-    StringBufferInit(&vm->allMethodNames);
+    vm->curThread = NULL;
+    vm->allModules = NULL;
+    symbolTableInit(&vm->allMethodNames);
+    internTableInit(&vm->internTable);
+    
+    vm->tmpRootNum = 0;
+    vm->grays.count = 0;
+    vm->grays.capacity = 32;
+    vm->grays.visited = 0;
+    //初始化灰色对象数组,它由gc自己维护,不经过memManager
+    vm->grays.grayObjects = (GrayEntry *)malloc(vm->grays.capacity * sizeof(GrayEntry));
+    if (vm->grays.grayObjects == NULL)
+    {
+        MEM_ERROR("allocate grayObjects failed!");
+    }
+    vm->remembered.count = 0;
+    vm->remembered.capacity = 32;
+    vm->remembered.objects = (ObjHeader **)malloc(vm->remembered.capacity * sizeof(ObjHeader *));
+    if (vm->remembered.objects == NULL)
+    {
+        MEM_ERROR("allocate remembered set failed!");
+    }
+#ifdef INLINE_CACHE
+    vm->inlineCacheStats = NULL;
+    vm->inlineCacheStatNum = 0;
+#endif
+    
+    vm->config.heapGrowthFactor = GC_HEAP_GROWTH_FACTOR;
+    vm->config.initialHeapSize = GC_INITIAL_HEAP_SIZE;
+    vm->config.minHeapSize = GC_MIN_HEAP_SIZE;
+    vm->config.nextGC = vm->config.initialHeapSize;
+    vm->config.nurserySize = GC_NURSERY_SIZE;
+    vm->config.stepSize = GC_STEP_SIZE;
+    vm->config.stepWork = GC_STEP_WORK;
+    
     vm->allModules = newObjMap(vm);
-    vm->curParser = NULL;
 }
 
 VM *newVM()
@@ -25,6 +75,21 @@ VM *newVM()
     return vm;
 }
 
+//把obj加入临时根,在其被挂到可达对象上之前避免被gc回收
+void pushTmpRoot(VM *vm, ObjHeader *obj)
+{
+    ASSERT(obj != NULL, "root obj is null");
+    ASSERT(vm->tmpRootNum < MAX_TEMP_ROOTS_NUM, "temporary roots too much!");
+    vm->tmpRoots[vm->tmpRootNum++] = obj;
+}
+
+//移除最近加入的临时根
+void popTmpRoot(VM *vm)
+{
+    ASSERT(vm->tmpRootNum > 0, "temporary roots too less!");
+    vm->tmpRootNum--;
+}
+
 //确保stack有效
 void ensureStack(VM *vm, ObjThread *objThread, uint32_t neededSlots)
 {
@@ -70,9 +135,9 @@ void ensureStack(VM *vm, ObjThread *objThread, uint32_t neededSlots)
     }
 }
 
-//为objClosure在objThread中创建运行时栈
+//为objClosure在objThread中创建运行时栈,maxStackSlotUsedNum是闭包所需的栈空间
 inline static void createFrame(VM *vm, ObjThread *objThread,
-    ObjClosure *objClosure, int argNum)
+    ObjClosure *objClosure, int argNum, uint32_t maxStackSlotUsedNum)
 {
     
     if (objThread->usedFrameNum + 1 > objThread->frameCapacity)
@@ -87,7 +152,7 @@ inline static void createFrame(VM *vm, ObjThread *objThread,
     //栈大小等于栈顶-栈底
     uint32_t stackSlots = (uint32_t)(objThread->esp - objThread->stack);
     //总共需要的栈大小
-    uint32_t neededSlots = stackSlots + objClosure->fn->maxStackSlotUsedNum;
+    uint32_t neededSlots = stackSlots + maxStackSlotUsedNum;
     
     ensureStack(vm, objThread, neededSlots);
     
@@ -96,7 +161,7 @@ inline static void createFrame(VM *vm, ObjThread *objThread,
 }
 
 //关闭在栈中slot为lastSlot及之上的upvalue
-static void closeUpvalue(ObjThread *objThread, Value *lastSlot)
+static void closeUpvalue(VM *vm, ObjThread *objThread, Value *lastSlot)
 {
     ObjUpvalue *upvalue = objThread->openUpvalues;
     while (upvalue != NULL && upvalue->localVarPtr >= lastSlot)
@@ -104,6 +169,7 @@ static void closeUpvalue(ObjThread *objThread, Value *lastSlot)
         //localVarPtr改指向本结构中的closedUpvalue
         upvalue->closedUpvalue = *(upvalue->localVarPtr);
         upvalue->localVarPtr = &(upvalue->closedUpvalue);
+        WRITE_BARRIER_VALUE(vm, upvalue, upvalue->closedUpvalue);
         
         upvalue = upvalue->next;
     }
@@ -164,6 +230,14 @@ static void validateSuperClass(VM *vm, Value classNameValue,
     uint32_t fieldNum, Value superClassValue)
 {
     
+    //类名由编译器以常量加载,指令来自字节码缓存时也须是合法的标识符
+    if (!VALUE_IS_OBJSTR(classNameValue) ||
+        VALUE_TO_OBJSTR(classNameValue)->value.length == 0 ||
+        VALUE_TO_OBJSTR(classNameValue)->value.length > MAX_ID_LEN)
+    {
+        RUN_ERROR("class name must be a valid identifier!");
+    }
+    
     //首先确保superClass的类型得是class
     if (!VALUE_IS_CLASS(superClassValue))
     {
@@ -198,7 +272,7 @@ static void validateSuperClass(VM *vm, Value classNameValue,
 }
 
 //修正部分指令操作数
-static void patchOperand(Class *class, ObjFn *fn)
+static void patchOperand(VM *vm, Class *class, ObjFn *fn)
 {
     int ip = 0;
     OpCode opCode;
@@ -236,6 +310,7 @@ static void patchOperand(Class *class, ObjFn *fn)
         {
             //指令流1: 2字节的method索引
             //指令流2: 2字节的基类常量索引
+            //指令流3: 定义了INLINE_CACHE时是2字节的内联缓存索引
             
             ip += 2; //跳过2字节的method索引
             uint32_t superClassIdx =
@@ -243,8 +318,9 @@ static void patchOperand(Class *class, ObjFn *fn)
             
             //回填在函数emitCallBySignature中的占位VT_TO_VALUE(VT_NULL)
             fn->constants.datas[superClassIdx] = OBJ_TO_VALUE(class->superClass);
+            WRITE_BARRIER(vm, fn);
             
-            ip += 2; //跳过2字节的基类索引
+            ip += 2 + INLINE_CACHE_OPERAND_BYTES; //跳过2字节的基类索引和内联缓存索引
             
             break;
         }
@@ -257,7 +333,7 @@ static void patchOperand(Class *class, ObjFn *fn)
             uint32_t fnIdx = (fn->instrStream.datas[ip] << 8) | fn->instrStream.datas[ip + 1];
             
             //递归进入该函数的指令流,继续为其中的super和field修正操作数
-            patchOperand(class, VALUE_TO_OBJFN(fn->constants.datas[fnIdx]));
+            patchOperand(vm, class, VALUE_TO_OBJFN(fn->constants.datas[fnIdx]));
             
             //ip-1是操作码OPCODE_CREATE_CLOSURE,
             //闭包中的参数涉及到upvalue,调用getBytesOfOperands获得参数字节数
@@ -278,6 +354,82 @@ static void patchOperand(Class *class, ObjFn *fn)
     }
 }
 
+#ifdef INLINE_CACHE
+//返回第index个方法的内联缓存统计项,方法第一次未命中时才为它扩容
+static InlineCacheStat *getInlineCacheStat(VM *vm, uint32_t index)
+{
+    if (index >= vm->inlineCacheStatNum)
+    {
+        uint32_t newNum = ceilToPowerOf2(index + 1);
+        vm->inlineCacheStats = (InlineCacheStat *)realloc(vm->inlineCacheStats,
+            newNum * sizeof(InlineCacheStat));
+        if (vm->inlineCacheStats == NULL)
+        {
+            MEM_ERROR("allocate inline cache stats failed!");
+        }
+        memset(vm->inlineCacheStats + vm->inlineCacheStatNum, 0,
+            (newNum - vm->inlineCacheStatNum) * sizeof(InlineCacheStat));
+        vm->inlineCacheStatNum = newNum;
+    }
+    return &vm->inlineCacheStats[index];
+}
+
+//内联缓存首项未命中时调用:在缓存项中查找类class的第index个方法,方法不存在时返回NULL.
+//仍未命中就查找方法表并填入缓存.类的方法被重新绑定过的缓存项已过期,原地重新填入.
+//缓存已满的调用点是megamorphic,结果放在scratch中返回
+static InlineCacheEntry *lookupInlineCache(VM *vm, ObjFn *fn,
+    InlineCache *cache, Class *class, uint32_t index, InlineCacheEntry *scratch)
+{
+    InlineCacheStat *stat = getInlineCacheStat(vm, index);
+    InlineCacheEntry *entry = scratch;
+    uint32_t idx = 0;
+    while (idx < cache->entryNum)
+    {
+        if (cache->entries[idx].class == class)
+        {
+            if (cache->entries[idx].methodVersion == class->methodVersion)
+            {
+                stat->hits++;
+                return &cache->entries[idx];
+            }
+            entry = &cache->entries[idx];
+            break;
+        }
+        idx++;
+    }
+    stat->misses++;
+    
+    if (index >= class->methods.count || class->methods.datas[index].type == MT_NONE)
+    {
+        return NULL;
+    }
+    
+    if (entry == scratch)
+    {
+        if (cache->entryNum < INLINE_CACHE_WAYS)
+        {
+            entry = &cache->entries[cache->entryNum++];
+        }
+        else
+        {
+            stat->megamorphicMisses++;
+        }
+    }
+    if (entry != scratch)
+    {
+        WRITE_BARRIER(vm, fn);
+    }
+    entry->class = class;
+    entry->method = class->methods.datas[index];
+    entry->methodVersion = class->methodVersion;
+    if (entry->method.type == MT_SCRIPT)
+    {
+        entry->maxStackSlotUsedNum = entry->method.obj->fn->maxStackSlotUsedNum;
+    }
+    return entry;
+}
+#endif
+
 //绑定方法和修正操作数
 static void bindMethodAndPatch(VM *vm, OpCode opCode,
     uint32_t methodIndex, Class *class, Value methodValue)
@@ -289,12 +441,18 @@ static void bindMethodAndPatch(VM *vm, OpCode opCode,
         class = class->objHeader.class;
     }
     
+    //只有object类没有基类,脚本不能为它定义方法
+    if (class->superClass == NULL)
+    {
+        RUN_ERROR("can`t bind method to class without superclass!");
+    }
+    
     Method method;
     method.type = MT_SCRIPT;
     method.obj = VALUE_TO_OBJCLOSURE(methodValue);
     
     //修正操作数
-    patchOperand(class, method.obj->fn);
+    patchOperand(vm, class, method.obj->fn);
     
     //修正过后,绑定method到class
     bindMethod(vm, class, methodIndex, method);
@@ -304,6 +462,8 @@ static void bindMethodAndPatch(VM *vm, OpCode opCode,
 VMResult executeInstruction(VM *vm, register ObjThread *curThread)
 {
     vm->curThread = curThread;
+    //线程的栈不经过写屏障,开始运行的线程要放入记忆集
+    WRITE_BARRIER(vm, curThread);
     register Frame *curFrame;
     register Value *stackStart;
     register uint8_t *ip;
@@ -334,12 +494,32 @@ VMResult executeInstruction(VM *vm, register ObjThread *curThread)
       ip = curFrame->ip; \
       fn = curFrame->closure->fn;
 
+#ifdef COMPUTED_GOTO
+    //各操作码对应的标签地址,由opcode.inc生成,与OpCode的顺序一致.
+    //每条指令执行完后直接跳到下一条指令的标签,不必都经过同一处分支
+#define OPCODE_SLOTS(opcode, effect) &&opcode_##opcode,
+    static void *opcodeLabels[] = {
+#include "opcode.inc"
+    };
+#undef OPCODE_SLOTS
+
+#define DISPATCH() \
+      do { \
+         opCode = READ_BYTE(); \
+         goto *opcodeLabels[opCode]; \
+      } while (0)
+
+#define DECODE DISPATCH();
+#define CASE(shortOpCode) opcode_##shortOpCode
+#define LOOP() DISPATCH()
+#else
 #define DECODE loopStart: \
       opCode = READ_BYTE();\
       switch (opCode)
 
 #define CASE(shortOpCode) case OPCODE_##shortOpCode
 #define LOOP() goto loopStart
+#endif
     
     LOAD_CUR_FRAME();
 DECODE
@@ -403,6 +583,38 @@ DECODE
             Value *args;
             Class *class;
             Method *method;
+#ifdef INLINE_CACHE
+            InlineCache *cache;
+            InlineCacheEntry *entry, scratchEntry;
+#endif
+        
+        //算术和比较指令的两个操作数都是数字时直接计算,
+        //否则按OPCODE_CALL1调用运算符方法,以支持类中重载的运算符
+        //指令流1: 2字节的method索引
+        //指令流2: 定义了INLINE_CACHE时是2字节的内联缓存索引
+#define NUM_BINARY_OP(shortOpCode, operator, type) \
+        CASE(shortOpCode): \
+            if (VALUE_IS_NUM(PEEK2()) && VALUE_IS_NUM(PEEK())) \
+            { \
+                double right = VALUE_TO_NUM(POP()); \
+                PEEK() = type##_TO_VALUE((VALUE_TO_NUM(PEEK()) operator right)); \
+                ip += 2 + INLINE_CACHE_OPERAND_BYTES; \
+                LOOP(); \
+            } \
+            argNum = 2; \
+            goto callMethod;
+        
+        NUM_BINARY_OP(ADD, +, NUM)
+        NUM_BINARY_OP(SUB, -, NUM)
+        NUM_BINARY_OP(MUL, *, NUM)
+        NUM_BINARY_OP(DIV, /, NUM)
+        NUM_BINARY_OP(LT, <, BOOL)
+        NUM_BINARY_OP(LE, <=, BOOL)
+        NUM_BINARY_OP(GT, >, BOOL)
+        NUM_BINARY_OP(GE, >=, BOOL)
+        NUM_BINARY_OP(EQ, ==, BOOL)
+        NUM_BINARY_OP(NEQ, !=, BOOL)
+#undef NUM_BINARY_OP
         
         CASE(CALL0):
         CASE(CALL1):
@@ -422,9 +634,11 @@ DECODE
         CASE(CALL15):
         CASE(CALL16):
             //指令流1: 2字节的method索引
+            //指令流2: 2字节的内联缓存索引
             //因为还有个隐式的receiver(就是下面的args[0]), 所以参数个数+1.
             argNum = opCode - OPCODE_CALL0 + 1;
-            
+        
+        callMethod:
             //读取2字节的数据(CALL指令的操作数),index是方法名的索引
             index = READ_SHORT();
             
@@ -454,6 +668,7 @@ DECODE
         CASE(SUPER16):
             //指令流1: 2字节的method索引
             //指令流2: 2字节的基类常量索引
+            //指令流3: 2字节的内联缓存索引
             
             //因为还有个隐式的receiver(就是下面的args[0]), 所以参数个数+1.
             argNum = opCode - OPCODE_SUPER0 + 1;
@@ -464,11 +679,31 @@ DECODE
             class = VALUE_TO_CLASS(fn->constants.datas[READ_SHORT()]);
         
         invokeMethod:
-            if ((uint32_t)index > class->methods.count ||
+#ifdef INLINE_CACHE
+            //先在本调用点的内联缓存中查找方法,首项命中是最常见的情况
+            cache = &fn->inlineCaches.datas[READ_SHORT()];
+            entry = &cache->entries[0];
+            if (entry->class == class && entry->methodVersion == class->methodVersion)
+            {
+                //首项填入时已经为此方法分配了统计项
+                vm->inlineCacheStats[index].hits++;
+            }
+            else
+            {
+                entry = lookupInlineCache(vm, fn, cache, class, index, &scratchEntry);
+            }
+            if (entry == NULL)
+            {
+                RUN_ERROR("method \"%s\" not found!", vm->allMethodNames.datas[index].str);
+            }
+            method = &entry->method;
+#else
+            if ((uint32_t)index >= class->methods.count ||
                 (method = &class->methods.datas[index])->type == MT_NONE)
             {
                 RUN_ERROR("method \"%s\" not found!", vm->allMethodNames.datas[index].str);
             }
+#endif
             
             switch (method->type)
             {
@@ -488,6 +723,8 @@ DECODE
                     //   2 或者切换了线程,此时vm->curThread已经被切换为新的线程
                     //保存线程的上下文环境,运行新线程之后还能回到当前老线程指令流的正确位置
                     STORE_CUR_FRAME();
+                    //被切换下去的线程在运行期间写入的栈不经过写屏障,放入记忆集
+                    WRITE_BARRIER(vm, curThread);
                     
                     if (!VALUE_IS_NULL(curThread->errorObj))
                     {
@@ -509,13 +746,19 @@ DECODE
                     //vm->curThread已经由返回false的函数置为下一个线程
                     //切换到下一个线程的上下文
                     curThread = vm->curThread;
+                    WRITE_BARRIER(vm, curThread);
                     LOAD_CUR_FRAME();
                 }
                 break;
             
             case MT_SCRIPT:
                 STORE_CUR_FRAME();
-                createFrame(vm, curThread, (ObjClosure *)method->obj, argNum);
+#ifdef INLINE_CACHE
+                createFrame(vm, curThread, (ObjClosure *)method->obj, argNum, entry->maxStackSlotUsedNum);
+#else
+                createFrame(vm, curThread, (ObjClosure *)method->obj, argNum,
+                    method->obj->fn->maxStackSlotUsedNum);
+#endif
                 LOAD_CUR_FRAME();   //加载最新的frame
                 break;
             
@@ -529,7 +772,7 @@ DECODE
                 }
                 
                 STORE_CUR_FRAME();
-                createFrame(vm, curThread, VALUE_TO_OBJCLOSURE(args[0]), argNum);
+                createFrame(vm, curThread, VALUE_TO_OBJCLOSURE(args[0]), argNum, objFn->maxStackSlotUsedNum);
                 LOAD_CUR_FRAME();   //加载最新的frame
                 break;
             
@@ -546,11 +789,16 @@ DECODE
         LOOP();
     
     CASE(STORE_UPVALUE):
+    {
         //栈顶: upvalue值
         //指令流: 1字节的upvalue索引
         
-        *((curFrame->closure->upvalues[READ_BYTE()])->localVarPtr) = PEEK();
+        ObjUpvalue *upvalue = curFrame->closure->upvalues[READ_BYTE()];
+        *(upvalue->localVarPtr) = PEEK();
+        //已关闭的upvalue值存储在upvalue自身中
+        WRITE_BARRIER_VALUE(vm, upvalue, PEEK());
         LOOP();
+    }
     
     CASE(LOAD_MODULE_VAR):
         //指令流: 2字节的模块变量索引
@@ -562,6 +810,7 @@ DECODE
         //栈顶: 模块变量值
         
         fn->module->moduleVarValue.datas[READ_SHORT()] = PEEK();
+        WRITE_BARRIER_VALUE(vm, fn->module, PEEK());
         LOOP();
     
     CASE(STORE_THIS_FIELD):
@@ -574,6 +823,7 @@ DECODE
         ObjInstance *objInstance = VALUE_TO_OBJINSTANCE(stackStart[0]);
         ASSERT(fieldIdx < objInstance->objHeader.class->fieldNum, "out of bounds field!");
         objInstance->fields[fieldIdx] = PEEK();
+        WRITE_BARRIER_VALUE(vm, objInstance, PEEK());
         LOOP();
     }
     
@@ -602,6 +852,7 @@ DECODE
         ObjInstance *objInstance = VALUE_TO_OBJINSTANCE(receiver);
         ASSERT(fieldIdx < objInstance->objHeader.class->fieldNum, "out of bounds field!");
         objInstance->fields[fieldIdx] = PEEK();
+        WRITE_BARRIER_VALUE(vm, objInstance, PEEK());
         LOOP();
     }
     
@@ -687,7 +938,7 @@ DECODE
     CASE(CLOSE_UPVALUE):
         //栈顶: 相当于局部变量
         //把地址大于栈顶局部变量的upvalue关闭
-        closeUpvalue(curThread, curThread->esp - 1);
+        closeUpvalue(vm, curThread, curThread->esp - 1);
         DROP();   //弹出栈顶局部变量
         LOOP();
     
@@ -702,7 +953,7 @@ DECODE
         curThread->usedFrameNum--;
         
         //关闭堆栈框架即此作用域内所有upvalue
-        closeUpvalue(curThread, stackStart);
+        closeUpvalue(vm, curThread, stackStart);
         
         //如果一个堆栈框架都没用,
         //说明它没有调用函数或者所有的函数调用都返回了,可以结束它
@@ -721,8 +972,10 @@ DECODE
             //恢复主调方线程的调度
             ObjThread *callerThread = curThread->caller;
             curThread->caller = NULL;
+            WRITE_BARRIER(vm, curThread);
             curThread = callerThread;
             vm->curThread = callerThread;
+            WRITE_BARRIER(vm, curThread);
             
             //在主调线程的栈顶存储被调线程的执行结果
             curThread->esp[-1] = retVal;
@@ -787,6 +1040,8 @@ DECODE
             }
             idx++;
         }
+        //创建upvalue时可能触发gc使闭包晋升为老对象
+        WRITE_BARRIER(vm, objClosure);
         
         LOOP();
     }
@@ -800,17 +1055,19 @@ DECODE
         Value superClass = curThread->esp[-1];  //基类名
         Value className = curThread->esp[-2];  //子类名
         
-        //回收基类所占的栈空间,
-        //次栈顶的空间暂时保留,创建的类会直接用该空间.
-        DROP();
-        
         //校验基类合法性,若不合法则停止运行
         validateSuperClass(vm, className, fieldNum, superClass);
         Class *class = newClass(vm, VALUE_TO_OBJSTR(className),
             fieldNum, VALUE_TO_CLASS(superClass));
         
-        //类存储于栈底
-        stackStart[0] = OBJ_TO_VALUE(class);
+        //回收基类所占的栈空间,
+        //次栈顶的空间暂时保留,创建的类会直接用该空间.
+        //创建类的过程中可能触发gc,故创建完成后才弹出基类
+        DROP();
+        
+        //类存储于原类名所在的次栈顶(现已是栈顶),
+        //类定义之前模块栈上可能还留有静态域等值,故不能假定是栈底
+        curThread->esp[-1] = OBJ_TO_VALUE(class);
         
         LOOP();
     }
@@ -824,6 +1081,12 @@ DECODE
         //获得方法名的索引
         uint32_t methodNameIndex = READ_SHORT();
         
+        //指令可能来自字节码缓存,绑定前确认操作数的类型
+        if (!VALUE_IS_CLASS(PEEK()) || !VALUE_IS_OBJCLOSURE(PEEK2()))
+        {
+            RUN_ERROR("method must be a closure bound to a class!");
+        }
+        
         //从栈顶中获得待绑定的类
         Class *class = VALUE_TO_CLASS(PEEK());
         
@@ -852,4 +1115,66 @@ DECODE
 #undef STORE_CUR_FRAME
 #undef READ_BYTE
 #undef READ_SHORT
+#undef DECODE
+#undef CASE
+#undef LOOP
+#ifdef COMPUTED_GOTO
+#undef DISPATCH
+#endif
+}
+
+//供原生代码同步调用脚本方法method,args[0]是接收者,其后是参数,共argNum个,返回值存入args[0].
+//方法在新线程中一直运行到返回,期间不能切换线程
+void callScriptMethod(VM *vm, ObjClosure *method, Value *args, uint32_t argNum)
+{
+    //每层调用占用一个临时根,嵌套过深时临时根会不够用
+    if (vm->tmpRootNum + 2 > MAX_TEMP_ROOTS_NUM)
+    {
+        RUN_ERROR("script method called from native code nested too deep!");
+    }
+    
+    //调用期间主调线程不再是当前线程,作为临时根保留,它的栈也要放入记忆集
+    ObjThread *callerThread = vm->curThread;
+    if (callerThread != NULL)
+    {
+        pushTmpRoot(vm, (ObjHeader *)callerThread);
+        WRITE_BARRIER(vm, callerThread);
+    }
+    
+    ObjThread *thread = newObjThread(vm, method);
+    pushTmpRoot(vm, (ObjHeader *)thread);
+    ensureStack(vm, thread, argNum + method->fn->maxStackSlotUsedNum);
+    popTmpRoot(vm);
+    
+    uint32_t idx = 0;
+    while (idx < argNum)
+    {
+        *thread->esp++ = args[idx++];
+    }
+    
+    //线程没有主调方,返回时结果留在stack[0]
+    executeInstruction(vm, thread);
+    
+    //方法以Thread.abort报错,或让出、挂起了线程而没有返回,都得不到返回值
+    if (!VALUE_IS_NULL(thread->errorObj))
+    {
+        if (VALUE_IS_OBJSTR(thread->errorObj))
+        {
+            RUN_ERROR("script method called from native code aborted: %s",
+                VALUE_TO_OBJSTR(thread->errorObj)->value.start);
+        }
+        RUN_ERROR("script method called from native code aborted!");
+    }
+    if (thread->usedFrameNum != 0)
+    {
+        RUN_ERROR("script method called from native code can`t yield or suspend its thread!");
+    }
+    args[0] = thread->stack[0];
+    
+    vm->curThread = callerThread;
+    if (callerThread != NULL)
+    {
+        popTmpRoot(vm);
+        WRITE_BARRIER(vm, callerThread);
+    }
 }
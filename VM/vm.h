@@ -6,6 +6,7 @@
 #include "obj_map.h"
 #include "obj_thread.h"
 #include "parser.h"
+#include "slab.h"
 
 //为定义在opcode.inc中的操作码加上前缀"OPCODE_"
 #define OPCODE_SLOTS(opcode, effect) OPCODE_##opcode,
@@ -22,11 +23,106 @@ typedef enum vmResult
 } VMResult;   //虚拟机执行结果
 //如果执行无误,可以将字符码输出到文件缓存,避免下次重新编译
 
+//以下gc参数可在编译时通过-D覆盖
+#ifndef GC_HEAP_GROWTH_FACTOR
+#define GC_HEAP_GROWTH_FACTOR 1.5   //堆生长因子
+#endif
+#ifndef GC_INITIAL_HEAP_SIZE
+#define GC_INITIAL_HEAP_SIZE (1024 * 1024 * 10)   //第一次触发gc的堆大小,10MB
+#endif
+#ifndef GC_MIN_HEAP_SIZE
+#define GC_MIN_HEAP_SIZE (1024 * 1024)   //gc阀值的下限,1MB
+#endif
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)   //新生代大小,新分配超过此值触发minor gc,256KB
+#endif
+#ifndef GC_STEP_SIZE
+#define GC_STEP_SIZE (16 * 1024)   //增量gc期间每分配这么多内存就推进一步,16KB
+#endif
+#ifndef GC_STEP_WORK
+#define GC_STEP_WORK 1000   //增量gc每一步最多标记的slot数或清扫的对象数
+#endif
+#ifndef GC_PAUSE_HISTORY
+#define GC_PAUSE_HISTORY 1024   //保留最近多少次gc暂停的时长
+#endif
+
+typedef enum
+{
+    GC_IDLE,    //没有进行中的gc
+    GC_MINOR,   //正在进行minor gc
+    GC_MARK,    //增量gc的标记阶段,期间暂停minor gc
+    GC_SWEEP    //增量gc的清扫阶段
+} GCPhase;
+
+typedef struct
+{
+    ObjHeader *obj;
+    //list和map可能分多步扫描,本次从第start个元素(entry)扫描到第end个之前,
+    //end为UINT32_MAX表示扫描到末尾
+    uint32_t start;
+    uint32_t end;
+    bool isCounted;   //对象大小已累计到markedBytes,续扫和重新扫描时不再累计
+    //重新扫描记忆集中的list:扫描范围取自list的[dirtyStart, dirtyEnd),
+    //进度也记在dirtyStart中,这样扫描期间新的写入只扩大范围,不会重复排队
+    bool isDirtyRange;
+} GrayEntry;
+
+typedef struct
+{
+    //gc中的灰对象(也是保留对象)数组
+    GrayEntry *grayObjects;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t visited;  //标灰时访问过的slot数,用于按slot数计算每步的工作量
+} Gray;
+
+typedef struct
+{
+    //记忆集:自上次gc以来被写入过引用的老对象,minor gc时需重新扫描
+    ObjHeader **objects;
+    uint32_t capacity;
+    uint32_t count;
+} RememberedSet;
+
+typedef struct
+{
+    //堆生长因子,下次gc的阀值为本次gc后存活对象大小乘以此因子
+    double heapGrowthFactor;
+    
+    //初始堆大小,默认为10MB
+    uint32_t initialHeapSize;
+    
+    //最小堆大小,默认为1MB
+    uint32_t minHeapSize;
+    
+    //下一次触发gc的堆大小,初始为initialHeapSize
+    uint32_t nextGC;
+    
+    //新生代大小,上次gc后新分配的内存超过此值就触发minor gc
+    uint32_t nurserySize;
+    
+    //增量gc期间,每分配stepSize字节推进一步,
+    //每步最多标记stepWork个slot,大的list和map分多步标记,或者最多清扫stepWork个对象
+    uint32_t stepSize;
+    uint32_t stepWork;
+} Configuration;
+
+typedef struct
+{
+    //最近GC_PAUSE_HISTORY次暂停的时长,单位微秒,环形存储
+    double pauses[GC_PAUSE_HISTORY];
+    uint32_t count;     //累计暂停次数
+    double maxPause;    //最长一次暂停
+} PauseStats;
+
+#define MAX_TEMP_ROOTS_NUM 8
+
 struct vm
 {
     Class *classOfClass;
     Class *objectClass;
     Class *stringClass;
+    Class *stringBuilderClass;
     Class *mapClass;
     Class *rangeClass;
     Class *listClass;
@@ -36,19 +132,51 @@ struct vm
     Class *fnClass;
     Class *threadClass;
     uint32_t allocatedBytes;  //累计已分配的内存量
-    ObjHeader *allObjects;  //所有已分配对象链表
+    ObjHeader *allObjects;  //新生代对象链表,即上次gc后分配的对象
+    ObjHeader *oldObjects;  //老生代对象链表,即经历过gc仍存活的对象
+    uint32_t survivedBytes; //上次gc后存活对象的大小
+    uint32_t markedBytes;   //本次gc已标记对象的大小
+    GCPhase gcPhase;
+    uint32_t nextStepBytes; //增量gc中allocatedBytes超过此值时推进一步
+    ObjHeader *unswept[2];  //标记阶段结束时的新生代和老生代,等待增量清扫
+    PauseStats pauseStats;
     SymbolTable allMethodNames;    //(所有)类的方法名
+    uint32_t hashCodeIndex;  //map对实例key回调的hashCode在allMethodNames中的索引
+    uint32_t equalIndex;     //同上,==(_)的索引
     ObjMap *allModules;
+    InternTable internTable;  //字符串驻留表
     ObjThread *curThread;   //当前正在执行的线程
     Parser *curParser;  //当前词法分析器
+    
+    //临时的根对象集合(数组),存储临时需要被GC保留的对象,避免回收
+    ObjHeader *tmpRoots[MAX_TEMP_ROOTS_NUM];
+    uint32_t tmpRootNum;
+    
+    //用于存储存活(保留)对象
+    Gray grays;
+    RememberedSet remembered;
+    Configuration config;
+    Slab slab;  //小对象的分配器
+#ifdef INLINE_CACHE
+    //按方法索引统计的内联缓存命中情况,由vm自己维护,不经过memManager,
+    //这样在方法调用中途扩容也不会触发gc
+    InlineCacheStat *inlineCacheStats;
+    uint32_t inlineCacheStatNum;
+#endif
 };
 
 void initVM(VM *vm);
 
 VM *newVM(void);
 
+void pushTmpRoot(VM *vm, ObjHeader *obj);
+
+void popTmpRoot(VM *vm);
+
 void ensureStack(VM *vm, ObjThread *objThread, uint32_t neededSlots);
 
 VMResult executeInstruction(VM *vm, register ObjThread *curThread);
 
+void callScriptMethod(VM *vm, ObjClosure *method, Value *args, uint32_t argNum);
+
 #endif
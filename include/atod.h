@@ -0,0 +1,10 @@
+#ifndef _INCLUDE_ATOD_H
+#define _INCLUDE_ATOD_H
+
+#include <stdint.h>
+
+uint32_t parseDecimal(const char *start, uint32_t length, double *num);
+
+double decimalToDouble(const char *start, uint32_t length);
+
+#endif
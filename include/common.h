@@ -14,6 +14,8 @@ typedef struct class Class;
 #define false  0
 #define UNUSED __attribute__ ((unused))
 
+#define VERSION "0.1.1"   //vm版本,字节码缓存按此区分
+
 #ifdef DEBUG
 #define ASSERT(condition, errMsg) \
       do {\
@@ -0,0 +1,342 @@
+#include "dtoa.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+
+//Grisu3算法(Florian Loitsch, Printing Floating-Point Numbers Quickly and Accurately with Integers):
+//用64位的近似浮点数DiyFp乘以缓存的10的幂,在整数域中逐位生成数字.
+//能确定结果最短且最接近时直接返回,否则(约0.5%的数)回退到逐个精度尝试的精确做法
+
+//f * 2^e
+typedef struct
+{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+//10^decimalExponent约等于significand * 2^binaryExponent
+typedef struct
+{
+    uint64_t significand;
+    int16_t binaryExponent;
+    int16_t decimalExponent;
+} CachedPower;
+
+//10^-348到10^340,每隔8个数量级一项,significand是四舍五入后的64位规格化值
+static const CachedPower cachedPowers[] = {
+    { 0xfa8fd5a0081c0288ull, -1220, -348 },
+    { 0xbaaee17fa23ebf76ull, -1193, -340 },
+    { 0x8b16fb203055ac76ull, -1166, -332 },
+    { 0xcf42894a5dce35eaull, -1140, -324 },
+    { 0x9a6bb0aa55653b2dull, -1113, -316 },
+    { 0xe61acf033d1a45dfull, -1087, -308 },
+    { 0xab70fe17c79ac6caull, -1060, -300 },
+    { 0xff77b1fcbebcdc4full, -1034, -292 },
+    { 0xbe5691ef416bd60cull, -1007, -284 },
+    { 0x8dd01fad907ffc3cull, -980, -276 },
+    { 0xd3515c2831559a83ull, -954, -268 },
+    { 0x9d71ac8fada6c9b5ull, -927, -260 },
+    { 0xea9c227723ee8bcbull, -901, -252 },
+    { 0xaecc49914078536dull, -874, -244 },
+    { 0x823c12795db6ce57ull, -847, -236 },
+    { 0xc21094364dfb5637ull, -821, -228 },
+    { 0x9096ea6f3848984full, -794, -220 },
+    { 0xd77485cb25823ac7ull, -768, -212 },
+    { 0xa086cfcd97bf97f4ull, -741, -204 },
+    { 0xef340a98172aace5ull, -715, -196 },
+    { 0xb23867fb2a35b28eull, -688, -188 },
+    { 0x84c8d4dfd2c63f3bull, -661, -180 },
+    { 0xc5dd44271ad3cdbaull, -635, -172 },
+    { 0x936b9fcebb25c996ull, -608, -164 },
+    { 0xdbac6c247d62a584ull, -582, -156 },
+    { 0xa3ab66580d5fdaf6ull, -555, -148 },
+    { 0xf3e2f893dec3f126ull, -529, -140 },
+    { 0xb5b5ada8aaff80b8ull, -502, -132 },
+    { 0x87625f056c7c4a8bull, -475, -124 },
+    { 0xc9bcff6034c13053ull, -449, -116 },
+    { 0x964e858c91ba2655ull, -422, -108 },
+    { 0xdff9772470297ebdull, -396, -100 },
+    { 0xa6dfbd9fb8e5b88full, -369, -92 },
+    { 0xf8a95fcf88747d94ull, -343, -84 },
+    { 0xb94470938fa89bcfull, -316, -76 },
+    { 0x8a08f0f8bf0f156bull, -289, -68 },
+    { 0xcdb02555653131b6ull, -263, -60 },
+    { 0x993fe2c6d07b7facull, -236, -52 },
+    { 0xe45c10c42a2b3b06ull, -210, -44 },
+    { 0xaa242499697392d3ull, -183, -36 },
+    { 0xfd87b5f28300ca0eull, -157, -28 },
+    { 0xbce5086492111aebull, -130, -20 },
+    { 0x8cbccc096f5088ccull, -103, -12 },
+    { 0xd1b71758e219652cull, -77, -4 },
+    { 0x9c40000000000000ull, -50, 4 },
+    { 0xe8d4a51000000000ull, -24, 12 },
+    { 0xad78ebc5ac620000ull, 3, 20 },
+    { 0x813f3978f8940984ull, 30, 28 },
+    { 0xc097ce7bc90715b3ull, 56, 36 },
+    { 0x8f7e32ce7bea5c70ull, 83, 44 },
+    { 0xd5d238a4abe98068ull, 109, 52 },
+    { 0x9f4f2726179a2245ull, 136, 60 },
+    { 0xed63a231d4c4fb27ull, 162, 68 },
+    { 0xb0de65388cc8ada8ull, 189, 76 },
+    { 0x83c7088e1aab65dbull, 216, 84 },
+    { 0xc45d1df942711d9aull, 242, 92 },
+    { 0x924d692ca61be758ull, 269, 100 },
+    { 0xda01ee641a708deaull, 295, 108 },
+    { 0xa26da3999aef774aull, 322, 116 },
+    { 0xf209787bb47d6b85ull, 348, 124 },
+    { 0xb454e4a179dd1877ull, 375, 132 },
+    { 0x865b86925b9bc5c2ull, 402, 140 },
+    { 0xc83553c5c8965d3dull, 428, 148 },
+    { 0x952ab45cfa97a0b3ull, 455, 156 },
+    { 0xde469fbd99a05fe3ull, 481, 164 },
+    { 0xa59bc234db398c25ull, 508, 172 },
+    { 0xf6c69a72a3989f5cull, 534, 180 },
+    { 0xb7dcbf5354e9beceull, 561, 188 },
+    { 0x88fcf317f22241e2ull, 588, 196 },
+    { 0xcc20ce9bd35c78a5ull, 614, 204 },
+    { 0x98165af37b2153dfull, 641, 212 },
+    { 0xe2a0b5dc971f303aull, 667, 220 },
+    { 0xa8d9d1535ce3b396ull, 694, 228 },
+    { 0xfb9b7cd9a4a7443cull, 720, 236 },
+    { 0xbb764c4ca7a44410ull, 747, 244 },
+    { 0x8bab8eefb6409c1aull, 774, 252 },
+    { 0xd01fef10a657842cull, 800, 260 },
+    { 0x9b10a4e5e9913129ull, 827, 268 },
+    { 0xe7109bfba19c0c9dull, 853, 276 },
+    { 0xac2820d9623bf429ull, 880, 284 },
+    { 0x80444b5e7aa7cf85ull, 907, 292 },
+    { 0xbf21e44003acdd2dull, 933, 300 },
+    { 0x8e679c2f5e44ff8full, 960, 308 },
+    { 0xd433179d9c8cb841ull, 986, 316 },
+    { 0x9e19db92b4e31ba9ull, 1013, 324 },
+    { 0xeb96bf6ebadf77d9ull, 1039, 332 },
+    { 0xaf87023b9bf0ee6bull, 1066, 340 },
+};
+
+#define CACHED_POWERS_OFFSET 348      //-cachedPowers[0].decimalExponent
+#define DECIMAL_EXPONENT_DISTANCE 8
+#define MIN_TARGET_EXPONENT (-60)     //放大后的二进制指数范围,保证整数部分能放进32位
+#define MAX_TARGET_EXPONENT (-32)
+#define D_1_LOG2_10 0.30102999566398114
+
+#define DOUBLE_SIGNIFICAND_MASK 0x000fffffffffffffull
+#define DOUBLE_HIDDEN_BIT 0x0010000000000000ull
+#define DOUBLE_EXPONENT_BIAS 1075     //1023 + 52
+#define DOUBLE_DENORMAL_EXPONENT (-1074)
+
+//两数相乘,结果取128位乘积的高64位并四舍五入
+static DiyFp diyFpMultiply(DiyFp x, DiyFp y)
+{
+    uint64_t a = x.f >> 32, b = x.f & 0xffffffff;
+    uint64_t c = y.f >> 32, d = y.f & 0xffffffff;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+    tmp += 1ull << 31;
+    DiyFp result = { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+    return result;
+}
+
+//左移到最高位为1
+static DiyFp diyFpNormalize(DiyFp x)
+{
+    int shift = __builtin_clzll(x.f);
+    x.f <<= shift;
+    x.e -= shift;
+    return x;
+}
+
+//把正数num拆成DiyFp,并求出与相邻两个double的中点m-和m+,
+//m+规格化后与规格化的num指数相同,m-按m+的指数对齐
+static DiyFp doubleToDiyFp(double num, DiyFp *minus, DiyFp *plus)
+{
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    uint64_t fraction = bits & DOUBLE_SIGNIFICAND_MASK;
+    int biasedExponent = (int)(bits >> 52) & 0x7ff;
+    
+    DiyFp v;
+    if (biasedExponent == 0)
+    {
+        v.f = fraction;
+        v.e = DOUBLE_DENORMAL_EXPONENT;
+    }
+    else
+    {
+        v.f = fraction | DOUBLE_HIDDEN_BIT;
+        v.e = biasedExponent - DOUBLE_EXPONENT_BIAS;
+    }
+    
+    DiyFp upper = { (v.f << 1) + 1, v.e - 1 };
+    *plus = diyFpNormalize(upper);
+    
+    //尾数为2的幂时,下面相邻的double离得更近(最小的规格化数除外)
+    if (fraction == 0 && biasedExponent > 1)
+    {
+        minus->f = (v.f << 2) - 1;
+        minus->e = v.e - 2;
+    }
+    else
+    {
+        minus->f = (v.f << 1) - 1;
+        minus->e = v.e - 1;
+    }
+    minus->f <<= minus->e - plus->e;
+    minus->e = plus->e;
+    return diyFpNormalize(v);
+}
+
+//取一个10的幂,使其与二进制指数为e的规格化数相乘后,指数落在目标范围内
+static DiyFp getCachedPower(int e, int *decimalExponent)
+{
+    int minExponent = MIN_TARGET_EXPONENT - (e + 64);
+    int k = (int)ceil((minExponent + 64 - 1) * D_1_LOG2_10);
+    int index = (CACHED_POWERS_OFFSET + k - 1) / DECIMAL_EXPONENT_DISTANCE + 1;
+    const CachedPower *power = &cachedPowers[index];
+    *decimalExponent = power->decimalExponent;
+    DiyFp result = { power->significand, power->binaryExponent };
+    return result;
+}
+
+//把最后一位往w方向调整,使结果最接近w,并判断结果能否保证正确.
+//unit是近似计算的误差单位,distanceTooHighW是上界到w的距离
+static bool roundWeed(char *buffer, uint32_t length, uint64_t distanceTooHighW,
+    uint64_t unsafeInterval, uint64_t rest, uint64_t tenKappa, uint64_t unit)
+{
+    uint64_t smallDistance = distanceTooHighW - unit;
+    uint64_t bigDistance = distanceTooHighW + unit;
+    while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+        (rest + tenKappa < smallDistance || smallDistance - rest >= rest + tenKappa - smallDistance))
+    {
+        buffer[length - 1]--;
+        rest += tenKappa;
+    }
+    
+    //在误差范围内仍可能继续调整时,无法确定哪个最接近
+    if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+        (rest + tenKappa < bigDistance || bigDistance - rest > rest + tenKappa - bigDistance))
+    {
+        return false;
+    }
+    return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+//在(low,high)中生成位数最少的数字串,kappa返回最后一位的十进制指数
+static bool digitGen(DiyFp low, DiyFp w, DiyFp high, char *buffer, uint32_t *length, int *kappa)
+{
+    uint64_t unit = 1;
+    DiyFp tooLow = { low.f - unit, low.e };
+    DiyFp tooHigh = { high.f + unit, high.e };
+    uint64_t unsafeInterval = tooHigh.f - tooLow.f;
+    int shift = -w.e;
+    uint64_t one = 1ull << shift;
+    uint32_t integrals = (uint32_t)(tooHigh.f >> shift);
+    uint64_t fractionals = tooHigh.f & (one - 1);
+    
+    uint32_t divisor = 1;
+    *kappa = 1;
+    while (divisor <= integrals / 10)
+    {
+        divisor *= 10;
+        (*kappa)++;
+    }
+    *length = 0;
+    
+    //先生成整数部分
+    while (*kappa > 0)
+    {
+        buffer[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        (*kappa)--;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafeInterval)
+        {
+            return roundWeed(buffer, *length, tooHigh.f - w.f, unsafeInterval,
+                rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    
+    //再生成小数部分,误差随之放大
+    while (true)
+    {
+        fractionals *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+        buffer[(*length)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafeInterval)
+        {
+            return roundWeed(buffer, *length, (tooHigh.f - w.f) * unit, unsafeInterval,
+                fractionals, one, unit);
+        }
+    }
+}
+
+//精确但较慢的做法:从1位有效数字开始逐个尝试,直到转换回来与num相等.
+//printf按当前精度正确舍入,因此最先成功的就是最短且最接近的表示
+static uint32_t fallbackDigits(double num, char *digits, int *exponent)
+{
+    char buf[40];
+    int precision = 1;
+    while (precision < DTOA_MAX_DIGITS)
+    {
+        snprintf(buf, sizeof(buf), "%.*e", precision - 1, num);
+        if (strtod(buf, NULL) == num)
+        {
+            break;
+        }
+        precision++;
+    }
+    if (precision == DTOA_MAX_DIGITS)
+    {
+        snprintf(buf, sizeof(buf), "%.*e", precision - 1, num);
+    }
+    
+    //形如d.ddde+XX,小数点可能因locale而不同,只取数字
+    uint32_t length = 0;
+    const char *cur = buf;
+    while (*cur != 'e')
+    {
+        if (*cur >= '0' && *cur <= '9')
+        {
+            digits[length++] = *cur;
+        }
+        cur++;
+    }
+    while (length > 1 && digits[length - 1] == '0')
+    {
+        length--;
+    }
+    *exponent = atoi(cur + 1) - (int)(precision - 1) + (int)(precision - length);
+    return length;
+}
+
+//求正数num往返不失真的最短十进制表示:num = digits * 10^exponent,
+//返回数字个数,不超过DTOA_MAX_DIGITS.有多个最短表示时取最接近num的
+uint32_t shortestDigits(double num, char *digits, int *exponent)
+{
+    DiyFp minus, plus;
+    DiyFp w = doubleToDiyFp(num, &minus, &plus);
+    
+    int mk;
+    DiyFp tenMk = getCachedPower(w.e, &mk);
+    DiyFp scaledW = diyFpMultiply(w, tenMk);
+    DiyFp scaledMinus = diyFpMultiply(minus, tenMk);
+    DiyFp scaledPlus = diyFpMultiply(plus, tenMk);
+    
+    //失败时生成的数字可能多于DTOA_MAX_DIGITS位,先写到足够大的缓冲区
+    char buffer[DTOA_MAX_DIGITS + 8];
+    uint32_t length;
+    int kappa;
+    if (digitGen(scaledMinus, scaledW, scaledPlus, buffer, &length, &kappa))
+    {
+        //放大了10^mk,最后一位的指数是kappa
+        memcpy(digits, buffer, length);
+        *exponent = kappa - mk;
+        return length;
+    }
+    return fallbackDigits(num, digits, exponent);
+}
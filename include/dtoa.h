@@ -0,0 +1,11 @@
+#ifndef _INCLUDE_DTOA_H
+#define _INCLUDE_DTOA_H
+
+#include <stdint.h>
+
+//往返不失真的最短表示最多需要17位有效数字
+#define DTOA_MAX_DIGITS 17
+
+uint32_t shortestDigits(double num, char *digits, int *exponent);
+
+#endif
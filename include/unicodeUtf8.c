@@ -1,5 +1,20 @@
 #include "unicodeUtf8.h"
-#include "common.h"
+#include <string.h>
+
+//向量化的utf8处理:有SSE2就用它跳过ascii、统计码点,
+//有SSSE3(SSE4)或AVX2时再用查表的方法一次校验一整块
+#if !defined(NO_SIMD)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define UTF8_SIMD_VALIDATE
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define UTF8_SIMD_VALIDATE
+#endif
+#endif
 
 //返回value按照utf8编码后的字节数
 uint32_t getByteNumOfEncodeUtf8(int value)
@@ -161,3 +176,358 @@ int decodeUtf8(const uint8_t *bytePtr, uint32_t length)
     }
     return value;
 }
+
+//返回bytes开头连续的ascii字节数.有SSE2时一次检查16字节,否则一次8字节
+uint32_t asciiPrefixLength(const uint8_t *bytes, uint32_t length)
+{
+    uint32_t idx = 0;
+#if defined(__SSE2__) && !defined(NO_SIMD)
+    while (idx + 16 <= length)
+    {
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + idx)));
+        if (mask != 0)
+        {
+            return idx + (uint32_t)__builtin_ctz(mask);
+        }
+        idx += 16;
+    }
+#endif
+    while (idx + 8 <= length)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + idx, sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0)
+        {
+            break;
+        }
+        idx += 8;
+    }
+    while (idx < length && bytes[idx] < 0x80)
+    {
+        idx++;
+    }
+    return idx;
+}
+
+//逐字节校验utf8编码,按RFC 3629拒绝超长编码、代理区及大于0x10ffff的码点
+static bool validateUtf8Scalar(const uint8_t *bytes, uint32_t length)
+{
+    uint32_t idx = 0;
+    while (idx < length)
+    {
+        uint8_t byte = bytes[idx];
+        if (byte < 0x80)
+        {
+            idx += asciiPrefixLength(bytes + idx, length - idx);
+            continue;
+        }
+        
+        //第2字节的合法范围,之后的字节都是0x80~0xbf
+        uint8_t low = 0x80, high = 0xbf;
+        uint32_t byteNum;
+        if (byte >= 0xc2 && byte <= 0xdf)
+        {
+            byteNum = 2;
+        }
+        else if (byte >= 0xe0 && byte <= 0xef)
+        {
+            byteNum = 3;
+            low = byte == 0xe0 ? 0xa0 : low;
+            high = byte == 0xed ? 0x9f : high;
+        }
+        else if (byte >= 0xf0 && byte <= 0xf4)
+        {
+            byteNum = 4;
+            low = byte == 0xf0 ? 0x90 : low;
+            high = byte == 0xf4 ? 0x8f : high;
+        }
+        else
+        {
+            return false;
+        }
+        
+        if (byteNum > length - idx || bytes[idx + 1] < low || bytes[idx + 1] > high)
+        {
+            return false;
+        }
+        uint32_t k = 2;
+        while (k < byteNum)
+        {
+            if (!IS_UTF8_CONTINUATION(bytes[idx + k]))
+            {
+                return false;
+            }
+            k++;
+        }
+        idx += byteNum;
+    }
+    return true;
+}
+
+#ifdef UTF8_SIMD_VALIDATE
+
+//Keiser和Lemire的查表校验法:用前一字节的高4位、低4位和当前字节的高4位
+//分别查表,三者按位与不为0就是错误;3、4字节编码的第3、4字节另外检查
+#define UTF8_TOO_SHORT      (1 << 0)
+#define UTF8_TOO_LONG       (1 << 1)
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+//按前一字节的高4位查
+static const uint8_t utf8Byte1High[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+//按前一字节的低4位查
+static const uint8_t utf8Byte1Low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+//按当前字节的高4位查
+static const uint8_t utf8Byte2High[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+//块的最后3字节若大于这些值,说明有字符延续到了下一块
+static const uint8_t utf8IncompleteMax[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+};
+
+#if defined(__AVX2__)
+typedef __m256i Utf8Block;
+#define UTF8_BLOCK 32
+#define blockLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define blockSplat(b) _mm256_set1_epi8((char)(b))
+#define blockTable(t) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t)))
+#define blockLookup(table, idx) _mm256_shuffle_epi8(table, idx)
+#define blockHigh(v) _mm256_and_si256(_mm256_srli_epi16(v, 4), blockSplat(0x0f))
+#define blockAnd _mm256_and_si256
+#define blockOr _mm256_or_si256
+#define blockXor _mm256_xor_si256
+#define blockSubs _mm256_subs_epu8
+#define blockMoveMask _mm256_movemask_epi8
+#define blockIsZero(v) _mm256_testz_si256(v, v)
+//当前块左移n字节,空出的位置用上一块末尾的字节填上
+#define blockPrev(cur, prev, n) \
+    _mm256_alignr_epi8(cur, _mm256_permute2x128_si256(prev, cur, 0x21), 16 - (n))
+#else
+typedef __m128i Utf8Block;
+#define UTF8_BLOCK 16
+#define blockLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define blockSplat(b) _mm_set1_epi8((char)(b))
+#define blockTable(t) _mm_loadu_si128((const __m128i *)(t))
+#define blockLookup(table, idx) _mm_shuffle_epi8(table, idx)
+#define blockHigh(v) _mm_and_si128(_mm_srli_epi16(v, 4), blockSplat(0x0f))
+#define blockAnd _mm_and_si128
+#define blockOr _mm_or_si128
+#define blockXor _mm_xor_si128
+#define blockSubs _mm_subs_epu8
+#define blockMoveMask _mm_movemask_epi8
+#define blockIsZero(v) (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff)
+#define blockPrev(cur, prev, n) _mm_alignr_epi8(cur, prev, 16 - (n))
+#endif
+
+//按块校验utf8编码.末尾不足一块的部分补0后再校验,
+//补的0是ascii,末尾被截断的字符因此会被当作过短的编码
+static bool validateUtf8Simd(const uint8_t *bytes, uint32_t length)
+{
+    Utf8Block byte1High = blockTable(utf8Byte1High);
+    Utf8Block byte1Low = blockTable(utf8Byte1Low);
+    Utf8Block byte2High = blockTable(utf8Byte2High);
+    Utf8Block incompleteMax = blockLoad(utf8IncompleteMax + 32 - UTF8_BLOCK);
+    Utf8Block error = blockSplat(0), prevInput = blockSplat(0), prevIncomplete = blockSplat(0);
+    uint8_t tail[UTF8_BLOCK];
+    uint32_t idx = 0;
+    
+    while (idx <= length)
+    {
+        Utf8Block input;
+        if (length - idx >= UTF8_BLOCK)
+        {
+            input = blockLoad(bytes + idx);
+        }
+        else
+        {
+            memset(tail, 0, UTF8_BLOCK);
+            memcpy(tail, bytes + idx, length - idx);
+            input = blockLoad(tail);
+        }
+        
+        if (blockMoveMask(input) == 0)
+        {
+            //整块都是ascii,只需检查上一块末尾有没有未完的字符
+            error = blockOr(error, prevIncomplete);
+            prevIncomplete = blockSplat(0);
+        }
+        else
+        {
+            Utf8Block prev1 = blockPrev(input, prevInput, 1);
+            Utf8Block special = blockAnd(blockAnd(
+                blockLookup(byte1High, blockHigh(prev1)),
+                blockLookup(byte1Low, blockAnd(prev1, blockSplat(0x0f)))),
+                blockLookup(byte2High, blockHigh(input)));
+            
+            //3、4字节编码的首字节后的第2、3字节必须是后续字节
+            Utf8Block prev2 = blockPrev(input, prevInput, 2);
+            Utf8Block prev3 = blockPrev(input, prevInput, 3);
+            Utf8Block must23 = blockOr(blockSubs(prev2, blockSplat(0xe0 - 0x80)),
+                blockSubs(prev3, blockSplat(0xf0 - 0x80)));
+            error = blockOr(error, blockXor(blockAnd(must23, blockSplat(0x80)), special));
+            prevIncomplete = blockSubs(input, incompleteMax);
+        }
+        prevInput = input;
+        idx += UTF8_BLOCK;
+    }
+    return blockIsZero(error);
+}
+
+#endif
+
+//校验bytes是否是合法的utf8编码,isAscii不为NULL时顺便返回是否全是ascii字符
+bool validateUtf8(const uint8_t *bytes, uint32_t length, bool *isAscii)
+{
+    uint32_t asciiLength = asciiPrefixLength(bytes, length);
+    if (isAscii != NULL)
+    {
+        *isAscii = asciiLength == length;
+    }
+    if (asciiLength == length)
+    {
+        return true;
+    }
+#ifdef UTF8_SIMD_VALIDATE
+    return validateUtf8Simd(bytes + asciiLength, length - asciiLength);
+#else
+    return validateUtf8Scalar(bytes + asciiLength, length - asciiLength);
+#endif
+}
+
+//返回bytes中码点的个数,即不是后续字节的字节数
+uint32_t countUtf8CodePoints(const uint8_t *bytes, uint32_t length)
+{
+    uint32_t count = 0, idx = 0;
+#if defined(__AVX2__) && !defined(NO_SIMD)
+    //后续字节作为有符号数是-128~-65.每字节的计数最多累加255次,再横向求和
+    while (length - idx >= 32)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        uint32_t rounds = 0;
+        while (rounds < 255 && length - idx >= 32)
+        {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + idx));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(block, _mm256_set1_epi8(-65)));
+            idx += 32;
+            rounds++;
+        }
+        uint64_t sums[4];
+        _mm256_storeu_si256((__m256i *)sums, _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+        count += (uint32_t)(sums[0] + sums[1] + sums[2] + sums[3]);
+    }
+#elif defined(__SSE2__) && !defined(NO_SIMD)
+    while (length - idx >= 16)
+    {
+        __m128i acc = _mm_setzero_si128();
+        uint32_t rounds = 0;
+        while (rounds < 255 && length - idx >= 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(bytes + idx));
+            acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(block, _mm_set1_epi8(-65)));
+            idx += 16;
+            rounds++;
+        }
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (uint32_t)(_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+    }
+#endif
+    while (idx < length)
+    {
+        count += !IS_UTF8_CONTINUATION(bytes[idx]);
+        idx++;
+    }
+    return count;
+}
+
+//把bytes解码成码点写入codePoints,返回写入的个数.
+//与字符串迭代一致,开头和每个不是后续字节的字节各开始一个码点,不能解码的写入-1.
+//ascii字节直接展宽,有SSE2时一次处理16字节
+uint32_t utf8ToCodePoints(const uint8_t *bytes, uint32_t length, int *codePoints)
+{
+    uint32_t count = 0, idx = 0;
+    while (idx < length)
+    {
+        if (bytes[idx] >= 0x80)
+        {
+            codePoints[count++] = decodeUtf8(bytes + idx, length - idx);
+            do
+            {
+                idx++;
+            } while (idx < length && IS_UTF8_CONTINUATION(bytes[idx]));
+            continue;
+        }
+        
+        uint32_t end = idx + asciiPrefixLength(bytes + idx, length - idx);
+#if defined(__SSE2__) && !defined(NO_SIMD)
+        __m128i zero = _mm_setzero_si128();
+        while (end - idx >= 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(bytes + idx));
+            __m128i low = _mm_unpacklo_epi8(block, zero);
+            __m128i high = _mm_unpackhi_epi8(block, zero);
+            __m128i *out = (__m128i *)(codePoints + count);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(low, zero));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low, zero));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high, zero));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high, zero));
+            idx += 16;
+            count += 16;
+        }
+#endif
+        while (idx < end)
+        {
+            codePoints[count++] = bytes[idx++];
+        }
+
+        //紧跟在ascii后的后续字节属于前一个码点
+        while (idx < length && IS_UTF8_CONTINUATION(bytes[idx]))
+        {
+            idx++;
+        }
+    }
+    return count;
+}
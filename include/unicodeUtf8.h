@@ -2,6 +2,10 @@
 #define _INCLUDE_UTF8_H
 
 #include <stdint.h>
+#include "common.h"
+
+//utf8编码字节中的后续字节,形如10xxxxxx
+#define IS_UTF8_CONTINUATION(byte) (((uint8_t)(byte) & 0xc0) == 0x80)
 
 uint32_t getByteNumOfEncodeUtf8(int value);
 
@@ -11,4 +15,12 @@ uint8_t encodeUtf8(uint8_t *buf, int value);
 
 int decodeUtf8(const uint8_t *bytePtr, uint32_t length);
 
+uint32_t asciiPrefixLength(const uint8_t *bytes, uint32_t length);
+
+bool validateUtf8(const uint8_t *bytes, uint32_t length, bool *isAscii);
+
+uint32_t countUtf8CodePoints(const uint8_t *bytes, uint32_t length);
+
+uint32_t utf8ToCodePoints(const uint8_t *bytes, uint32_t length, int *codePoints);
+
 #endif
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include "vm.h"
 #include "parser.h"
+#include "gc.h"
 #include <stdlib.h>
 #include <stdarg.h>
 
@@ -11,16 +12,47 @@
 void *memManager(VM *vm, void *ptr, uint32_t oldSize, uint32_t newSize)
 {
     //累计系统分配的总内存
-    vm->allocatedBytes += newSize - oldSize;
+    //gc后allocatedBytes只统计了存活对象,释放时要避免其下溢
+    if (newSize >= oldSize)
+    {
+        vm->allocatedBytes += newSize - oldSize;
+    }
+    else
+    {
+        uint32_t freed = oldSize - newSize;
+        vm->allocatedBytes = vm->allocatedBytes > freed ? vm->allocatedBytes - freed : 0;
+    }
     
     //避免realloc(NULL, 0)定义的新地址,此地址不能被释放
     if (newSize == 0)
     {
+#ifdef USE_SYSTEM_ALLOCATOR
         free(ptr);
+#else
+        slabFree(&vm->slab, ptr);
+#endif
         return NULL;
     }
     
+    //在分配内存时若达到了GC触发的阀值则开始一轮增量垃圾回收,
+    //回收进行期间按分配量逐步推进.否则若新生代已满则只回收新生代
+    if (vm->gcPhase == GC_IDLE ?
+        vm->allocatedBytes > vm->config.nextGC : vm->allocatedBytes > vm->nextStepBytes)
+    {
+        stepGC(vm);
+    }
+    else if (vm->gcPhase != GC_MARK &&
+        vm->allocatedBytes > vm->survivedBytes + vm->config.nurserySize)
+    {
+        startMinorGC(vm);
+    }
+    
+    //小对象由slab分配,定义USE_SYSTEM_ALLOCATOR时全部交给系统分配器,便于对比
+#ifdef USE_SYSTEM_ALLOCATOR
     return realloc(ptr, newSize);
+#else
+    return slabRealloc(&vm->slab, ptr, oldSize, newSize);
+#endif
 }
 
 // 找出大于等于v最近的2次幂
@@ -45,14 +77,24 @@ DEFINE_BUFFER_METHOD(Char)
 
 DEFINE_BUFFER_METHOD(Byte)
 
-void symbolTableClear(VM *vm, SymbolTable *buffer)
+void symbolTableInit(SymbolTable *table)
+{
+    table->datas = NULL;
+    table->count = table->capacity = 0;
+    table->hashIndex = NULL;
+    table->hashCapacity = 0;
+}
+
+void symbolTableClear(VM *vm, SymbolTable *table)
 {
     uint32_t idx = 0;
-    while (idx < buffer->count)
+    while (idx < table->count)
     {
-        memManager(vm, buffer->datas[idx++].str, 0, 0);
+        memManager(vm, table->datas[idx++].str, 0, 0);
     }
-    StringBufferClear(vm, buffer);
+    memManager(vm, table->datas, table->capacity * sizeof(String), 0);
+    memManager(vm, table->hashIndex, table->hashCapacity * sizeof(uint32_t), 0);
+    symbolTableInit(table);
 }
 
 //通用报错函数
@@ -30,7 +30,7 @@ typedef struct
 typedef struct
 {
     uint32_t length; //除结束'\0'之外的字符个数
-    char start[];  //类似c99中的柔性数组
+    char *start;     //以'\0'结尾的字符数据
 } CharValue;  //字符串缓冲区
 
 //声明buffer类型
@@ -85,7 +85,17 @@ typedef struct
 
 DECLARE_BUFFER_TYPE(String)
 
-#define SymbolTable StringBuffer
+//符号表:datas按索引稠密存放各符号,
+//hashIndex是开放定址的哈希索引,每个槽存放符号的索引加1,0表示空槽
+typedef struct
+{
+    String *datas;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *hashIndex;
+    uint32_t hashCapacity;  //哈希索引的槽数,为0或2的幂
+} SymbolTable;
+
 typedef uint8_t Byte;
 typedef char Char;
 typedef int Int;
@@ -107,7 +117,9 @@ typedef enum
 void errorReport(void *parser,
     ErrorType errorType, const char *fmt, ...);
 
-void symbolTableClear(VM *, SymbolTable *buffer);
+void symbolTableInit(SymbolTable *table);
+
+void symbolTableClear(VM *, SymbolTable *table);
 
 #define IO_ERROR(...)\
    errorReport(NULL, ERROR_IO, __VA_ARGS__)